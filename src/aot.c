@@ -0,0 +1,485 @@
+#include <unistd.h>
+
+#include "engine_aot.h"
+#include "profile.h"
+
+// longest block translated, the same limit the JIT has
+#define MAX_BLOCK_INSTRUCTIONS 64
+
+static void usage(void) {
+    fprintf(stderr, "Usage: chip8-aot [-q quirks] [-o file] [-d] <ROM file>\n"
+                    "  -q  modern, cosmac, chip48, superchip or xochip, overriding the ROM's\n"
+                    "  -o  write the C translation here rather than to stdout\n"
+                    "  -d  print the disassembly of the code that was found instead\n");
+    exit(1);
+}
+
+// What chip8-aot learnt about the ROM
+typedef struct Program {
+    const Chip8 *chip8;
+    const C8Quirks *quirks;
+    bool reached[CODE_MEM_SIZE]; // an instruction starts here
+    bool leader[CODE_MEM_SIZE];  // and so does a block
+    size_t instructions;
+    size_t blocks;
+} Program;
+
+static uint16_t opcode_at(const Program *prog, uint16_t pc) {
+    return prog->chip8->ram[pc] << 8 | prog->chip8->ram[pc + 1];
+}
+
+// Whether pc can end up anywhere but the next instruction, which ends the block
+static bool ends_block(const C8Quirks *quirks, uint16_t opcode) {
+    bool xo = quirks->ext == C8_EXT_XOCHIP;
+
+    switch(opcode & 0xF000) {
+        case 0x0000:
+            // the reference decodes 0NE0 and 0NEE on the low byte alone
+            return op_NN(opcode) == 0xEE || (quirks->ext != C8_EXT_NONE && opcode == 0x00FD);
+        case 0x5000:
+            return !xo || (op_N(opcode) != 2 && op_N(opcode) != 3);
+        case 0x1000:
+        case 0x2000:
+        case 0x3000:
+        case 0x4000:
+        case 0x9000:
+        case 0xB000:
+            return true;
+        case 0xE000:
+            return op_NN(opcode) == 0x9E || op_NN(opcode) == 0xA1;
+        case 0xF000:
+            return (xo && opcode == 0xF000) || op_NN(opcode) == 0x0A;
+        default:
+            return false;
+    }
+}
+
+// Where the instruction at pc can send pc, as far as that's known without
+// running it. Returns how many of next are set, BNNN and 00EE have none.
+static int successors(const Program *prog, uint16_t pc, uint16_t next[3]) {
+    uint16_t opcode = opcode_at(prog, pc);
+
+    if(!ends_block(prog->quirks, opcode)) {
+        next[0] = pc + 2;
+        return 1;
+    }
+
+    switch(opcode & 0xF000) {
+        case 0x0000:
+        case 0xB000:
+            return 0;
+        case 0x1000:
+            next[0] = op_NNN(opcode);
+            return 1;
+        case 0x2000:
+            next[0] = op_NNN(opcode);
+            next[1] = pc + 2;
+            return 2;
+        case 0xF000:
+            next[0] = opcode == 0xF000 ? pc + 4 : pc + 2;
+            return 1;
+        default:
+            // skips, which on XO-CHIP step over all of F000 NNNN
+            next[0] = pc + 2;
+            next[1] = pc + 4;
+            next[2] = pc + 6;
+            return prog->quirks->ext == C8_EXT_XOCHIP ? 3 : 2;
+    }
+}
+
+// Follows every jump, call, return site and skip from PROG_START_ADDR, marking
+// the instructions reached and where blocks start. Code only reached through
+// BNNN isn't found and is left to the reference interpreter.
+static void discover(Program *prog) {
+    static uint16_t work[CODE_MEM_SIZE];
+    size_t pending = 0;
+
+    work[pending++] = PROG_START_ADDR;
+    prog->leader[PROG_START_ADDR] = true;
+
+    while(pending > 0) {
+        uint16_t pc = work[--pending];
+
+        while(pc <= CODE_MEM_SIZE - 2 && !prog->reached[pc]) {
+            prog->reached[pc] = true;
+            prog->instructions++;
+
+            uint16_t next[3];
+            int count = successors(prog, pc, next);
+            if(!ends_block(prog->quirks, opcode_at(prog, pc))) {
+                pc = next[0];
+                continue;
+            }
+
+            for(int i = 0; i < count; i++) {
+                if(next[i] > CODE_MEM_SIZE - 2 || prog->leader[next[i]]) {
+                    continue;
+                }
+                prog->leader[next[i]] = true;
+                work[pending++] = next[i];
+            }
+            break;
+        }
+    }
+
+    for(uint32_t pc = 0; pc < CODE_MEM_SIZE; pc++) {
+        prog->blocks += prog->leader[pc];
+    }
+}
+
+static void disassemble(const Program *prog, FILE *out) {
+    for(uint32_t pc = 0; pc <= CODE_MEM_SIZE - 2; pc++) {
+        if(!prog->reached[pc]) {
+            continue;
+        }
+        uint16_t opcode = opcode_at(prog, pc);
+        fprintf(out, "%c %03x  %04x  %s\n", prog->leader[pc] ? '>' : ' ', pc, opcode,
+                c8_op_class_name(c8_op_class(opcode)));
+    }
+}
+
+// The instruction the k-th of its block runs through the reference
+// interpreter, leaving the block afterwards when it ends it or stored into code
+static void emit_interpret(FILE *out, uint16_t start, uint16_t pc, uint32_t k, bool ends) {
+    if(ends) {
+        fprintf(out, "    c8_aot_interpret(chip8, aot, 0x%03x);\n    C8_AOT_EXIT(0x%03x, %u)\n",
+                pc, start, k + 1);
+    } else {
+        fprintf(out,
+                "    if(c8_aot_interpret(chip8, aot, 0x%03x)) {\n        return ran + %u;\n    }\n",
+                pc, k + 1);
+    }
+}
+
+static void emit_skip(FILE *out, const char *cond, uint16_t start, uint16_t pc, uint32_t k) {
+    fprintf(out, "    chip8->pc = %s ? 0x%03x : 0x%03x;\n    C8_AOT_EXIT(0x%03x, %u)\n", cond,
+            pc + 4, pc + 2, start, k + 1);
+}
+
+// Translates the k-th instruction of a block into statements that do what
+// the reference interpreter does with the default quirks. Anything the
+// machine's quirks change, and anything complicated, goes through the
+// reference interpreter itself. Returns true when the instruction ended the block.
+static bool emit_instruction(FILE *out, const C8Quirks *quirks, uint16_t opcode,
+                             uint16_t start, uint16_t pc, uint32_t k) {
+    uint8_t x = op_X(opcode);
+    uint8_t y = op_Y(opcode);
+    uint8_t nn = op_NN(opcode);
+    uint16_t nnn = op_NNN(opcode);
+    bool ends = ends_block(quirks, opcode);
+    char cond[64];
+
+    if(c8_quirks_affect(quirks, opcode)) {
+        emit_interpret(out, start, pc, k, ends);
+        return ends;
+    }
+
+    switch(opcode & 0xF000) {
+        case 0x0000:
+            if(op_NN(opcode) == 0xE0) {
+                fprintf(out, "    c8_clear_screen(chip8);\n");
+            } else if(op_NN(opcode) == 0xEE) {
+                fprintf(out,
+                        "    chip8->sp--;\n"
+                        "    if(chip8->sp >= STACK_SIZE) {\n"
+                        "        chip8->pc = 0x%03x;\n"
+                        "        c8_fault(chip8, C8_FAULT_STACK);\n"
+                        "    }\n"
+                        "    chip8->pc = chip8->stack[chip8->sp %% STACK_SIZE] + 2;\n"
+                        "    C8_AOT_EXIT(0x%03x, %u)\n",
+                        pc, start, k + 1);
+            }
+            return ends;
+
+        case 0x1000:
+            fprintf(out, "    chip8->pc = 0x%03x;\n    C8_AOT_EXIT(0x%03x, %u)\n", nnn, start,
+                    k + 1);
+            return true;
+
+        case 0x2000:
+            fprintf(out,
+                    "    if(chip8->sp >= STACK_SIZE) {\n"
+                    "        chip8->pc = 0x%03x;\n"
+                    "        c8_fault(chip8, C8_FAULT_STACK);\n"
+                    "    }\n"
+                    "    chip8->stack[chip8->sp++ %% STACK_SIZE] = 0x%03x;\n"
+                    "    chip8->pc = 0x%03x;\n"
+                    "    C8_AOT_EXIT(0x%03x, %u)\n",
+                    pc, pc, nnn, start, k + 1);
+            return true;
+
+        case 0x3000:
+        case 0x4000:
+            snprintf(cond, sizeof cond, "chip8->V[0x%X] %s 0x%02x",
+                     x, (opcode & 0xF000) == 0x3000 ? "==" : "!=", nn);
+            emit_skip(out, cond, start, pc, k);
+            return true;
+
+        case 0x5000:
+        case 0x9000:
+            snprintf(cond, sizeof cond, "chip8->V[0x%X] %s chip8->V[0x%X]",
+                     x, (opcode & 0xF000) == 0x5000 ? "==" : "!=", y);
+            emit_skip(out, cond, start, pc, k);
+            return true;
+
+        case 0x6000:
+            fprintf(out, "    chip8->V[0x%X] = 0x%02x;\n", x, nn);
+            return false;
+
+        case 0x7000:
+            fprintf(out, "    chip8->V[0x%X] += 0x%02x;\n", x, nn);
+            return false;
+
+        case 0x8000:
+            switch(op_N(opcode)) {
+                case 0x0:
+                case 0x1:
+                case 0x2:
+                case 0x3: {
+                    static const char *const ops[] = {"=", "|=", "&=", "^="};
+                    fprintf(out, "    chip8->V[0x%X] %s chip8->V[0x%X];\n", x,
+                            ops[op_N(opcode)], y);
+                    break;
+                }
+                // the flag goes in last so it wins when X is F
+                case 0x4:
+                    fprintf(out,
+                            "    {\n"
+                            "        unsigned sum = chip8->V[0x%X] + chip8->V[0x%X];\n"
+                            "        chip8->V[0x%X] = sum;\n"
+                            "        chip8->V[0xF] = sum > 0xFF;\n"
+                            "    }\n",
+                            x, y, x);
+                    break;
+                case 0x5:
+                case 0x7: {
+                    uint8_t from = op_N(opcode) == 0x5 ? x : y;
+                    uint8_t by = op_N(opcode) == 0x5 ? y : x;
+                    fprintf(out,
+                            "    {\n"
+                            "        uint8_t flag = chip8->V[0x%X] >= chip8->V[0x%X];\n"
+                            "        chip8->V[0x%X] = chip8->V[0x%X] - chip8->V[0x%X];\n"
+                            "        chip8->V[0xF] = flag;\n"
+                            "    }\n",
+                            from, by, x, from, by);
+                    break;
+                }
+                case 0x6:
+                case 0xE:
+                    fprintf(out,
+                            "    {\n"
+                            "        uint8_t flag = chip8->V[0x%X] %s;\n"
+                            "        chip8->V[0x%X] %s= 1;\n"
+                            "        chip8->V[0xF] = flag;\n"
+                            "    }\n",
+                            x, op_N(opcode) == 0x6 ? "& 0x1" : ">> 7", x,
+                            op_N(opcode) == 0x6 ? ">>" : "<<");
+                    break;
+            }
+            return false;
+
+        case 0xA000:
+            fprintf(out, "    chip8->I = 0x%03x;\n", nnn);
+            return false;
+
+        case 0xB000:
+            fprintf(out, "    chip8->pc = 0x%03x + chip8->V[0x0];\n    C8_AOT_EXIT(0x%03x, %u)\n",
+                    nnn, start, k + 1);
+            return true;
+
+        case 0xE000:
+            if(nn != 0x9E && nn != 0xA1) {
+                return false;
+            }
+            fprintf(out,
+                    "    if(chip8->V[0x%X] >= NUM_KEYS) {\n"
+                    "        chip8->pc = 0x%03x;\n"
+                    "        c8_fault(chip8, C8_FAULT_KEY);\n"
+                    "    }\n",
+                    x, pc);
+            snprintf(cond, sizeof cond, "chip8->keypad[chip8->V[0x%X] %% NUM_KEYS] %s 0", x,
+                     nn == 0x9E ? "!=" : "==");
+            emit_skip(out, cond, start, pc, k);
+            return true;
+
+        case 0xF000:
+            switch(nn) {
+                case 0x07:
+                    fprintf(out, "    chip8->V[0x%X] = chip8->delay_timer;\n", x);
+                    return false;
+                case 0x15:
+                    fprintf(out, "    chip8->delay_timer = chip8->V[0x%X];\n", x);
+                    return false;
+                case 0x18:
+                    fprintf(out, "    chip8->sound_timer = chip8->V[0x%X];\n", x);
+                    return false;
+                case 0x1E:
+                    fprintf(out,
+                            "    chip8->I += chip8->V[0x%X];\n"
+                            "    chip8->V[0xF] = chip8->I > 0xFFF;\n",
+                            x);
+                    return false;
+                case 0x29:
+                    fprintf(out, "    chip8->I = chip8->V[0x%X] * 0x05;\n", x);
+                    return false;
+            }
+            break;
+    }
+
+    // CXNN, DXYN, the stores and loads, FX0A and whatever else is left
+    emit_interpret(out, start, pc, k, ends);
+    return ends;
+}
+
+// One function per block, running until the block ends somewhere other than
+// its own start, the budget runs out or the block stored into code
+static void emit_block(const Program *prog, FILE *out, uint16_t start, uint16_t *len) {
+    uint16_t pc = start;
+    uint32_t k = 0;
+
+    fprintf(out,
+            "static uint64_t block_%03x(Chip8 *chip8, C8Aot *aot, uint64_t n, uint64_t ran) {\n",
+            start);
+    fprintf(out, "top:;\n    uint64_t left = n - ran;\n    (void)left;\n");
+
+    for(;;) {
+        if(pc > CODE_MEM_SIZE - 2 || k == MAX_BLOCK_INSTRUCTIONS) {
+            fprintf(out, "    chip8->pc = 0x%03x;\n    C8_AOT_EXIT(0x%03x, %u)\n", pc, start, k);
+            break;
+        }
+
+        uint16_t opcode = opcode_at(prog, pc);
+        if(k > 0) {
+            fprintf(out, "    C8_AOT_BUDGET(%u, 0x%03x)\n", k, pc);
+        }
+        fprintf(out, "    // %03x  %04x  %s\n", pc, opcode, c8_op_class_name(c8_op_class(opcode)));
+
+        bool ended = emit_instruction(out, prog->quirks, opcode, start, pc, k);
+        k++;
+        pc += prog->quirks->ext == C8_EXT_XOCHIP && opcode == 0xF000 ? 4 : 2;
+        if(ended) {
+            break;
+        }
+    }
+
+    fprintf(out, "}\n\n");
+    *len = (pc < CODE_MEM_SIZE ? pc : CODE_MEM_SIZE) - start;
+}
+
+static uint64_t chunks(uint16_t addr, uint16_t len) {
+    uint64_t mask = 0;
+    for(uint32_t chunk = addr / CODE_CHUNK_SIZE; chunk <= (uint32_t)(addr + len - 1) / CODE_CHUNK_SIZE;
+        chunk++) {
+        mask |= 1ULL << chunk;
+    }
+    return mask;
+}
+
+static void translate(const Program *prog, const char *rom, FILE *out) {
+    static uint16_t lens[CODE_MEM_SIZE];
+    const char *slash = strrchr(rom, '/');
+
+    fprintf(out, "// %s translated by chip8-aot for the %s quirks. Generated, don't edit.\n\n",
+            slash ? slash + 1 : rom, c8_quirks_name(prog->chip8->quirks));
+    fprintf(out, "#include \"engine_aot.h\"\n\n");
+    fprintf(out, "static const C8AotBlock BLOCKS[CODE_MEM_SIZE];\n\n");
+
+    for(uint32_t pc = 0; pc <= CODE_MEM_SIZE - 2; pc++) {
+        if(prog->leader[pc]) {
+            emit_block(prog, out, pc, &lens[pc]);
+        }
+    }
+
+    fprintf(out, "static const uint8_t IMAGE[CODE_MEM_SIZE] = {");
+    for(uint32_t addr = 0; addr < CODE_MEM_SIZE; addr++) {
+        fprintf(out, "%s0x%02x,", addr % 16 ? " " : "\n    ", prog->chip8->ram[addr]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const C8AotBlock BLOCKS[CODE_MEM_SIZE] = {\n");
+    for(uint32_t pc = 0; pc <= CODE_MEM_SIZE - 2; pc++) {
+        if(prog->leader[pc]) {
+            fprintf(out, "    [0x%03x] = {block_%03x, %u, 0x%016llxULL},\n", pc, pc, lens[pc],
+                    (unsigned long long)chunks(pc, lens[pc]));
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out,
+            "static const C8AotProgram PROGRAM = {\n"
+            "    .quirks = %u,\n"
+            "    .image = IMAGE,\n"
+            "    .blocks = BLOCKS,\n"
+            "    .rom = \"%s\",\n"
+            "};\n\n"
+            "const C8AotProgram *c8_aot_program = &PROGRAM;\n",
+            prog->chip8->quirks, slash ? slash + 1 : rom);
+}
+
+int main(int argc, char **argv) {
+    const char *out_path = NULL;
+    bool listing = false;
+    C8QuirkProfile quirks;
+    bool force_quirks = false;
+    int opt;
+
+    while((opt = getopt(argc, argv, "q:o:d")) != -1) {
+        switch(opt) {
+            case 'q':
+                if(!c8_quirks_from_name(optarg, &quirks)) {
+                    fprintf(stderr, "Unknown quirk profile %s\n", optarg);
+                    usage();
+                }
+                force_quirks = true;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'd':
+                listing = true;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if(optind != argc - 1) {
+        usage();
+    }
+
+    Chip8 *chip8 = chip8_init();
+    c8_load_rom(chip8, argv[optind], force_quirks ? &quirks : NULL);
+
+    Program *prog = c8_calloc(1, sizeof *prog);
+    prog->chip8 = chip8;
+    prog->quirks = c8_quirks(chip8->quirks);
+    discover(prog);
+
+    FILE *out = stdout;
+    if(out_path) {
+        out = fopen(out_path, "w");
+        if(!out) {
+            fprintf(stderr, "Couldn't open %s for writing\n", out_path);
+            exit(1);
+        }
+    }
+
+    if(listing) {
+        disassemble(prog, out);
+    } else {
+        translate(prog, argv[optind], out);
+    }
+
+    if(out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Couldn't write %s\n", out_path);
+        exit(1);
+    }
+    if(out_path) {
+        printf("%s: %zu instructions in %zu blocks\n", out_path, prog->instructions,
+               prog->blocks);
+    }
+
+    free(prog);
+    free(chip8);
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "beeper.h"
+
+// changes in flight, a power of two
+#define RING_SIZE 64
+#define TONE_HZ 440
+#define AMPLITUDE 6000
+// fading in and out over this long keeps the buzzer from clicking
+#define RAMP_MS 2
+
+typedef struct BeepEvent {
+    uint64_t frame;
+    bool on;
+} BeepEvent;
+
+// The indices only ever count up, the slot is the index mod RING_SIZE.
+// Each side's fields get a cache line of their own.
+struct C8Beeper {
+    BeepEvent ring[RING_SIZE];
+
+    // producer
+    uint32_t tail __attribute__((aligned(64)));
+    bool on;
+    // frames reported so far, the consumer knows the sound up to there
+    uint64_t frames;
+
+    // consumer
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t rate;
+    uint32_t buffer;
+    uint64_t playhead; // samples since frame 0
+    bool synced;
+    bool gate;
+    float level;
+    float ramp;
+    float phase;
+    float step;
+};
+
+C8Beeper *c8_beeper_create(uint32_t rate, uint32_t buffer) {
+    C8Beeper *bp = c8_aligned_alloc(64, sizeof *bp);
+    bp->rate = rate;
+    bp->buffer = buffer;
+    bp->ramp = 1000.0f / (RAMP_MS * rate);
+    bp->step = (float)TONE_HZ / rate;
+    return bp;
+}
+
+void c8_beeper_destroy(C8Beeper *bp) {
+    free(bp);
+}
+
+void c8_beeper_frame(C8Beeper *bp, uint64_t frame, bool on) {
+    if(on != bp->on) {
+        uint32_t tail = bp->tail;
+        // a full ring means the callback isn't running, try again next frame
+        if(tail - __atomic_load_n(&bp->head, __ATOMIC_ACQUIRE) < RING_SIZE) {
+            bp->ring[tail % RING_SIZE] = (BeepEvent){frame, on};
+            __atomic_store_n(&bp->tail, tail + 1, __ATOMIC_RELEASE);
+            bp->on = on;
+        }
+    }
+
+    __atomic_store_n(&bp->frames, frame + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t frame_start(const C8Beeper *bp, uint64_t frame) {
+    return frame * bp->rate / FRAMES_PER_SECOND;
+}
+
+// Correction for a naive square wave's jump at phase t, which takes most of
+// the aliasing out of it (PolyBLEP)
+static float poly_blep(float t, float dt) {
+    if(t < dt) {
+        t /= dt;
+        return t + t - t * t - 1.0f;
+    }
+    if(t > 1.0f - dt) {
+        t = (t - 1.0f) / dt;
+        return t * t + t + t + 1.0f;
+    }
+    return 0.0f;
+}
+
+void c8_beeper_render(C8Beeper *bp, int16_t *out, uint32_t count) {
+    uint64_t known = frame_start(bp, __atomic_load_n(&bp->frames, __ATOMIC_ACQUIRE));
+    uint32_t tail = __atomic_load_n(&bp->tail, __ATOMIC_ACQUIRE);
+    uint32_t head = bp->head;
+    uint64_t slack = 2 * frame_start(bp, 1);
+
+    // play a buffer behind the machine, and go back to that when the audio
+    // clock and the frame clock drift more than a couple of frames apart
+    uint64_t end = bp->playhead + count;
+    if(!bp->synced || end > known + slack || end + slack < known) {
+        bp->playhead = known > bp->buffer ? known - bp->buffer : 0;
+        bp->synced = known > 0;
+    }
+
+    for(uint32_t i = 0; i < count; i++, bp->playhead++) {
+        while(head != tail && frame_start(bp, bp->ring[head % RING_SIZE].frame) <= bp->playhead) {
+            bp->gate = bp->ring[head % RING_SIZE].on;
+            head++;
+        }
+
+        if(bp->gate && bp->level < 1.0f) {
+            bp->level = bp->level + bp->ramp < 1.0f ? bp->level + bp->ramp : 1.0f;
+        } else if(!bp->gate && bp->level > 0.0f) {
+            bp->level = bp->level - bp->ramp > 0.0f ? bp->level - bp->ramp : 0.0f;
+        }
+
+        float sample = 0.0f;
+        if(bp->level > 0.0f) {
+            float half = bp->phase + 0.5f < 1.0f ? bp->phase + 0.5f : bp->phase - 0.5f;
+            sample = bp->phase < 0.5f ? 1.0f : -1.0f;
+            sample += poly_blep(bp->phase, bp->step) - poly_blep(half, bp->step);
+        }
+        out[i] = sample * bp->level * AMPLITUDE;
+
+        // the oscillator keeps running through silence so its phase never jumps
+        bp->phase += bp->step;
+        if(bp->phase >= 1.0f) {
+            bp->phase -= 1.0f;
+        }
+    }
+
+    __atomic_store_n(&bp->head, head, __ATOMIC_RELEASE);
+}
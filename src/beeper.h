@@ -0,0 +1,25 @@
+#ifndef BEEPER_H
+#define BEEPER_H
+
+#include "chip8.h"
+
+// The buzzer, as a square wave. The emulation thread reports the sound timer
+// once per frame and whenever it turns on or off the change goes into a
+// single producer, single consumer ring stamped with the frame it happened
+// in. The audio callback plays the changes back at the sample that frame
+// starts on, a buffer behind the newest frame, so neither side ever waits.
+typedef struct C8Beeper C8Beeper;
+
+// rate is the output sample rate, buffer the samples the callback is asked
+// for at a time, which is also about how far the sound lags the machine
+C8Beeper *c8_beeper_create(uint32_t rate, uint32_t buffer);
+void c8_beeper_destroy(C8Beeper *bp);
+
+// Producer side: whether the buzzer sounds during the given frame. Frames
+// are numbered by the caller and have to keep counting up.
+void c8_beeper_frame(C8Beeper *bp, uint64_t frame, bool on);
+
+// Consumer side: fills out with count mono samples
+void c8_beeper_render(C8Beeper *bp, int16_t *out, uint32_t count);
+
+#endif
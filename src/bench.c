@@ -0,0 +1,631 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "display.h"
+#include "engine.h"
+#include "engine_jit.h"
+#include "triple_buffer.h"
+
+// the whole suite runs this many rounds and each result keeps its best one.
+// Rounds rather than repeats of each benchmark in a row, so that a stretch
+// of the host being busy only spoils one round.
+#define ROUNDS 5
+// ten seconds of play for the per-frame costs
+#define DEFAULT_FRAMES (10 * FRAMES_PER_SECOND)
+#define DEFAULT_INSTRUCTIONS 10000000
+// throughput runs as fast as it can, in frames this long
+#define TURBO_IPF 1000
+#define DEFAULT_TOLERANCE 15.0
+// the scripted keypad moves on to the next key this often
+#define KEY_FRAMES 12
+// replays of recorded draws and frames run at least this many
+#define MIN_SAMPLES 20000
+#define BLITS 1000000
+#define CONVERSIONS 20000
+#define MAX_RESULTS 256
+
+typedef enum Metric {
+    METRIC_IPS,
+    METRIC_DRAW,
+    METRIC_PRESENT,
+    METRIC_CONVERT,
+    METRIC_RSS,
+    NUM_METRICS
+} Metric;
+
+static const struct {
+    const char *name;
+    const char *unit;
+    bool higher_is_better;
+} METRICS[NUM_METRICS] = {
+    [METRIC_IPS] = {"ips", "instr/s", true},
+    [METRIC_DRAW] = {"ns_per_draw", "ns", false},
+    [METRIC_PRESENT] = {"ns_per_present", "ns", false},
+    [METRIC_CONVERT] = {"ns_per_convert", "ns", false},
+    [METRIC_RSS] = {"peak_rss", "KiB", false},
+};
+
+typedef struct Result {
+    char bench[64];
+    Metric metric;
+    double value;
+} Result;
+
+typedef struct Results {
+    Result entries[MAX_RESULTS];
+    size_t count;
+} Results;
+
+static void usage(void) {
+    fprintf(stderr, "Usage: chip8-bench [-f frames] [-s ipf] [-i instructions] [-o results] "
+                    "[-b baseline] [-t percent] [ROM file]...\n"
+                    "  -f  frames of scripted play per ROM for the draw and present costs "
+                    "(default %d)\n"
+                    "  -s  instructions per frame of play (default %d)\n"
+                    "  -i  instructions per ROM and engine for the throughput (default %d)\n"
+                    "  -o  write the results as tab separated bench, metric, value lines\n"
+                    "  -b  compare against results written by -o, failing on regressions\n"
+                    "  -t  how much worse than the baseline counts as a regression "
+                    "(default %.0f%%)\n",
+            DEFAULT_FRAMES, INSTRUCTIONS_PER_FRAME, DEFAULT_INSTRUCTIONS, DEFAULT_TOLERANCE);
+    exit(1);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_result(Results *results, const char *bench, Metric metric, double value) {
+    if(results->count == MAX_RESULTS) {
+        fprintf(stderr, "Too many benchmark results\n");
+        exit(1);
+    }
+    Result *result = &results->entries[results->count++];
+    snprintf(result->bench, sizeof result->bench, "%s", bench);
+    result->metric = metric;
+    result->value = value;
+}
+
+// The same keys on every run: one at a time, the next one every KEY_FRAMES
+// frames and every fourth stretch with nothing held, so games waiting for a
+// release get one too
+static void apply_script(Chip8 *chip8, uint64_t frame) {
+    uint64_t step = frame / KEY_FRAMES;
+    uint16_t keys = step % 4 == 3 ? 0 : 1 << (step * 7 % NUM_KEYS);
+
+    for(uint8_t key = 0; key < NUM_KEYS; key++) {
+        chip8->keypad[key] = keys >> key & 1;
+    }
+}
+
+// Instructions per second through the engine with idle skipping off, so
+// only instructions that really ran are counted
+static double throughput(const Chip8 *loaded, C8EngineKind kind, uint64_t instructions) {
+    Chip8 *chip8 = chip8_init();
+    c8_reset_to(chip8, loaded);
+    C8Engine *engine = c8_engine_create(kind, chip8);
+    c8_engine_set_idle_skip(engine, false);
+    uint64_t frames = (instructions + TURBO_IPF - 1) / TURBO_IPF;
+
+    uint64_t start = now_ns();
+    for(uint64_t frame = 0; frame < frames; frame++) {
+        apply_script(chip8, frame);
+        c8_engine_run_frame(engine, TURBO_IPF);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    c8_engine_destroy(engine);
+    free(chip8);
+    return elapsed ? frames * TURBO_IPF * 1e9 / elapsed : 0.0;
+}
+
+// main.c's present up to the texture upload, with a plain buffer standing in
+// for the texture
+typedef struct Presenter {
+    uint64_t shown[NUM_PLANES][SCREEN_WORDS][SCREEN_HEIGHT];
+    bool shown_hires;
+    bool uploaded;
+    uint32_t pixels[SCREEN_HEIGHT * SCREEN_WIDTH];
+} Presenter;
+
+static void present(Presenter *p, const C8Frame *frame) {
+    bool redraw = !p->uploaded || frame->hires != p->shown_hires;
+    uint64_t dirty_rows =
+        redraw ? UINT64_MAX
+               : c8_dirty_texture_rows(frame->screen[0][0], p->shown[0][0], frame->hires);
+    uint8_t first, count;
+
+    if(c8_dirty_span(dirty_rows, &first, &count)) {
+        c8_screen_to_argb(frame->screen[0][0], frame->hires, first, count,
+                          p->pixels + first * SCREEN_WIDTH, SCREEN_WIDTH * sizeof(uint32_t));
+        memcpy(p->shown, frame->screen, sizeof p->shown);
+        p->shown_hires = frame->hires;
+        p->uploaded = true;
+    }
+}
+
+typedef struct PlayCosts {
+    double ns_per_draw;    // 0 when the ROM never drew
+    double ns_per_present; // 0 when it never finished a frame with something drawn
+} PlayCosts;
+
+// A DXYN as the ROM ran it, enough to run it again on its own
+typedef struct Draw {
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t I;
+    uint8_t vx;
+    uint8_t vy;
+    bool hires;
+} Draw;
+
+typedef struct Recording {
+    Draw *draws;
+    size_t num_draws;
+    size_t draws_cap;
+    C8Frame *frames; // every frame that had something drawn, at most one per frame played
+    size_t num_frames;
+} Recording;
+
+static void record_draw(Recording *rec, const Chip8 *chip8, uint16_t opcode) {
+    if(rec->num_draws == rec->draws_cap) {
+        rec->draws_cap = rec->draws_cap ? rec->draws_cap * 2 : 256;
+        rec->draws = c8_realloc(rec->draws, rec->draws_cap * sizeof *rec->draws);
+    }
+    rec->draws[rec->num_draws++] = (Draw){
+        .pc = chip8->pc,
+        .opcode = opcode,
+        .I = chip8->I,
+        .vx = chip8->V[(opcode >> 8) & 0xF],
+        .vy = chip8->V[(opcode >> 4) & 0xF],
+        .hires = chip8->hires,
+    };
+}
+
+static void record_frame(Recording *rec, const Chip8 *chip8, uint64_t number) {
+    C8Frame *frame = &rec->frames[rec->num_frames++];
+    memcpy(frame->screen, chip8->screen, sizeof frame->screen);
+    frame->hires = chip8->hires;
+    frame->number = number;
+    frame->input_time = 0;
+}
+
+// How many times over a recording is run so that even a ROM that only drew a
+// handful of times gets timed for long enough to mean something
+static size_t passes(size_t count) {
+    return (MIN_SAMPLES + count - 1) / count;
+}
+
+// Runs the recorded draws back to back through the reference interpreter.
+// A clock read around every single one would cost about as much as the draw.
+static double replay_draws(const Chip8 *played, const Recording *rec) {
+    Chip8 *chip8 = chip8_init();
+    c8_reset_to(chip8, played);
+    size_t n = passes(rec->num_draws);
+
+    uint64_t start = now_ns();
+    for(size_t pass = 0; pass < n; pass++) {
+        for(size_t i = 0; i < rec->num_draws; i++) {
+            const Draw *draw = &rec->draws[i];
+            chip8->ram[draw->pc] = draw->opcode >> 8;
+            chip8->ram[(draw->pc + 1) % MEM_SIZE] = draw->opcode & 0xFF;
+            chip8->pc = draw->pc;
+            chip8->I = draw->I;
+            chip8->V[(draw->opcode >> 8) & 0xF] = draw->vx;
+            chip8->V[(draw->opcode >> 4) & 0xF] = draw->vy;
+            chip8->hires = draw->hires;
+            c8_exec_instruction(chip8, false);
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    free(chip8);
+    return (double)elapsed / (n * rec->num_draws);
+}
+
+// Hands the recorded frames one after the other through the triple buffer to
+// the presenter, as the machine thread and the render thread would
+static double replay_frames(const Recording *rec) {
+    C8TripleBuffer *tb = c8_aligned_alloc(64, sizeof *tb);
+    Presenter *p = c8_malloc(sizeof *p);
+    size_t n = passes(rec->num_frames);
+    c8_triple_init(tb);
+    p->uploaded = false;
+
+    uint64_t start = now_ns();
+    for(size_t pass = 0; pass < n; pass++) {
+        for(size_t i = 0; i < rec->num_frames; i++) {
+            C8Frame *back = c8_triple_back(tb);
+            memcpy(back->screen, rec->frames[i].screen, sizeof back->screen);
+            back->hires = rec->frames[i].hires;
+            back->number = rec->frames[i].number;
+            c8_triple_publish(tb);
+            present(p, c8_triple_acquire(tb));
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    free(p);
+    free(tb);
+    return (double)elapsed / (n * rec->num_frames);
+}
+
+// Plays the ROM through the reference interpreter, noting down every DXYN and
+// every frame that would have been presented, then times those on their own
+static PlayCosts play(const Chip8 *loaded, uint64_t frames, uint32_t ipf) {
+    Chip8 *chip8 = chip8_init();
+    Recording rec = {0};
+    rec.frames = c8_malloc(frames * sizeof *rec.frames);
+    PlayCosts costs = {0, 0};
+
+    c8_reset_to(chip8, loaded);
+    for(uint64_t frame = 0; frame < frames; frame++) {
+        apply_script(chip8, frame);
+        for(uint32_t i = 0; i < ipf; i++) {
+            uint16_t opcode = c8_fetch(chip8, chip8->pc);
+            if((opcode & 0xF000) == 0xD000) {
+                record_draw(&rec, chip8, opcode);
+            }
+            c8_exec_instruction(chip8, false);
+        }
+        c8_tick_timers(chip8);
+
+        if(chip8->needs_draw) {
+            record_frame(&rec, chip8, frame);
+            chip8->needs_draw = false;
+        }
+    }
+
+    // the draws run over the ram the ROM ended with, which has its sprites
+    if(rec.num_draws > 0) {
+        costs.ns_per_draw = replay_draws(chip8, &rec);
+    }
+    if(rec.num_frames > 0) {
+        costs.ns_per_present = replay_frames(&rec);
+    }
+
+    free(rec.draws);
+    free(rec.frames);
+    free(chip8);
+    return costs;
+}
+
+// Arithmetic, a skip and a jump back with no drawing or memory traffic, so
+// what's left is getting from one instruction to the next. Run under the
+// modern profile, where shifts work on VX in place.
+static const uint8_t DISPATCH_ROM[] = {
+    0x60, 0x01, // 200: V0 = 1
+    0x61, 0x03, // 202: V1 = 3
+    0x80, 0x14, // 204: V0 += V1
+    0x81, 0x02, // 206: V1 &= V0
+    0x72, 0x05, // 208: V2 += 5
+    0x32, 0x37, // 20a: skip if V2 == 0x37
+    0x83, 0x26, // 20c: V3 >>= 1
+    0x84, 0x33, // 20e: V4 ^= V3
+    0xA3, 0x00, // 210: I = 0x300
+    0xF4, 0x1E, // 212: I += V4
+    0x12, 0x04, // 214: jump 204
+};
+
+// 8x15 sprites at positions that are mostly unaligned, some clipped at the edges
+static double bench_blit(void) {
+    Chip8 *chip8 = chip8_init();
+    chip8->I = BIG_FONT_ADDR;
+
+    uint64_t start = now_ns();
+    for(uint32_t i = 0; i < BLITS; i++) {
+        c8_draw_sprite(chip8, i * 7 % LORES_WIDTH, i * 5 % LORES_HEIGHT, 15);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    free(chip8);
+    return (double)elapsed / BLITS;
+}
+
+// A whole noisy texture, which is what a mode switch or the first frame costs
+static double bench_convert(bool hires) {
+    uint64_t screen[NUM_PLANES][SCREEN_WORDS][SCREEN_HEIGHT];
+    uint32_t *pixels = c8_malloc(SCREEN_HEIGHT * SCREEN_WIDTH * sizeof(uint32_t));
+    uint64_t x = C8_DEFAULT_SEED;
+
+    for(size_t i = 0; i < sizeof screen / sizeof(uint64_t); i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        (&screen[0][0][0])[i] = x;
+    }
+
+    uint64_t start = now_ns();
+    for(uint32_t i = 0; i < CONVERSIONS; i++) {
+        c8_screen_to_argb(screen[0][0], hires, 0, SCREEN_HEIGHT, pixels,
+                          SCREEN_WIDTH * sizeof(uint32_t));
+        // keeps the stores from being thrown away as dead
+        __asm__ volatile("" : : "r"(pixels) : "memory");
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    free(pixels);
+    return (double)elapsed / CONVERSIONS;
+}
+
+// The JIT is left out on hosts it can't generate code for
+static size_t engines(C8EngineKind kinds[3]) {
+    size_t count = 0;
+    kinds[count++] = C8_ENGINE_INTERP;
+    kinds[count++] = C8_ENGINE_CACHED;
+
+    C8Jit *jit = c8_jit_create();
+    if(jit) {
+        kinds[count++] = C8_ENGINE_JIT;
+        c8_jit_destroy(jit);
+    }
+    return count;
+}
+
+static void run_micro(Results *results, uint64_t instructions) {
+    C8EngineKind kinds[3];
+    size_t num_engines = engines(kinds);
+    char bench[64];
+
+    Chip8 *loaded = chip8_init();
+    C8QuirkProfile modern = C8_QUIRKS_MODERN;
+    c8_load_rom_data(loaded, DISPATCH_ROM, sizeof DISPATCH_ROM, &modern);
+    for(size_t e = 0; e < num_engines; e++) {
+        snprintf(bench, sizeof bench, "dispatch/%s", c8_engine_name(kinds[e]));
+        add_result(results, bench, METRIC_IPS, throughput(loaded, kinds[e], instructions));
+    }
+    free(loaded);
+
+    add_result(results, "blit", METRIC_DRAW, bench_blit());
+    add_result(results, "convert/lores", METRIC_CONVERT, bench_convert(false));
+    add_result(results, "convert/hires", METRIC_CONVERT, bench_convert(true));
+}
+
+static void run_rom(Results *results, const char *path, uint64_t frames, uint32_t ipf,
+                    uint64_t instructions) {
+    C8EngineKind kinds[3];
+    size_t num_engines = engines(kinds);
+    // results are named after the file so baselines survive moving the ROMs
+    const char *slash = strrchr(path, '/');
+    char name[48], bench[64];
+    snprintf(name, sizeof name, "%s", slash ? slash + 1 : path);
+
+    Chip8 *loaded = chip8_init();
+    c8_load_rom(loaded, path, NULL);
+
+    for(size_t e = 0; e < num_engines; e++) {
+        snprintf(bench, sizeof bench, "%s/%s", name, c8_engine_name(kinds[e]));
+        add_result(results, bench, METRIC_IPS, throughput(loaded, kinds[e], instructions));
+    }
+
+    PlayCosts costs = play(loaded, frames, ipf);
+    if(costs.ns_per_draw > 0) {
+        add_result(results, name, METRIC_DRAW, costs.ns_per_draw);
+    }
+    if(costs.ns_per_present > 0) {
+        add_result(results, name, METRIC_PRESENT, costs.ns_per_present);
+    }
+
+    free(loaded);
+}
+
+// In KiB. ru_maxrss would also count whatever the process was before it
+// exec'd into this, VmHWM starts over at the exec.
+static double peak_rss(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    long kib = -1;
+
+    while(f && fgets(line, sizeof line, f)) {
+        if(sscanf(line, "VmHWM: %ld kB", &kib) == 1) {
+            break;
+        }
+    }
+    if(f) {
+        fclose(f);
+    }
+
+    if(kib < 0) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        kib = ru.ru_maxrss;
+    }
+    return kib;
+}
+
+// Every round runs the same benchmarks in the same order
+static void keep_best(Results *best, const Results *round) {
+    if(best->count == 0) {
+        *best = *round;
+        return;
+    }
+    for(size_t i = 0; i < round->count; i++) {
+        Result *result = &best->entries[i];
+        double value = round->entries[i].value;
+        bool better = METRICS[result->metric].higher_is_better ? value > result->value
+                                                               : value < result->value;
+        if(better) {
+            result->value = value;
+        }
+    }
+}
+
+static bool metric_from_name(const char *name, Metric *metric) {
+    for(int i = 0; i < NUM_METRICS; i++) {
+        if(strcmp(name, METRICS[i].name) == 0) {
+            *metric = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void write_results(const Results *results, const char *path) {
+    FILE *f = fopen(path, "w");
+    if(!f) {
+        fprintf(stderr, "Couldn't write benchmark results to %s\n", path);
+        exit(1);
+    }
+
+    fprintf(f, "# bench\tmetric\tvalue\n");
+    for(size_t i = 0; i < results->count; i++) {
+        const Result *result = &results->entries[i];
+        fprintf(f, "%s\t%s\t%.3f\n", result->bench, METRICS[result->metric].name,
+                result->value);
+    }
+
+    if(fclose(f) != 0) {
+        fprintf(stderr, "Couldn't write benchmark results to %s\n", path);
+        exit(1);
+    }
+}
+
+static void read_results(Results *results, const char *path) {
+    FILE *f = fopen(path, "r");
+    if(!f) {
+        fprintf(stderr, "Couldn't open the baseline %s\n", path);
+        exit(1);
+    }
+
+    char line[256], bench[64], metric_name[32];
+    double value;
+    Metric metric;
+    results->count = 0;
+
+    while(fgets(line, sizeof line, f)) {
+        if(line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if(sscanf(line, "%63s %31s %lf", bench, metric_name, &value) != 3 ||
+           !metric_from_name(metric_name, &metric)) {
+            fprintf(stderr, "%s isn't a benchmark baseline\n", path);
+            exit(1);
+        }
+        add_result(results, bench, metric, value);
+    }
+
+    fclose(f);
+}
+
+static const Result *find_result(const Results *results, const Result *like) {
+    for(size_t i = 0; i < results->count; i++) {
+        const Result *result = &results->entries[i];
+        if(result->metric == like->metric && strcmp(result->bench, like->bench) == 0) {
+            return result;
+        }
+    }
+    return NULL;
+}
+
+// Prints every result next to its baseline, when there is one, and returns how
+// many got worse by more than the tolerance
+static size_t report(const Results *results, const Results *baseline, double tolerance) {
+    size_t regressions = 0;
+
+    printf("%-26s %-15s %20s %12s %9s\n", "bench", "metric", "value", "baseline", "change");
+    for(size_t i = 0; i < results->count; i++) {
+        const Result *result = &results->entries[i];
+        const Result *base = baseline ? find_result(baseline, result) : NULL;
+        printf("%-26s %-15s %12.0f %-7s", result->bench, METRICS[result->metric].name,
+               result->value, METRICS[result->metric].unit);
+
+        if(!base || base->value <= 0) {
+            printf("\n");
+            continue;
+        }
+
+        double change = (result->value - base->value) / base->value * 100;
+        double worse = METRICS[result->metric].higher_is_better ? -change : change;
+        printf(" %12.0f %+8.1f%%", base->value, change);
+        if(worse > tolerance) {
+            printf("  REGRESSION");
+            regressions++;
+        }
+        printf("\n");
+    }
+
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    uint64_t frames = DEFAULT_FRAMES;
+    uint32_t ipf = INSTRUCTIONS_PER_FRAME;
+    uint64_t instructions = DEFAULT_INSTRUCTIONS;
+    const char *out_path = NULL;
+    const char *baseline_path = NULL;
+    double tolerance = DEFAULT_TOLERANCE;
+    int opt;
+
+    while((opt = getopt(argc, argv, "f:s:i:o:b:t:")) != -1) {
+        switch(opt) {
+            case 'f':
+                frames = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                ipf = strtoul(optarg, NULL, 10);
+                if(ipf == 0) {
+                    usage();
+                }
+                break;
+            case 'i':
+                instructions = strtoull(optarg, NULL, 10);
+                if(instructions == 0) {
+                    usage();
+                }
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'b':
+                baseline_path = optarg;
+                break;
+            case 't':
+                tolerance = strtod(optarg, NULL);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    // the baseline is read first so a bad path fails before the long part
+    Results *baseline = NULL;
+    if(baseline_path) {
+        baseline = c8_malloc(sizeof *baseline);
+        read_results(baseline, baseline_path);
+    }
+
+    Results *results = c8_calloc(1, sizeof *results);
+    Results *round = c8_malloc(sizeof *round);
+
+    for(int r = 0; r < ROUNDS; r++) {
+        round->count = 0;
+        run_micro(round, instructions);
+        for(int i = optind; i < argc; i++) {
+            run_rom(round, argv[i], frames, ipf, instructions);
+        }
+        keep_best(results, round);
+    }
+
+    add_result(results, "process", METRIC_RSS, peak_rss());
+
+    size_t regressions = report(results, baseline, tolerance);
+
+    if(out_path) {
+        write_results(results, out_path);
+    }
+    if(regressions > 0) {
+        fprintf(stderr, "%zu benchmarks regressed by more than %.0f%% against %s\n",
+                regressions, tolerance, baseline_path);
+    }
+
+    free(round);
+    free(results);
+    free(baseline);
+
+    return regressions > 0;
+}
@@ -1,11 +1,35 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "chip8.h"
 
 Chip8 *chip8_init() {
     Chip8 *chip8 = c8_calloc(1, sizeof *chip8);
+    c8_reset(chip8);
+    c8_seed(chip8, time(NULL));
+
+    return chip8;
+}
+
+Chip8 *chip8_init_pooled(C8Pool *pool) {
+    Chip8 *chip8 = c8_pool_alloc(pool);
+    if(chip8) {
+        c8_reset(chip8);
+        c8_seed(chip8, time(NULL));
+    }
+
+    return chip8;
+}
+
+void c8_reset(Chip8 *chip8) {
+    memset(chip8, 0, sizeof *chip8);
 
     for(size_t i = 0; i < FONTSET_SIZE; i++) {
         chip8->ram[i] = FONTSET[i];
     }
+    memcpy(chip8->ram + BIG_FONT_ADDR, BIG_FONTSET, BIG_FONTSET_SIZE);
 
     for(size_t i = 0; i < NUM_KEYS; i++) {
         chip8->keypad[i] = false;
@@ -13,13 +37,34 @@ Chip8 *chip8_init() {
 
     chip8->pc = PROG_START_ADDR;
     chip8->needs_draw = false;
+    chip8->planes = 1;
+    // the frontend hasn't shown anything yet
+    chip8->dirty_rows = UINT64_MAX;
+    c8_seed(chip8, C8_DEFAULT_SEED);
+}
 
-    srand(time(NULL));
+void c8_copy_state(Chip8 *dst, const Chip8 *src) {
+    _Static_assert(offsetof(Chip8, ram) == 0, "ram has to lead Chip8");
+    memcpy(dst->ram, src->ram, c8_quirks_mem(c8_quirks(src->quirks)));
+    memcpy((uint8_t *)dst + sizeof dst->ram, (const uint8_t *)src + sizeof dst->ram,
+           sizeof *dst - sizeof dst->ram);
+}
 
-    return chip8;
+void c8_reset_to(Chip8 *chip8, const Chip8 *template) {
+    c8_copy_state(chip8, template);
 }
 
-void c8_load_rom(Chip8 *chip8, const char *rom_path) {
+void c8_reset_dirty(Chip8 *chip8, const Chip8 *template) {
+    // ram comes first, everything after it is small enough to copy whole
+    for(uint64_t dirty = chip8->dirty_ram; dirty; dirty &= dirty - 1) {
+        size_t page = __builtin_ctzll(dirty) * RAM_PAGE_SIZE;
+        memcpy(chip8->ram + page, template->ram + page, RAM_PAGE_SIZE);
+    }
+    memcpy((uint8_t *)chip8 + sizeof chip8->ram, (const uint8_t *)template + sizeof chip8->ram,
+           sizeof *chip8 - sizeof chip8->ram);
+}
+
+uint8_t *c8_read_rom(const char *rom_path, size_t *rom_len) {
     FILE *rom = fopen(rom_path, "rb");
     if(!rom) {
         fprintf(stderr, "Couldn't open ROM file %s\n", rom_path);
@@ -27,31 +72,346 @@ void c8_load_rom(Chip8 *chip8, const char *rom_path) {
     }
 
     fseek(rom, 0, SEEK_END);
-    size_t rom_len = ftell(rom);
+    *rom_len = ftell(rom);
     fseek(rom, 0, SEEK_SET);
 
-    uint8_t *rom_buffer = c8_malloc(sizeof(uint8_t) * rom_len);
-    size_t bytes_read = fread(rom_buffer, sizeof(uint8_t), rom_len, rom);
-    if(bytes_read != rom_len) {
+    if(*rom_len > PROG_REGION_SIZE) {
+        fprintf(stderr, "ROM is too big to fit into memory\n");
+        exit(1);
+    }
+
+    uint8_t *rom_buffer = c8_malloc(*rom_len ? *rom_len : 1);
+    size_t bytes_read = fread(rom_buffer, sizeof(uint8_t), *rom_len, rom);
+    if(bytes_read != *rom_len) {
         fprintf(stderr, "Couldn't read ROM\n");
         exit(1);
     }
 
-    if(rom_len > PROG_REGION_SIZE) {
+    fclose(rom);
+
+    return rom_buffer;
+}
+
+void c8_load_rom_data(Chip8 *chip8, const uint8_t *rom, size_t rom_len,
+                      const C8QuirkProfile *quirks) {
+    C8QuirkProfile profile = quirks ? *quirks : c8_quirks_for_rom(rom, rom_len);
+    // the rest would sit in ram the profile can't reach
+    if(rom_len > c8_rom_space(profile)) {
+        fprintf(stderr, "ROM is too big for the %s profile\n", c8_quirks_name(profile));
+        exit(1);
+    }
+    memcpy(chip8->ram + PROG_START_ADDR, rom, rom_len);
+    chip8->quirks = profile;
+}
+
+// The file is mapped rather than read, so its bytes go straight from the page
+// cache into ram
+void c8_load_rom(Chip8 *chip8, const char *rom_path, const C8QuirkProfile *quirks) {
+    int fd = open(rom_path, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "Couldn't open ROM file %s\n", rom_path);
+        exit(1);
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        fprintf(stderr, "Couldn't read ROM\n");
+        exit(1);
+    }
+    if((size_t)st.st_size > PROG_REGION_SIZE) {
         fprintf(stderr, "ROM is too big to fit into memory\n");
         exit(1);
     }
 
-    for(size_t i = 0; i < rom_len; i++) {
-        chip8->ram[i + PROG_START_ADDR] = rom_buffer[i];
+    // an empty file can't be mapped, and there's nothing to copy anyway
+    if(st.st_size == 0) {
+        static const uint8_t empty[1];
+        close(fd);
+        c8_load_rom_data(chip8, empty, 0, quirks);
+        return;
     }
 
-    fclose(rom);
-    free(rom_buffer);
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        fprintf(stderr, "Couldn't map ROM file %s\n", rom_path);
+        exit(1);
+    }
+
+    c8_load_rom_data(chip8, map, st.st_size, quirks);
+    munmap(map, st.st_size);
 }
 
-void c8_exec_instruction(Chip8 *chip8, bool dbg) {
-    uint16_t opcode = (chip8->ram[chip8->pc] << 8) | chip8->ram[chip8->pc + 1];
+// 00E0 -> CLEAR SCREEN
+void c8_clear_screen(Chip8 *chip8) {
+    for(uint8_t plane = 0; plane < NUM_PLANES; plane++) {
+        if(chip8->planes >> plane & 1) {
+            memset(chip8->screen[plane], 0, sizeof chip8->screen[plane]);
+        }
+    }
+    chip8->dirty_rows = UINT64_MAX;
+    chip8->needs_draw = true;
+}
+
+uint64_t c8_screen_hash(const Chip8 *chip8) {
+    const uint64_t *plane1 = chip8->screen[1][0];
+    bool blank = true;
+
+    for(size_t i = 0; i < SCREEN_WORDS * SCREEN_HEIGHT; i++) {
+        blank &= plane1[i] == 0;
+    }
+    if(!chip8->hires && blank) {
+        return c8_hash(chip8->screen[0][0], LORES_HEIGHT * sizeof(uint64_t));
+    }
+    return c8_hash(chip8->screen, sizeof chip8->screen);
+}
+
+uint64_t c8_state_hash(const Chip8 *chip8) {
+    // V, stack and RPL flags fill the first eight words
+    uint64_t regs[9];
+    uint8_t *bytes = (uint8_t *)regs;
+
+    memcpy(bytes, chip8->V, NUM_GPRS);
+    memcpy(bytes + NUM_GPRS, chip8->stack, sizeof chip8->stack);
+    memcpy(bytes + NUM_GPRS + sizeof chip8->stack, chip8->rpl, NUM_GPRS);
+    regs[8] = (uint64_t)chip8->pc | (uint64_t)chip8->I << 16 | (uint64_t)chip8->sp << 32 |
+              (uint64_t)chip8->delay_timer << 40 | (uint64_t)chip8->sound_timer << 48 |
+              (uint64_t)(chip8->hires | chip8->planes << 1) << 56;
+
+    uint64_t screen = c8_hash_words(chip8->screen[0][0], sizeof chip8->screen / 8, 0);
+    return c8_hash_words(regs, 9, screen);
+}
+
+uint32_t c8_store_range(const Chip8 *chip8, uint32_t *addr) {
+    const C8Quirks *quirks = c8_quirks(chip8->quirks);
+    uint16_t opcode = c8_fetch(chip8, chip8->pc);
+
+    *addr = chip8->I & (c8_quirks_mem(quirks) - 1);
+    if((opcode & 0xF0FF) == 0xF033) {
+        return 3;
+    } else if((opcode & 0xF0FF) == 0xF055) {
+        return op_X(opcode) + 1;
+    } else if(quirks->ext == C8_EXT_XOCHIP && (opcode & 0xF00F) == 0x5002) {
+        return (op_X(opcode) > op_Y(opcode) ? op_X(opcode) - op_Y(opcode)
+                                           : op_Y(opcode) - op_X(opcode)) + 1;
+    }
+    return 0;
+}
+
+int c8_store_spans(const Chip8 *chip8, C8Span spans[2]) {
+    uint32_t mem = c8_quirks_mem(c8_quirks(chip8->quirks));
+    uint32_t addr;
+    uint32_t len = c8_store_range(chip8, &addr);
+    int count = 0;
+
+    if(len == 0) {
+        return 0;
+    }
+
+    uint32_t end = addr + len;
+    if(addr < CODE_MEM_SIZE) {
+        uint32_t to = end < CODE_MEM_SIZE ? end : CODE_MEM_SIZE;
+        spans[count++] = (C8Span){addr, to - addr};
+    }
+    if(end > mem) {
+        spans[count++] = (C8Span){0, end - mem};
+    }
+    return count;
+}
+
+// A hi-res row across both words of a column, the first word in the top half
+typedef unsigned __int128 ScreenRow;
+
+// DXYN -> DRAW N px tall sprite from memory location in I
+// at (x, y) = (VX, VY)
+// The starting position wraps around the screen, the sprite itself is clipped
+// at the right and bottom edges unless wrap is set. Each sprite row lands in
+// the screen with one shift, one XOR and one AND to pick up collisions. With
+// an extension, DXY0 draws 16x16 and every selected plane gets its own sprite,
+// one after the other in memory. Hi-res rows are 128 bits wide, shifted and
+// rotated as one.
+static inline __attribute__((always_inline)) void draw_sprite(Chip8 *chip8, uint8_t x_coord,
+                                                              uint8_t y_coord, uint8_t height,
+                                                              const C8Quirks quirks) {
+    const uint32_t mem = c8_quirks_mem(&quirks);
+    bool big = quirks.ext != C8_EXT_NONE && height == 0;
+    bool hires = quirks.ext != C8_EXT_NONE && chip8->hires;
+    uint8_t screen_width = hires ? SCREEN_WIDTH : LORES_WIDTH;
+    uint8_t screen_height = hires ? SCREEN_HEIGHT : LORES_HEIGHT;
+    uint8_t width = big ? 16 : 8;
+    uint8_t x = x_coord % screen_width;
+    uint8_t y = y_coord % screen_height;
+    uint8_t planes = quirks.ext == C8_EXT_XOCHIP ? chip8->planes : 1;
+    uint16_t addr = chip8->I;
+    uint64_t collision = 0;
+
+    height = big ? 16 : height;
+    uint8_t rows = height;
+    if(!quirks.wrap && rows > screen_height - y) {
+        rows = screen_height - y;
+    }
+
+    for(uint8_t plane = 0; plane < NUM_PLANES; plane++) {
+        if(!(planes >> plane & 1)) {
+            continue;
+        }
+
+        uint64_t *left = chip8->screen[plane][0];
+        uint64_t *right = chip8->screen[plane][1];
+        for(uint8_t curr_y = 0; curr_y < rows; curr_y++) {
+            uint8_t row = quirks.wrap ? (y + curr_y) % screen_height : y + curr_y;
+            uint32_t bits = c8_load(chip8, mem, addr + curr_y * (width / 8));
+            if(big) {
+                bits = bits << 8 | c8_load(chip8, mem, addr + curr_y * 2 + 1);
+            }
+
+            // columns past the right edge shift out of the row, or rotate back in
+            if(!hires) {
+                uint64_t sprite_row = (uint64_t)bits << (64 - width);
+                if(quirks.wrap) {
+                    sprite_row = sprite_row >> x | sprite_row << (63 - x) << 1;
+                } else {
+                    sprite_row >>= x;
+                }
+
+                collision |= left[row] & sprite_row;
+                left[row] ^= sprite_row;
+                if(sprite_row) {
+                    chip8->dirty_rows |= 1ULL << row;
+                }
+                continue;
+            }
+
+            ScreenRow sprite_row = (ScreenRow)bits << (128 - width);
+            if(quirks.wrap) {
+                sprite_row = sprite_row >> x | sprite_row << (127 - x) << 1;
+            } else {
+                sprite_row >>= x;
+            }
+
+            uint64_t hi = sprite_row >> 64;
+            uint64_t lo = (uint64_t)sprite_row;
+            collision |= (left[row] & hi) | (right[row] & lo);
+            left[row] ^= hi;
+            right[row] ^= lo;
+            if(hi | lo) {
+                chip8->dirty_rows |= 1ULL << row;
+            }
+        }
+
+        addr += height * (width / 8);
+    }
+
+    // colission flag
+    chip8->V[0xF] = collision != 0;
+    chip8->needs_draw = true;
+}
+
+void c8_draw_sprite(Chip8 *chip8, uint8_t x_coord, uint8_t y_coord, uint8_t height) {
+    // the default profile has every quirk off
+    draw_sprite(chip8, x_coord, y_coord, height, (C8Quirks){.ext = C8_EXT_NONE});
+}
+
+// The rows the current resolution shows, as dirty_rows bits
+static uint64_t visible_rows(const Chip8 *chip8) {
+    return chip8->hires ? UINT64_MAX : (1ULL << LORES_HEIGHT) - 1;
+}
+
+// 00CN/00DN -> SCROLL the selected planes down or up by n rows
+// Rows are runs of words in every column, so this is one move per column.
+static void scroll_vertical(Chip8 *chip8, uint8_t n, bool down) {
+    uint8_t height = chip8->hires ? SCREEN_HEIGHT : LORES_HEIGHT;
+    uint8_t words = chip8->hires ? SCREEN_WORDS : 1;
+    if(n > height) {
+        n = height;
+    }
+
+    for(uint8_t plane = 0; plane < NUM_PLANES; plane++) {
+        if(!(chip8->planes >> plane & 1)) {
+            continue;
+        }
+        for(uint8_t word = 0; word < words; word++) {
+            uint64_t *column = chip8->screen[plane][word];
+            if(down) {
+                memmove(column + n, column, (height - n) * sizeof *column);
+                memset(column, 0, n * sizeof *column);
+            } else {
+                memmove(column, column + n, (height - n) * sizeof *column);
+                memset(column + height - n, 0, n * sizeof *column);
+            }
+        }
+    }
+
+    chip8->dirty_rows |= visible_rows(chip8);
+    chip8->needs_draw = true;
+}
+
+// 00FB/00FC -> SCROLL the selected planes right or left by 4 pixels
+// Every row shifts the same way, so these are straight loops over the columns
+// that the compiler turns into vector shifts.
+static void scroll_horizontal(Chip8 *chip8, bool right) {
+    for(uint8_t plane = 0; plane < NUM_PLANES; plane++) {
+        if(!(chip8->planes >> plane & 1)) {
+            continue;
+        }
+
+        uint64_t *left_words = chip8->screen[plane][0];
+        uint64_t *right_words = chip8->screen[plane][1];
+        if(!chip8->hires) {
+            for(uint8_t y = 0; y < LORES_HEIGHT; y++) {
+                left_words[y] = right ? left_words[y] >> 4 : left_words[y] << 4;
+            }
+        } else if(right) {
+            for(uint8_t y = 0; y < SCREEN_HEIGHT; y++) {
+                right_words[y] = right_words[y] >> 4 | left_words[y] << 60;
+                left_words[y] >>= 4;
+            }
+        } else {
+            for(uint8_t y = 0; y < SCREEN_HEIGHT; y++) {
+                left_words[y] = left_words[y] << 4 | right_words[y] >> 60;
+                right_words[y] <<= 4;
+            }
+        }
+    }
+
+    chip8->dirty_rows |= visible_rows(chip8);
+    chip8->needs_draw = true;
+}
+
+// 00FE/00FF -> switch resolution, which clears every plane
+static void set_hires(Chip8 *chip8, bool hires) {
+    chip8->hires = hires;
+    memset(chip8->screen, 0, sizeof chip8->screen);
+    chip8->dirty_rows = UINT64_MAX;
+    chip8->needs_draw = true;
+}
+
+static inline uint16_t fetch(const Chip8 *chip8, uint32_t mem, uint16_t addr) {
+    return chip8->ram[addr & (mem - 1)] << 8 | chip8->ram[(addr + 1) & (mem - 1)];
+}
+
+// Moves pc from the next instruction to the one after, which on XO-CHIP means
+// stepping over all four bytes of F000 NNNN
+static inline __attribute__((always_inline)) void skip_next(Chip8 *chip8,
+                                                            const C8Quirks quirks) {
+    if(quirks.ext == C8_EXT_XOCHIP && fetch(chip8, MEM_SIZE, chip8->pc) == 0xF000) {
+        chip8->pc += 2;
+    }
+    chip8->pc += 2;
+}
+
+// The interpreter for one set of quirks. Every profile instantiates it with
+// its quirks as constants, so the tests on them fold away.
+static inline __attribute__((always_inline)) void exec_instruction(Chip8 *chip8, bool dbg,
+                                                                   const C8Quirks quirks) {
+    const uint32_t mem = c8_quirks_mem(&quirks);
+    const bool ext = quirks.ext != C8_EXT_NONE;
+    const bool xo = quirks.ext == C8_EXT_XOCHIP;
+
+    if(chip8->pc > mem - 2) {
+        c8_fault(chip8, C8_FAULT_PC);
+    }
+    uint16_t opcode = fetch(chip8, mem, chip8->pc);
 
     switch(opcode & 0xF000) {
         case 0x0000:
@@ -59,20 +419,42 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
                 // 00E0 -> CLEAR SCREEN
                 case 0x00E0:
                     INFO("Clearing Screen");
-                    memset(chip8->screen, 0, SCREEN_WIDTH * SCREEN_HEIGHT);
-                    chip8->needs_draw = true;
+                    c8_clear_screen(chip8);
                     chip8->pc += 2;
                     break;
 
                 // 00EE -> RETURN from SUBROUTINE
                 case 0x00EE:
                     chip8->sp--;
-                    chip8->pc = chip8->stack[chip8->sp];
+                    if(chip8->sp >= STACK_SIZE) {
+                        c8_fault(chip8, C8_FAULT_STACK);
+                    }
+                    chip8->pc = chip8->stack[chip8->sp % STACK_SIZE];
                     chip8->pc += 2;
                     break;
 
                 default:
-                    INFO("Unknown Instruction 0x%04x", opcode);
+                    // 00CN -> SCROLL DOWN N rows
+                    if(ext && (opcode & 0xFFF0) == 0x00C0) {
+                        scroll_vertical(chip8, op_N(opcode), true);
+                    // 00DN -> SCROLL UP N rows
+                    } else if(xo && (opcode & 0xFFF0) == 0x00D0) {
+                        scroll_vertical(chip8, op_N(opcode), false);
+                    // 00FB -> SCROLL RIGHT 4 px
+                    } else if(ext && opcode == 0x00FB) {
+                        scroll_horizontal(chip8, true);
+                    // 00FC -> SCROLL LEFT 4 px
+                    } else if(ext && opcode == 0x00FC) {
+                        scroll_horizontal(chip8, false);
+                    // 00FD -> EXIT, which halts on the spot
+                    } else if(ext && opcode == 0x00FD) {
+                        break;
+                    // 00FE -> LO-RES, 00FF -> HI-RES
+                    } else if(ext && (opcode == 0x00FE || opcode == 0x00FF)) {
+                        set_hires(chip8, opcode == 0x00FF);
+                    } else {
+                        INFO("Unknown Instruction 0x%04x", opcode);
+                    }
                     chip8->pc += 2;
             }
             break;
@@ -84,7 +466,10 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
 
         // 2NNN -> CALL SUBROUTINE at memory location NNN
         case 0x2000:
-            chip8->stack[chip8->sp++] = chip8->pc;
+            if(chip8->sp >= STACK_SIZE) {
+                c8_fault(chip8, C8_FAULT_STACK);
+            }
+            chip8->stack[chip8->sp++ % STACK_SIZE] = chip8->pc;
             chip8->pc = op_NNN(opcode);
             break;
 
@@ -92,7 +477,7 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
         case 0x3000:
             chip8->pc += 2;
             if(chip8->V[op_X(opcode)] == op_NN(opcode)) {
-                chip8->pc += 2;
+                skip_next(chip8, quirks);
             }
             break;
 
@@ -100,17 +485,41 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
         case 0x4000:
             chip8->pc += 2;
             if(chip8->V[op_X(opcode)] != op_NN(opcode)) {
-                chip8->pc += 2;
+                skip_next(chip8, quirks);
             }
             break;
 
-        // 5XY0 -> SKIP next instruction if VX == VY
-        case 0x5000:
-            chip8->pc += 2;
-            if(chip8->V[op_X(opcode)] == chip8->V[op_Y(opcode)]) {
+        case 0x5000: {
+            uint8_t x = op_X(opcode);
+            uint8_t y = op_Y(opcode);
+            int8_t step = x <= y ? 1 : -1;
+
+            // 5XY2 -> Store VX to VY in memory addr starting at I, backwards
+            // when X > Y
+            if(xo && op_N(opcode) == 2) {
+                for(uint8_t i = 0; i <= (x <= y ? y - x : x - y); i++) {
+                    c8_store(chip8, mem, chip8->I + i, chip8->V[x + i * step]);
+                }
                 chip8->pc += 2;
+                break;
+            }
+
+            // 5XY3 -> Load VX to VY from memory addrs starting at I
+            if(xo && op_N(opcode) == 3) {
+                for(uint8_t i = 0; i <= (x <= y ? y - x : x - y); i++) {
+                    chip8->V[x + i * step] = c8_load(chip8, mem, chip8->I + i);
+                }
+                chip8->pc += 2;
+                break;
+            }
+
+            // 5XY0 -> SKIP next instruction if VX == VY
+            chip8->pc += 2;
+            if(chip8->V[x] == chip8->V[y]) {
+                skip_next(chip8, quirks);
             }
             break;
+        }
 
         // 6XNN -> SET VX to NN
         case 0x6000:
@@ -135,72 +544,90 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
                 // 8XY1 -> SET VX to VX OR VY
                 case 0x0001:
                     chip8->V[op_X(opcode)] |= chip8->V[op_Y(opcode)];
+                    if(quirks.vf_reset) {
+                        chip8->V[0xF] = 0;
+                    }
                     chip8->pc += 2;
                     break;
 
                 // 8XY2 -> SET VX to VX AND VY
                 case 0x0002:
                     chip8->V[op_X(opcode)] &= chip8->V[op_Y(opcode)];
+                    if(quirks.vf_reset) {
+                        chip8->V[0xF] = 0;
+                    }
                     chip8->pc += 2;
                     break;
 
                 // 8XY3 -> SET VX to VX XOR VY
                 case 0x0003:
                     chip8->V[op_X(opcode)] ^= chip8->V[op_Y(opcode)];
+                    if(quirks.vf_reset) {
+                        chip8->V[0xF] = 0;
+                    }
                     chip8->pc += 2;
                     break;
 
                 // 8XY4 -> ADD VY to VX
-                // FLAG set if carry
+                // FLAG set if carry, written last so it wins when X is F
                 case 0x0004:
-                    chip8->V[op_X(opcode)] += chip8->V[op_Y(opcode)];
-                    if(chip8->V[op_X(opcode)] > 0xFF - chip8->V[op_Y(opcode)]) {
-                        chip8->V[0xF] = 1;
-                    } else {
-                        chip8->V[0xF] = 0;
+                    {
+                        uint16_t sum = chip8->V[op_X(opcode)] + chip8->V[op_Y(opcode)];
+                        chip8->V[op_X(opcode)] = sum;
+                        chip8->V[0xF] = sum > 0xFF;
+                        chip8->pc += 2;
                     }
-                    chip8->pc += 2;
                     break;
 
                 // 8XY5 -> SET VX to VX - VY
-                // FLAG set if borrow
+                // FLAG set if no borrow
                 case 0x0005:
-                    if(chip8->V[op_X(opcode)] < chip8->V[op_Y(opcode)]) {
-                        chip8->V[0xF] = 1;
-                    } else {
-                        chip8->V[0xF] = 0;
+                    {
+                        uint8_t flag = chip8->V[op_X(opcode)] >= chip8->V[op_Y(opcode)];
+                        chip8->V[op_X(opcode)] -= chip8->V[op_Y(opcode)];
+                        chip8->V[0xF] = flag;
+                        chip8->pc += 2;
                     }
-                    chip8->V[op_X(opcode)] -= chip8->V[op_Y(opcode)];
-                    chip8->pc += 2;
                     break;
 
-                // 8XYE -> RIGHT SHIFT VX by one
+                // 8XY6 -> RIGHT SHIFT VX by one
                 // SET VF to LSB of VX before shift
                 case 0x0006:
-                    chip8->V[0xF] = chip8->V[op_X(opcode)] & 0x1;
-                    chip8->V[op_X(opcode)] >>= 1;
-                    chip8->pc += 2;
+                    {
+                        if(quirks.shift_vy) {
+                            chip8->V[op_X(opcode)] = chip8->V[op_Y(opcode)];
+                        }
+                        uint8_t flag = chip8->V[op_X(opcode)] & 0x1;
+                        chip8->V[op_X(opcode)] >>= 1;
+                        chip8->V[0xF] = flag;
+                        chip8->pc += 2;
+                    }
                     break;
 
                 // 8XY7 -> SET VX to VY - VX
-                // FLAG set if borrow
+                // FLAG set if no borrow
                 case 0x0007:
-                    if(chip8->V[op_Y(opcode)] < chip8->V[op_X(opcode)]) {
-                        chip8->V[0xF] = 1;
-                    } else {
-                        chip8->V[0xF] = 0;
+                    {
+                        uint8_t flag = chip8->V[op_Y(opcode)] >= chip8->V[op_X(opcode)];
+                        chip8->V[op_X(opcode)] =
+                            chip8->V[op_Y(opcode)] - chip8->V[op_X(opcode)];
+                        chip8->V[0xF] = flag;
+                        chip8->pc += 2;
                     }
-                    chip8->V[op_X(opcode)] =
-                        chip8->V[op_Y(opcode)] - chip8->V[op_X(opcode)];
-                    chip8->pc += 2;
                     break;
 
                 // 8XYE -> LEFT SHIFT VX by one
                 // SET VF to MSB of VX before shift
                 case 0x000E:
-                    chip8->V[0xF] = chip8->V[op_X(opcode)] >> 7;
-                    chip8->V[op_X(opcode)] <<= 1;
-                    chip8->pc += 2;
+                    {
+                        if(quirks.shift_vy) {
+                            chip8->V[op_X(opcode)] = chip8->V[op_Y(opcode)];
+                        }
+                        uint8_t flag = chip8->V[op_X(opcode)] >> 7;
+                        chip8->V[op_X(opcode)] <<= 1;
+                        chip8->V[0xF] = flag;
+                        chip8->pc += 2;
+                    }
                     break;
 
                 default:
@@ -213,7 +640,7 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
         case 0x9000:
             chip8->pc += 2;
             if(chip8->V[op_X(opcode)] != chip8->V[op_Y(opcode)]) {
-                chip8->pc += 2;
+                skip_next(chip8, quirks);
             }
             break;
 
@@ -224,13 +651,14 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
             break;
 
         // BNNN -> JUMP to NNN + V0
+        // or BXNN -> JUMP to XNN + VX
         case 0xB000:
-            chip8->pc = op_NNN(opcode) + chip8->V[0];
+            chip8->pc = op_NNN(opcode) + chip8->V[quirks.jump_vx ? op_X(opcode) : 0];
             break;
 
         // CXNN -> SET Vx to a random number masked by NN
         case 0xC000:
-            chip8->V[op_X(opcode)] = (rand() % 256) & op_X(opcode);
+            chip8->V[op_X(opcode)] = c8_random(chip8) & op_NN(opcode);
             chip8->pc += 2;
             break;
 
@@ -238,49 +666,32 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
         // at (x, y) = (VX, VY)
         case 0xD000:
             INFO("Drawing Sprite");
-            uint8_t width = 8;
-            uint8_t height = op_N(opcode);
-            uint8_t x_coord = chip8->V[op_X(opcode)];
-            uint8_t y_coord = chip8->V[op_Y(opcode)];
-            uint8_t sprite_row;
-
-            // colission flag
-            chip8->V[0xF] = 0;
-
-            // TODO: add checks to ensure x & y are within bounds
-            for(uint8_t curr_y = 0; curr_y < height; curr_y++) {
-                sprite_row = chip8->ram[chip8->I + curr_y];
-                for(uint8_t curr_x = 0; curr_x < width; curr_x++) {
-                    if((sprite_row & (0x80 >> curr_x)) != 0) {
-                        uint16_t draw_at = (x_coord + curr_x + ((y_coord + curr_y) * 64));
-                        if(chip8->screen[draw_at] == 1) {
-                            chip8->V[0xF] = 1;
-                        }
-                        chip8->screen[draw_at] ^= 1;
-                    }
-                }
-            }
-
-            chip8->needs_draw = true;
+            draw_sprite(chip8, chip8->V[op_X(opcode)], chip8->V[op_Y(opcode)], op_N(opcode),
+                        quirks);
             chip8->pc += 2;
-
             break;
 
         case 0xE000:
             switch(opcode & 0x00FF) {
                 // EX9E -> SKIP next instruction if key in VX is pressed
                 case 0x009E:
+                    if(chip8->V[op_X(opcode)] >= NUM_KEYS) {
+                        c8_fault(chip8, C8_FAULT_KEY);
+                    }
                     chip8->pc += 2;
-                    if(chip8->keypad[chip8->V[op_X(opcode)]] != 0) {
-                        chip8->pc += 2;
+                    if(chip8->keypad[chip8->V[op_X(opcode)] % NUM_KEYS] != 0) {
+                        skip_next(chip8, quirks);
                     }
                     break;
 
                 // EXA1 -> SKIP next instruction if key in VX is not pressed
                 case 0x00A1:
+                    if(chip8->V[op_X(opcode)] >= NUM_KEYS) {
+                        c8_fault(chip8, C8_FAULT_KEY);
+                    }
                     chip8->pc += 2;
-                    if(chip8->keypad[chip8->V[op_X(opcode)]] == 0) {
-                        chip8->pc += 2;
+                    if(chip8->keypad[chip8->V[op_X(opcode)] % NUM_KEYS] == 0) {
+                        skip_next(chip8, quirks);
                     }
                     break;
 
@@ -291,7 +702,22 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
             break;
 
         case 0xF000:
+            // F000 NNNN -> SET I to the 16 bit address in the next two bytes
+            if(xo && opcode == 0xF000) {
+                chip8->I = fetch(chip8, mem, chip8->pc + 2);
+                chip8->pc += 4;
+                break;
+            }
+
             switch(opcode & 0x00FF) {
+                // FN01 -> SELECT planes N for drawing, clearing and scrolling
+                case 0x0001:
+                    if(xo) {
+                        chip8->planes = op_X(opcode) & 0x3;
+                    }
+                    chip8->pc += 2;
+                    break;
+
                 // FX07 -> SET VX to value of delay timer
                 case 0x0007:
                     chip8->V[op_X(opcode)] = chip8->delay_timer;
@@ -322,14 +748,12 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
                 // FX15 -> SET delay timer to VX
                 case 0x0015:
                     chip8->delay_timer = chip8->V[op_X(opcode)];
-                    chip8->delay_cycles = 0;
                     chip8->pc += 2;
                     break;
 
                 // FX18 -> SET sound timer to VX
                 case 0x0018:
                     chip8->sound_timer = chip8->V[op_X(opcode)];
-                    chip8->sound_cycles = 0;
                     chip8->pc += 2;
                     break;
 
@@ -354,14 +778,38 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
                     chip8->pc += 2;
                     break;
 
+                // FX30 -> SET I to addr of the big sprite in VX
+                case 0x0030:
+                    if(ext) {
+                        chip8->I = BIG_FONT_ADDR + (chip8->V[op_X(opcode)] & 0xF) * 10;
+                    }
+                    chip8->pc += 2;
+                    break;
+
+                // FX75 -> Store V0 to VX in the RPL flags
+                case 0x0075:
+                    if(ext) {
+                        memcpy(chip8->rpl, chip8->V, op_X(opcode) + 1);
+                    }
+                    chip8->pc += 2;
+                    break;
+
+                // FX85 -> Load V0 to VX from the RPL flags
+                case 0x0085:
+                    if(ext) {
+                        memcpy(chip8->V, chip8->rpl, op_X(opcode) + 1);
+                    }
+                    chip8->pc += 2;
+                    break;
+
                 // FX33 -> Store Binary coded decimal representation of VX
                 // at addr I, I + 1, I + 2
                 case 0x0033:
                     {
                         uint8_t target = op_X(opcode);
-                        chip8->ram[chip8->I] = chip8->V[target] / 100;
-                        chip8->ram[chip8->I + 1] = (chip8->V[target] / 10) % 10;
-                        chip8->ram[chip8->I] = chip8->V[target] % 10;
+                        c8_store(chip8, mem, chip8->I, chip8->V[target] / 100);
+                        c8_store(chip8, mem, chip8->I + 1, (chip8->V[target] / 10) % 10);
+                        c8_store(chip8, mem, chip8->I + 2, chip8->V[target] % 10);
                         chip8->pc += 2;
                     }
                     break;
@@ -369,15 +817,21 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
                 // FX55 -> Store V0 to VX in memory addr starting at I
                 case 0x0055:
                     for(uint8_t i = 0; i <= op_X(opcode); i++) {
-                        chip8->ram[chip8->I + 1] = chip8->V[i];
+                        c8_store(chip8, mem, chip8->I + i, chip8->V[i]);
+                    }
+                    if(quirks.mem_i != C8_MEM_KEEP_I) {
+                        chip8->I += op_X(opcode) + (quirks.mem_i == C8_MEM_I_PLUS_X1);
                     }
                     chip8->pc += 2;
                     break;
 
                 // FX65 -> Store values at memory addrs starting at I in V0 to VX
-                case 0x0655:
+                case 0x0065:
                     for(uint8_t i = 0; i <= op_X(opcode); i++) {
-                        chip8->V[i] = chip8->ram[chip8->I + 1];
+                        chip8->V[i] = c8_load(chip8, mem, chip8->I + i);
+                    }
+                    if(quirks.mem_i != C8_MEM_KEEP_I) {
+                        chip8->I += op_X(opcode) + (quirks.mem_i == C8_MEM_I_PLUS_X1);
                     }
                     chip8->pc += 2;
                     break;
@@ -394,17 +848,37 @@ void c8_exec_instruction(Chip8 *chip8, bool dbg) {
     }
 }
 
+// Each profile is built twice, the INFO trace compiled out of the copy that
+// runs when it's off
+#define C8_EXEC_PROFILE(id, name, ...)                                                   \
+    static void exec_##name(Chip8 *chip8) {                                              \
+        exec_instruction(chip8, false, (C8Quirks){__VA_ARGS__});                         \
+    }                                                                                    \
+    static void exec_##name##_dbg(Chip8 *chip8) {                                        \
+        exec_instruction(chip8, true, (C8Quirks){__VA_ARGS__});                          \
+    }
+C8_QUIRK_PROFILES(C8_EXEC_PROFILE)
+#undef C8_EXEC_PROFILE
+
+#define C8_EXEC_ENTRY(id, name, ...) [C8_QUIRKS_##id] = exec_##name,
+#define C8_EXEC_DBG_ENTRY(id, name, ...) [C8_QUIRKS_##id] = exec_##name##_dbg,
+static void (*const EXEC_PROFILES[2][C8_NUM_QUIRK_PROFILES])(Chip8 *chip8) = {
+    {C8_QUIRK_PROFILES(C8_EXEC_ENTRY)},
+    {C8_QUIRK_PROFILES(C8_EXEC_DBG_ENTRY)},
+};
+#undef C8_EXEC_ENTRY
+#undef C8_EXEC_DBG_ENTRY
+
+void c8_exec_instruction(Chip8 *chip8, bool dbg) {
+    EXEC_PROFILES[dbg][chip8->quirks](chip8);
+}
+
+// called once per 60 Hz frame
 void c8_tick_timers(Chip8 *chip8) {
-    if(chip8->delay_cycles >= 9) {
-        if(chip8->delay_timer > 0) {
-            chip8->delay_timer--;
-        }
-        chip8->delay_cycles = 0;
+    if(chip8->delay_timer > 0) {
+        chip8->delay_timer--;
     }
-    if(chip8->sound_cycles >= 9) {
-        if(chip8->sound_timer > 0) {
-            chip8->sound_timer--;
-        }
-        chip8->sound_cycles = 0;
+    if(chip8->sound_timer > 0) {
+        chip8->sound_timer--;
     }
 }
@@ -1,12 +1,14 @@
 #ifndef CHIP8_H
 #define CHIP8_H
 
-#include <SDL2/SDL.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #include "common.h"
+#include "quirks.h"
 
 #define op_X(op) ((op & 0x0F00) >> 8)
 #define op_Y(op) ((op & 0x00F0) >> 4)
@@ -14,23 +16,57 @@
 #define op_NN(op) (op & 0x00FF)
 #define op_NNN(op) (op & 0x0FFF)
 
-#define MEM_SIZE 4096
+// XO-CHIP's 64k, the other machines only have the first 4k of it
+#define MEM_SIZE 0x10000
+// all NNN can reach, so also all the code the engines translate
+#define CODE_MEM_SIZE 0x1000
 #define STACK_SIZE 16
 #define NUM_GPRS 16
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 32
+// the hi-res screen, lo-res uses the top left quarter of it
+#define SCREEN_WIDTH 128
+#define SCREEN_HEIGHT 64
+#define LORES_WIDTH 64
+#define LORES_HEIGHT 32
+#define SCREEN_WORDS (SCREEN_WIDTH / 64)
+#define NUM_PLANES 2
 #define NUM_KEYS 16
 #define FONTSET_SIZE 80
+// the 8x10 digits FX30 points at, right after the small ones
+#define BIG_FONT_ADDR FONTSET_SIZE
+#define BIG_FONTSET_SIZE 160
+
+// timers decrement at 60 Hz, the default cpu clock speed is 540 Hz
+#define FRAMES_PER_SECOND 60
+#define INSTRUCTIONS_PER_FRAME 9
 
 #define PROG_START_ADDR 0x200
-#define PROG_END_ADDR 0x1000
+#define PROG_END_ADDR MEM_SIZE
 #define PROG_REGION_SIZE (PROG_END_ADDR - PROG_START_ADDR)
 
+// ram is tracked for writes in 64 pages of this many bytes
+#define RAM_PAGE_SIZE (MEM_SIZE / 64)
+
+// Out of range accesses a ROM made. The access wraps around into the machine
+// and the ROM carries on, so these are only ever reports. The end of ram is
+// the end of the memory the machine's profile gives it.
+typedef enum C8Fault {
+    C8_FAULT_PC = 1 << 0,    // fetched past the end of ram
+    C8_FAULT_RAM = 1 << 1,   // I plus an offset past the end of ram
+    C8_FAULT_STACK = 1 << 2, // call with the stack full, return with it empty
+    C8_FAULT_KEY = 1 << 3,   // key number above 0xF
+} C8Fault;
+
+// machines reset with this seed so runs are reproducible unless reseeded
+#define C8_DEFAULT_SEED 0x9E3779B97F4A7C15ULL
+
 #define c8_malloc(size) c8_malloc(size, __FILE__, __LINE__)
 #define c8_calloc(nmemb, size) c8_calloc(nmemb, size, __FILE__, __LINE__)
+#define c8_realloc(ptr, size) c8_realloc(ptr, size, __FILE__, __LINE__)
+#define c8_aligned_alloc(alignment, size) c8_aligned_alloc(alignment, size, __FILE__, __LINE__)
+#define c8_pool_create(size, capacity) c8_pool_create(size, capacity, __FILE__, __LINE__)
 
 typedef struct Chip8 {
-    uint8_t ram[MEM_SIZE]; // 4k of memory
+    uint8_t ram[MEM_SIZE]; // 64k of memory
     uint16_t stack[STACK_SIZE];
 
     // registers
@@ -42,17 +78,29 @@ typedef struct Chip8 {
     uint8_t delay_timer;
     uint8_t sound_timer;
 
-    // graphics buffer
-    uint8_t screen[SCREEN_WIDTH * SCREEN_HEIGHT];
+    // graphics buffer, one bit per pixel with the leftmost pixel in the MSB.
+    // Each plane is kept as columns of 64 pixel wide words, so lo-res is the
+    // first LORES_HEIGHT words of plane 0's first column and scrolling
+    // vertically moves whole runs of words.
+    uint64_t screen[NUM_PLANES][SCREEN_WORDS][SCREEN_HEIGHT];
+    bool hires;
+    uint8_t planes;        // bit n set when drawing and clearing go to plane n
+    uint8_t rpl[NUM_GPRS]; // what FX75 saved for FX85
 
     // keypad
     bool keypad[NUM_KEYS];
 
     bool needs_draw;
+    // bit y set when row y changed since the frontend last presented it
+    uint64_t dirty_rows;
 
-    // timer cycle tracking
-    uint8_t delay_cycles;
-    uint8_t sound_cycles;
+    uint64_t cycles; // instructions executed since power on
+    uint64_t rng;    // xorshift64* state behind CXNN, never zero
+    uint8_t quirks;  // C8QuirkProfile, picked from the ROM when it's loaded
+
+    uint8_t faults;     // C8Fault bits, they stay set
+    uint16_t fault_pc;  // the instruction behind the first fault
+    uint64_t dirty_ram; // bit n set when the ROM stored into ram page n
 } Chip8;
 
 static const uint8_t FONTSET[FONTSET_SIZE] = {
@@ -74,28 +122,150 @@ static const uint8_t FONTSET[FONTSET_SIZE] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-static const uint8_t KEYMAP[NUM_KEYS] = {
-    SDLK_x, // 0
-    SDLK_1, // 1
-    SDLK_2, // 2
-    SDLK_3, // 3
-    SDLK_q, // 4
-    SDLK_w, // 5
-    SDLK_e, // 6
-    SDLK_a, // 7
-    SDLK_s, // 8
-    SDLK_d, // 9
-    SDLK_z, // A
-    SDLK_c, // B
-    SDLK_4, // C
-    SDLK_r, // D
-    SDLK_f, // E
-    SDLK_v  // F
+static const uint8_t BIG_FONTSET[BIG_FONTSET_SIZE] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
 };
 
+static inline void c8_seed(Chip8 *chip8, uint64_t seed) {
+    // zero is the one state xorshift can't leave
+    chip8->rng = seed ? seed : C8_DEFAULT_SEED;
+}
+
+static inline uint8_t c8_random(Chip8 *chip8) {
+    uint64_t x = chip8->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    chip8->rng = x;
+    return (x * 0x2545F4914F6CDD1DULL) >> 56;
+}
+
+static inline void c8_fault(Chip8 *chip8, C8Fault fault) {
+    if(!chip8->faults) {
+        chip8->fault_pc = chip8->pc;
+    }
+    chip8->faults |= fault;
+}
+
+// How much of ram a machine with these quirks has
+static inline uint32_t c8_quirks_mem(const C8Quirks *quirks) {
+    return quirks->ext == C8_EXT_XOCHIP ? MEM_SIZE : CODE_MEM_SIZE;
+}
+
+// Biggest ROM there's room for after PROG_START_ADDR under the profile
+static inline size_t c8_rom_space(C8QuirkProfile profile) {
+    return c8_quirks_mem(c8_quirks(profile)) - PROG_START_ADDR;
+}
+
+// The opcode at addr, wrapping around the end of the machine's memory
+static inline uint16_t c8_fetch(const Chip8 *chip8, uint16_t addr) {
+    uint32_t mask = c8_quirks_mem(c8_quirks(chip8->quirks)) - 1;
+    return chip8->ram[addr & mask] << 8 | chip8->ram[(addr + 1) & mask];
+}
+
+// mem is the machine's memory size, a constant wherever the quirks are
+static inline uint8_t c8_load(Chip8 *chip8, uint32_t mem, uint32_t addr) {
+    if(addr >= mem) {
+        c8_fault(chip8, C8_FAULT_RAM);
+    }
+    return chip8->ram[addr & (mem - 1)];
+}
+
+// Every store a ROM makes goes through here
+static inline void c8_store(Chip8 *chip8, uint32_t mem, uint32_t addr, uint8_t value) {
+    if(addr >= mem) {
+        c8_fault(chip8, C8_FAULT_RAM);
+    }
+    addr &= mem - 1;
+    chip8->ram[addr] = value;
+    chip8->dirty_ram |= 1ULL << (addr / RAM_PAGE_SIZE);
+}
+
+// Plane 0, in hi-res coordinates
+static inline bool c8_pixel(const Chip8 *chip8, uint8_t x, uint8_t y) {
+    return (chip8->screen[0][x / 64][y] >> (63 - x % 64)) & 1;
+}
+
+// A run of ram in the first CODE_MEM_SIZE bytes
+typedef struct C8Span {
+    uint16_t addr;
+    uint16_t len;
+} C8Span;
+
 Chip8 *chip8_init();
-void c8_load_rom(Chip8 *chip8, const char *rom_path);
+// Puts a machine that wasn't allocated by chip8_init into its power on state
+void c8_reset(Chip8 *chip8);
+// chip8_init out of a pool made with c8_pool_create(sizeof(Chip8), ...), NULL
+// once the pool is full. The machine goes back with c8_pool_free.
+Chip8 *chip8_init_pooled(C8Pool *pool);
+// Copies src into dst, ram only as far as src's quirk profile reaches. The
+// rest can't be read or written under that profile, and it's 60k of the 64k
+// for everything but XO-CHIP.
+void c8_copy_state(Chip8 *dst, const Chip8 *src);
+// Puts the machine back into the state template is in, normally one that
+// just had its ROM loaded, so restarting costs a copy instead of a reset, a
+// file read and a load. c8_engine_restore does the same for engines.
+void c8_reset_to(Chip8 *chip8, const Chip8 *template);
+// c8_reset_to that copies back only the ram pages dirty_ram marks, for a
+// machine that started out as a copy of template while its dirty_ram was 0
+void c8_reset_dirty(Chip8 *chip8, const Chip8 *template);
+// Reads a whole ROM file into a buffer the caller frees. Only the room the
+// largest profile has is checked, loading checks the profile the ROM runs under.
+uint8_t *c8_read_rom(const char *rom_path, size_t *rom_len);
+// Loads the ROM under quirks, or the profile the ROM is known to want when
+// that's NULL. A ROM bigger than that profile's ram is an error.
+void c8_load_rom_data(Chip8 *chip8, const uint8_t *rom, size_t rom_len,
+                      const C8QuirkProfile *quirks);
+void c8_load_rom(Chip8 *chip8, const char *rom_path, const C8QuirkProfile *quirks);
+// Runs the interpreter built for the machine's quirk profile
 void c8_exec_instruction(Chip8 *chip8, bool dbg);
 void c8_tick_timers(Chip8 *chip8);
+// Clears the selected planes
+void c8_clear_screen(Chip8 *chip8);
+// Lo-res, one plane and clipping, the way the default profile draws
+void c8_draw_sprite(Chip8 *chip8, uint8_t x_coord, uint8_t y_coord, uint8_t height);
+// FNV-1a over the visible part of the screen. A lo-res screen with nothing
+// on plane 1 hashes the same as it did when that was all there was.
+uint64_t c8_screen_hash(const Chip8 *chip8);
+// c8_hash_words over every plane and the registers, stack, timers, resolution
+// and RPL flags, for telling apart machines that should have run the same
+uint64_t c8_state_hash(const Chip8 *chip8);
+// How many bytes the instruction at pc is about to store, from *addr on and
+// wrapping around the end of the machine's memory. 0 when it doesn't store.
+uint32_t c8_store_range(const Chip8 *chip8, uint32_t *addr);
+// Where in the code the engines translate the instruction at pc is about to
+// store, at most two runs since stores wrap around the end of memory. Returns
+// how many, 0 for instructions that don't store.
+int c8_store_spans(const Chip8 *chip8, C8Span spans[2]);
+
+// c8_store_spans that turns away everything but FX33, FX55 and 5XY2 inline,
+// cheap enough to ask before every instruction
+static inline int c8_code_stores(const Chip8 *chip8, C8Span spans[2]) {
+    uint16_t pc = chip8->pc;
+    // pcs past the code space wrap differently per machine, so they take the long way
+    if(pc <= CODE_MEM_SIZE - 2) {
+        uint16_t opcode = chip8->ram[pc] << 8 | chip8->ram[pc + 1];
+        if((opcode & 0xF0FF) != 0xF033 && (opcode & 0xF0FF) != 0xF055 &&
+           (opcode & 0xF00F) != 0x5002) {
+            return 0;
+        }
+    }
+    return c8_store_spans(chip8, spans);
+}
 
 #endif
@@ -1,5 +1,7 @@
 #include "common.h"
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
 
 void *c8_malloc(size_t size, const char *file, int line) {
     void *ptr = malloc(size);
@@ -18,3 +20,126 @@ void *c8_calloc(size_t nmemb, size_t size, const char *file, int line) {
     }
     return ptr;
 }
+
+void *c8_realloc(void *ptr, size_t size, const char *file, int line) {
+    ptr = realloc(ptr, size);
+    if(!ptr) {
+        fprintf(stderr, "Couldn't allocate memory in %s at line %d\n", file, line);
+        exit(1);
+    }
+    return ptr;
+}
+
+void *c8_aligned_alloc(size_t alignment, size_t size, const char *file, int line) {
+    void *ptr;
+    if(posix_memalign(&ptr, alignment, size) != 0) {
+        fprintf(stderr, "Couldn't allocate memory in %s at line %d\n", file, line);
+        exit(1);
+    }
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+#define POOL_ALIGN 64
+
+// Free slots hold the link to the next free slot
+typedef struct PoolSlot {
+    struct PoolSlot *next;
+} PoolSlot;
+
+struct C8Pool {
+    uint8_t *slots;
+    size_t bytes;
+    size_t slot_size;
+    size_t capacity;
+    size_t used;
+    PoolSlot *free;
+};
+
+C8Pool *c8_pool_create(size_t size, size_t capacity, const char *file, int line) {
+    C8Pool *pool = c8_calloc(1, sizeof *pool, file, line);
+    if(size < sizeof(PoolSlot)) {
+        size = sizeof(PoolSlot);
+    }
+    pool->slot_size = (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    pool->capacity = capacity;
+    if(capacity > SIZE_MAX / pool->slot_size) {
+        fprintf(stderr, "Couldn't allocate memory in %s at line %d\n", file, line);
+        exit(1);
+    }
+    // fresh anonymous pages read as zero without being backed, so the part of
+    // a slot that never gets written never costs any memory
+    pool->bytes = capacity ? capacity * pool->slot_size : POOL_ALIGN;
+    pool->slots = mmap(NULL, pool->bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+    if(pool->slots == MAP_FAILED) {
+        fprintf(stderr, "Couldn't allocate memory in %s at line %d\n", file, line);
+        exit(1);
+    }
+
+    // handed out in address order while nothing has been given back
+    for(size_t i = capacity; i-- > 0;) {
+        PoolSlot *slot = (PoolSlot *)(pool->slots + i * pool->slot_size);
+        slot->next = pool->free;
+        pool->free = slot;
+    }
+
+    return pool;
+}
+
+void c8_pool_destroy(C8Pool *pool) {
+    munmap(pool->slots, pool->bytes);
+    free(pool);
+}
+
+void *c8_pool_alloc(C8Pool *pool) {
+    PoolSlot *slot = pool->free;
+    if(slot) {
+        pool->free = slot->next;
+        pool->used++;
+    }
+    return slot;
+}
+
+void c8_pool_free(C8Pool *pool, void *ptr) {
+    PoolSlot *slot = ptr;
+    slot->next = pool->free;
+    pool->free = slot;
+    pool->used--;
+}
+
+size_t c8_pool_capacity(const C8Pool *pool) {
+    return pool->capacity;
+}
+
+size_t c8_pool_used(const C8Pool *pool) {
+    return pool->used;
+}
+
+uint64_t c8_hash(const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for(size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+uint64_t c8_hash_words(const uint64_t *words, size_t count, uint64_t seed) {
+    uint64_t hash = seed ^ (count * 0x9E3779B97F4A7C15ULL);
+
+    for(size_t i = 0; i < count; i++) {
+        hash ^= words[i] * 0x87C37B91114253D5ULL;
+        hash = (hash << 31 | hash >> 33) * 0x4CF5AD432745937FULL;
+    }
+
+    // murmur3's finalizer, so every input bit reaches every output bit
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
@@ -1,10 +1,34 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
 void *c8_malloc(size_t size, const char *file, int line);
 void *c8_calloc(size_t nmemb, size_t size, const char *file, int line);
+void *c8_realloc(void *ptr, size_t size, const char *file, int line);
+// Zeroed, and released with free
+void *c8_aligned_alloc(size_t alignment, size_t size, const char *file, int line);
+
+// A fixed number of same sized objects carved out of one block, every slot
+// on cache lines of its own. Taking and giving back a slot is a free list pop
+// or push, nothing is allocated after c8_pool_create. Memory is only backed
+// once a slot is written to.
+typedef struct C8Pool C8Pool;
+
+C8Pool *c8_pool_create(size_t size, size_t capacity, const char *file, int line);
+void c8_pool_destroy(C8Pool *pool);
+// Not zeroed, NULL once every slot is taken
+void *c8_pool_alloc(C8Pool *pool);
+void c8_pool_free(C8Pool *pool, void *ptr);
+size_t c8_pool_capacity(const C8Pool *pool);
+size_t c8_pool_used(const C8Pool *pool);
+
+// 64 bit FNV-1a
+uint64_t c8_hash(const void *data, size_t len);
+// A multiply and rotate per word instead of per byte, several times faster
+// than c8_hash for buffers that are whole words. Values depend on byte order.
+uint64_t c8_hash_words(const uint64_t *words, size_t count, uint64_t seed);
 
 #define INFO(fmt, ...)                                                                   \
     if(dbg) {                                                                            \
@@ -0,0 +1,394 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "debug_server.h"
+
+// longest command line taken, anything past it is cut off
+#define MAX_LINE 512
+// most bytes a read command prints
+#define MAX_READ 256
+
+struct C8DebugServer {
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int listen_fd;
+    int client_fd; // -1 without a client
+    char line[MAX_LINE];
+    size_t line_len;
+    C8Debugger *dbg;
+    uint64_t stops_told; // the stop count the client last heard about
+};
+
+static const char *STOP_NAMES[] = {
+    [C8_STOP_NONE] = "none",   [C8_STOP_PAUSE] = "pause", [C8_STOP_BREAK] = "break",
+    [C8_STOP_WATCH] = "watch", [C8_STOP_STEP] = "step",
+};
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+C8DebugServer *c8_debug_server_create(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if(strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "Debugger socket path %s is too long\n", path);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        fprintf(stderr, "Couldn't create the debugger socket\n");
+        return NULL;
+    }
+    // a socket left behind by an emulator that didn't get to clean up, but
+    // never anything else that happens to be at path
+    struct stat st;
+    if(lstat(path, &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and isn't a socket\n", path);
+            close(fd);
+            return NULL;
+        }
+        unlink(path);
+    }
+    if(bind(fd, (struct sockaddr *)&addr, sizeof addr) != 0 || listen(fd, 1) != 0 ||
+       !set_nonblocking(fd)) {
+        fprintf(stderr, "Couldn't listen for a debugger on %s\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    C8DebugServer *server = c8_calloc(1, sizeof *server);
+    strcpy(server->path, path);
+    server->listen_fd = fd;
+    server->client_fd = -1;
+    server->dbg = c8_debugger_create();
+    return server;
+}
+
+static void reply(C8DebugServer *server, const char *fmt, ...) {
+    char buf[MAX_READ * 3 + 64];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof buf - 1, fmt, args);
+    va_end(args);
+
+    if(len > (int)sizeof buf - 2) {
+        len = sizeof buf - 2;
+    }
+    buf[len++] = '\n';
+    // a client that went away is noticed by the next read
+    send(server->client_fd, buf, len, MSG_NOSIGNAL);
+}
+
+static void hang_up(C8DebugServer *server, C8Engine *engine) {
+    c8_engine_set_debugger(engine, NULL);
+    c8_debugger_clear(server->dbg);
+    close(server->client_fd);
+    server->client_fd = -1;
+    server->line_len = 0;
+}
+
+void c8_debug_server_destroy(C8DebugServer *server, C8Engine *engine) {
+    if(server->client_fd >= 0) {
+        hang_up(server, engine);
+    }
+    close(server->listen_fd);
+    unlink(server->path);
+    c8_debugger_destroy(server->dbg);
+    free(server);
+}
+
+// Tells the client about the last time the machine stopped, if it hasn't
+// heard about it yet
+static void tell_stop(C8DebugServer *server) {
+    const C8DebugStop *stop = c8_debugger_stop(server->dbg);
+    if(server->client_fd < 0 || stop->count == server->stops_told) {
+        return;
+    }
+    server->stops_told = stop->count;
+
+    char detail[96] = "";
+    if(stop->reason == C8_STOP_WATCH && stop->regs) {
+        size_t len = 0;
+        for(int i = 0; i < NUM_GPRS; i++) {
+            if(stop->regs & C8_WATCH_V(i)) {
+                len += snprintf(detail + len, sizeof detail - len, " v%x", i);
+            }
+        }
+        if(stop->regs & C8_WATCH_I) {
+            snprintf(detail + len, sizeof detail - len, " i");
+        }
+    } else if(stop->reason == C8_STOP_WATCH) {
+        snprintf(detail, sizeof detail, " addr=%03x", stop->addr);
+    }
+    reply(server, "stop %s pc=%03x%s", STOP_NAMES[stop->reason], stop->pc, detail);
+}
+
+static bool parse_number(const char *token, int base, uint32_t max, uint32_t *value) {
+    char *end;
+    if(!token || !*token) {
+        return false;
+    }
+    unsigned long parsed = strtoul(token, &end, base);
+    if(*end != '\0' || parsed > max) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+// v0 to vf and i as C8_WATCH bits
+static bool parse_register(const char *token, uint32_t *mask) {
+    uint32_t v;
+    if(token && token[0] == 'v' && parse_number(token + 1, 16, NUM_GPRS - 1, &v)) {
+        *mask = C8_WATCH_V(v);
+        return true;
+    }
+    if(token && strcmp(token, "i") == 0) {
+        *mask = C8_WATCH_I;
+        return true;
+    }
+    return false;
+}
+
+static void read_ram(C8DebugServer *server, const Chip8 *chip8, uint32_t addr,
+                     uint32_t len) {
+    uint32_t mem = c8_quirks_mem(c8_quirks(chip8->quirks));
+    char buf[MAX_READ * 3 + 1];
+    size_t used = 0;
+
+    for(uint32_t i = 0; i < len; i++) {
+        used += snprintf(buf + used, sizeof buf - used, " %02x",
+                         chip8->ram[(addr + i) & (mem - 1)]);
+    }
+    reply(server, "ok%s", buf);
+}
+
+static void write_ram(C8DebugServer *server, C8Engine *engine, Chip8 *chip8,
+                      uint32_t addr, char **save) {
+    uint32_t mem = c8_quirks_mem(c8_quirks(chip8->quirks));
+    uint8_t bytes[MAX_LINE / 2];
+    uint32_t count = 0;
+    char *token;
+
+    // nothing is stored unless every byte parses
+    while((token = strtok_r(NULL, " \t\r", save))) {
+        uint32_t byte;
+        if(!parse_number(token, 16, 0xFF, &byte)) {
+            reply(server, "error %s isn't a byte", token);
+            return;
+        }
+        bytes[count++] = byte;
+    }
+    if(count == 0) {
+        reply(server, "error write needs bytes to store");
+        return;
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        uint32_t at = (addr + i) & (mem - 1);
+        c8_store(chip8, mem, at, bytes[i]);
+        c8_engine_invalidate(engine, at, 1);
+    }
+    reply(server, "ok");
+}
+
+static void set_register(C8DebugServer *server, Chip8 *chip8, const char *name,
+                         const char *arg) {
+    uint32_t mask = 0;
+    uint32_t max, value;
+
+    if(parse_register(name, &mask) && mask != C8_WATCH_I) {
+        max = 0xFF;
+    } else if(name && strcmp(name, "i") == 0) {
+        max = 0xFFFF;
+    } else if(name && strcmp(name, "pc") == 0) {
+        max = c8_quirks_mem(c8_quirks(chip8->quirks)) - 1;
+    } else if(name && strcmp(name, "sp") == 0) {
+        max = STACK_SIZE;
+    } else if(name && (strcmp(name, "dt") == 0 || strcmp(name, "st") == 0)) {
+        max = 0xFF;
+    } else {
+        reply(server, "error set takes v0 to vf, i, pc, sp, dt or st");
+        return;
+    }
+    if(!parse_number(arg, 16, max, &value)) {
+        reply(server, "error set %s needs a value up to %x", name, max);
+        return;
+    }
+
+    if(name[0] == 'v') {
+        chip8->V[__builtin_ctz(mask)] = value;
+    } else if(name[0] == 'i') {
+        chip8->I = value;
+    } else if(name[0] == 'p') {
+        chip8->pc = value;
+    } else if(name[0] == 's' && name[1] == 'p') {
+        chip8->sp = value;
+    } else if(name[0] == 'd') {
+        chip8->delay_timer = value;
+    } else {
+        chip8->sound_timer = value;
+    }
+    reply(server, "ok");
+}
+
+static void run_command(C8DebugServer *server, C8Engine *engine, Chip8 *chip8,
+                        char *line) {
+    C8Debugger *dbg = server->dbg;
+    uint32_t mem = c8_quirks_mem(c8_quirks(chip8->quirks));
+    char *save;
+    char *cmd = strtok_r(line, " \t\r", &save);
+    char *arg = cmd ? strtok_r(NULL, " \t\r", &save) : NULL;
+    uint32_t addr, len, mask;
+
+    if(!cmd) {
+        return;
+    }
+
+    if(strcmp(cmd, "break") == 0 || strcmp(cmd, "delete") == 0) {
+        if(!parse_number(arg, 16, mem - 1, &addr)) {
+            reply(server, "error %s needs an address", cmd);
+            return;
+        }
+        c8_debugger_set_break(dbg, addr, cmd[0] == 'b');
+        reply(server, "ok");
+    } else if(strcmp(cmd, "watch") == 0 || strcmp(cmd, "unwatch") == 0) {
+        bool on = cmd[0] == 'w';
+        if(parse_register(arg, &mask)) {
+            c8_debugger_watch_regs(dbg, mask, on);
+        } else if(parse_number(arg, 16, mem - 1, &addr)) {
+            char *count = strtok_r(NULL, " \t\r", &save);
+            len = 1;
+            if(count && (!parse_number(count, 16, mem, &len) || len == 0)) {
+                reply(server, "error %s isn't a length", count);
+                return;
+            }
+            c8_debugger_watch_ram(dbg, addr, len, on);
+        } else {
+            reply(server, "error %s needs an address or a register", cmd);
+            return;
+        }
+        reply(server, "ok");
+    } else if(strcmp(cmd, "step") == 0) {
+        uint32_t n = 1;
+        if(arg && (!parse_number(arg, 10, UINT32_MAX, &n) || n == 0)) {
+            reply(server, "error %s isn't an instruction count", arg);
+            return;
+        }
+        reply(server, "ok");
+        c8_debugger_step(dbg, chip8, n);
+        c8_engine_run(engine, n);
+    } else if(strcmp(cmd, "continue") == 0) {
+        c8_debugger_resume(dbg, chip8);
+        reply(server, "ok");
+    } else if(strcmp(cmd, "pause") == 0) {
+        if(!c8_debugger_paused(dbg)) {
+            c8_debugger_pause(dbg, chip8);
+        }
+        reply(server, "ok");
+    } else if(strcmp(cmd, "regs") == 0) {
+        char v[NUM_GPRS * 3 + 1];
+        for(int i = 0; i < NUM_GPRS; i++) {
+            snprintf(v + i * 3, sizeof v - i * 3, " %02x", chip8->V[i]);
+        }
+        reply(server, "ok pc=%03x i=%03x sp=%x dt=%02x st=%02x v=%s", chip8->pc, chip8->I,
+              chip8->sp, chip8->delay_timer, chip8->sound_timer, v + 1);
+    } else if(strcmp(cmd, "read") == 0) {
+        char *count = strtok_r(NULL, " \t\r", &save);
+        len = 16;
+        if(!parse_number(arg, 16, mem - 1, &addr) ||
+           (count && (!parse_number(count, 16, MAX_READ, &len) || len == 0))) {
+            reply(server, "error read needs an address and at most %x bytes", MAX_READ);
+            return;
+        }
+        read_ram(server, chip8, addr, len);
+    } else if(strcmp(cmd, "write") == 0) {
+        if(!parse_number(arg, 16, mem - 1, &addr)) {
+            reply(server, "error write needs an address");
+            return;
+        }
+        write_ram(server, engine, chip8, addr, &save);
+    } else if(strcmp(cmd, "set") == 0) {
+        set_register(server, chip8, arg, strtok_r(NULL, " \t\r", &save));
+    } else if(strcmp(cmd, "detach") == 0) {
+        reply(server, "ok");
+        hang_up(server, engine);
+    } else {
+        reply(server, "error unknown command %s", cmd);
+    }
+}
+
+static void accept_client(C8DebugServer *server, C8Engine *engine, const Chip8 *chip8) {
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if(fd < 0) {
+        return;
+    }
+    if(!set_nonblocking(fd)) {
+        close(fd);
+        return;
+    }
+
+    server->client_fd = fd;
+    server->stops_told = c8_debugger_stop(server->dbg)->count;
+    // from here on the engine runs the instrumented loop
+    c8_engine_set_debugger(engine, server->dbg);
+    reply(server, "ok attached pc=%03x", chip8->pc);
+}
+
+void c8_debug_server_poll(C8DebugServer *server, C8Engine *engine, Chip8 *chip8,
+                          int timeout_ms) {
+    // stops since the last poll, while the machine ran
+    tell_stop(server);
+
+    struct pollfd pfd = {
+        .fd = server->client_fd >= 0 ? server->client_fd : server->listen_fd,
+        .events = POLLIN,
+    };
+    if(poll(&pfd, 1, timeout_ms) <= 0) {
+        return;
+    }
+
+    if(server->client_fd < 0) {
+        accept_client(server, engine, chip8);
+        return;
+    }
+
+    char buf[1024];
+    ssize_t got = read(server->client_fd, buf, sizeof buf);
+    if(got < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if(got <= 0) {
+        hang_up(server, engine);
+        return;
+    }
+
+    for(ssize_t i = 0; i < got && server->client_fd >= 0; i++) {
+        if(buf[i] != '\n') {
+            if(server->line_len < MAX_LINE - 1) {
+                server->line[server->line_len++] = buf[i];
+            }
+            continue;
+        }
+        server->line[server->line_len] = '\0';
+        server->line_len = 0;
+        run_command(server, engine, chip8, server->line);
+        tell_stop(server);
+    }
+}
+
+void c8_debug_server_wait(C8DebugServer *server, C8Engine *engine, Chip8 *chip8) {
+    while(server->client_fd < 0) {
+        c8_debug_server_poll(server, engine, chip8, -1);
+    }
+    c8_debugger_pause(server->dbg, chip8);
+}
@@ -0,0 +1,44 @@
+#ifndef DEBUG_SERVER_H
+#define DEBUG_SERVER_H
+
+#include "engine.h"
+
+// Serves a debugger on a Unix domain socket, one client at a time. The
+// debugger is only set on the engine while a client is connected, so an
+// emulator nobody is attached to runs at full speed.
+//
+// The protocol is a command per line, with step counts in decimal and
+// everything else in hex:
+//   break <addr>            stop before running the instruction at addr
+//   delete <addr>           drop that breakpoint
+//   watch <addr> [len]      stop after a store into [addr, addr + len)
+//   watch v<x> | i          stop after an instruction changes the register
+//   unwatch <as for watch>  drop the watchpoint
+//   step [n]                run n instructions, 1 by default, then stop
+//   continue                run until something stops the machine
+//   pause                   stop where it is
+//   regs                    print pc, I, sp, the timers and V0 to VF
+//   read <addr> [len]       print len bytes of ram, 16 by default
+//   write <addr> <byte>...  store bytes into ram
+//   set <reg> <value>       set v<x>, i, pc, sp, dt or st
+//   detach                  hang up, leaving the machine running
+// Every command is answered with a line starting "ok" or "error". Whenever
+// the machine stops, a line "stop <reason> pc=<pc>" follows, with the
+// address or registers behind a watch stop.
+typedef struct C8DebugServer C8DebugServer;
+
+// NULL when the socket can't be created or something other than a socket is
+// already at path. A stale socket there is replaced.
+C8DebugServer *c8_debug_server_create(const char *path);
+// Hangs up on the client, leaving the machine running, and removes the socket
+void c8_debug_server_destroy(C8DebugServer *server, C8Engine *engine);
+
+// Takes a client that's waiting and carries out the commands it sent, waiting
+// up to timeout_ms for any to arrive. Runs on the thread that runs the engine,
+// between two calls to it.
+void c8_debug_server_poll(C8DebugServer *server, C8Engine *engine, Chip8 *chip8,
+                          int timeout_ms);
+// Blocks until a client attaches and stops the machine for it where it is
+void c8_debug_server_wait(C8DebugServer *server, C8Engine *engine, Chip8 *chip8);
+
+#endif
@@ -0,0 +1,146 @@
+#include "debugger.h"
+
+struct C8Debugger {
+    uint64_t breaks[MEM_SIZE / 64];
+    uint64_t watches[MEM_SIZE / 64];
+    uint32_t watched_bytes;
+    uint32_t watched_regs;
+
+    bool paused;
+    uint64_t steps_left; // 0 unless stepping
+    bool skip_break;     // resumed from the breakpoint at pc
+    C8DebugStop stop;
+};
+
+static inline bool test_bit(const uint64_t *bits, uint32_t addr) {
+    return bits[addr / 64] >> (addr % 64) & 1;
+}
+
+static inline void set_bit(uint64_t *bits, uint32_t addr, bool on) {
+    if(on) {
+        bits[addr / 64] |= 1ULL << (addr % 64);
+    } else {
+        bits[addr / 64] &= ~(1ULL << (addr % 64));
+    }
+}
+
+C8Debugger *c8_debugger_create(void) {
+    return c8_calloc(1, sizeof(C8Debugger));
+}
+
+void c8_debugger_destroy(C8Debugger *dbg) {
+    free(dbg);
+}
+
+void c8_debugger_clear(C8Debugger *dbg) {
+    uint64_t count = dbg->stop.count;
+    memset(dbg, 0, sizeof *dbg);
+    dbg->stop.count = count;
+}
+
+void c8_debugger_set_break(C8Debugger *dbg, uint16_t addr, bool on) {
+    set_bit(dbg->breaks, addr, on);
+}
+
+void c8_debugger_watch_ram(C8Debugger *dbg, uint16_t addr, uint32_t len, bool on) {
+    for(uint32_t i = 0; i < len && i < MEM_SIZE; i++) {
+        uint32_t at = (addr + i) % MEM_SIZE;
+        dbg->watched_bytes += on - test_bit(dbg->watches, at);
+        set_bit(dbg->watches, at, on);
+    }
+}
+
+void c8_debugger_watch_regs(C8Debugger *dbg, uint32_t mask, bool on) {
+    if(on) {
+        dbg->watched_regs |= mask;
+    } else {
+        dbg->watched_regs &= ~mask;
+    }
+}
+
+static void stop(C8Debugger *dbg, const Chip8 *chip8, C8StopReason reason) {
+    dbg->paused = true;
+    dbg->steps_left = 0;
+    dbg->stop.reason = reason;
+    dbg->stop.pc = chip8->pc;
+    dbg->stop.count++;
+}
+
+void c8_debugger_pause(C8Debugger *dbg, const Chip8 *chip8) {
+    stop(dbg, chip8, C8_STOP_PAUSE);
+}
+
+void c8_debugger_resume(C8Debugger *dbg, const Chip8 *chip8) {
+    // anywhere else, the breakpoint at pc is one the machine hasn't stopped at yet
+    dbg->skip_break = dbg->paused && dbg->stop.reason == C8_STOP_BREAK &&
+                      dbg->stop.pc == chip8->pc;
+    dbg->paused = false;
+    dbg->steps_left = 0;
+    dbg->stop.reason = C8_STOP_NONE;
+}
+
+void c8_debugger_step(C8Debugger *dbg, const Chip8 *chip8, uint64_t n) {
+    c8_debugger_resume(dbg, chip8);
+    dbg->steps_left = n;
+}
+
+bool c8_debugger_paused(const C8Debugger *dbg) {
+    return dbg->paused;
+}
+
+const C8DebugStop *c8_debugger_stop(const C8Debugger *dbg) {
+    return &dbg->stop;
+}
+
+// The first watched byte among those the instruction at pc is about to
+// store, -1 when there's none
+static int64_t watched_store(const C8Debugger *dbg, const Chip8 *chip8) {
+    uint32_t mem = c8_quirks_mem(c8_quirks(chip8->quirks));
+    uint32_t addr;
+    uint32_t len = c8_store_range(chip8, &addr);
+
+    for(uint32_t i = 0; i < len; i++) {
+        uint32_t at = (addr + i) & (mem - 1);
+        if(test_bit(dbg->watches, at)) {
+            return at;
+        }
+    }
+    return -1;
+}
+
+uint64_t c8_debugger_run(C8Debugger *dbg, Chip8 *chip8, uint64_t n, C8DebugStepFn step,
+                         void *ctx) {
+    uint64_t ran = 0;
+
+    while(ran < n && !dbg->paused) {
+        if(test_bit(dbg->breaks, chip8->pc) && !dbg->skip_break) {
+            stop(dbg, chip8, C8_STOP_BREAK);
+            break;
+        }
+        dbg->skip_break = false;
+
+        int64_t store = dbg->watched_bytes ? watched_store(dbg, chip8) : -1;
+        uint8_t V[NUM_GPRS];
+        uint16_t I = chip8->I;
+        memcpy(V, chip8->V, sizeof V);
+
+        step(ctx, chip8);
+        ran++;
+
+        uint32_t changed = (chip8->I != I) * C8_WATCH_I;
+        for(int i = 0; i < NUM_GPRS; i++) {
+            changed |= (chip8->V[i] != V[i]) * C8_WATCH_V(i);
+        }
+        changed &= dbg->watched_regs;
+
+        if(store >= 0 || changed) {
+            stop(dbg, chip8, C8_STOP_WATCH);
+            dbg->stop.addr = store >= 0 ? store : 0;
+            dbg->stop.regs = changed;
+        } else if(dbg->steps_left > 0 && --dbg->steps_left == 0) {
+            stop(dbg, chip8, C8_STOP_STEP);
+        }
+    }
+
+    return ran;
+}
@@ -0,0 +1,60 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include "chip8.h"
+
+// Breakpoints and watchpoints for one machine: a bit per address pc can
+// break at, a bit per ram byte stores are watched on and a mask of watched
+// registers. Only c8_debugger_run looks at them, and engines only switch to
+// it while a debugger is set (c8_engine_set_debugger), so the usual path
+// never pays for the checks.
+typedef struct C8Debugger C8Debugger;
+
+typedef enum C8StopReason {
+    C8_STOP_NONE,  // running
+    C8_STOP_PAUSE, // told to stop
+    C8_STOP_BREAK, // at a breakpoint, before running the instruction under it
+    C8_STOP_WATCH, // after an instruction stored into watched ram or changed a register
+    C8_STOP_STEP,  // ran every instruction it was stepped for
+} C8StopReason;
+
+// register watch bits, bit n for Vn
+#define C8_WATCH_V(n) (1u << (n))
+#define C8_WATCH_I (1u << NUM_GPRS)
+
+typedef struct C8DebugStop {
+    C8StopReason reason;
+    uint16_t pc;
+    uint32_t addr;  // first watched byte stored into, for a ram watch
+    uint32_t regs;  // watched registers that changed, for a register watch
+    uint64_t count; // stops so far, to tell a new one from the last
+} C8DebugStop;
+
+C8Debugger *c8_debugger_create(void);
+void c8_debugger_destroy(C8Debugger *dbg);
+// Drops every breakpoint and watchpoint and leaves the machine running
+void c8_debugger_clear(C8Debugger *dbg);
+
+void c8_debugger_set_break(C8Debugger *dbg, uint16_t addr, bool on);
+// Stores into [addr, addr + len) stop the machine, wrapping around the end of ram
+void c8_debugger_watch_ram(C8Debugger *dbg, uint16_t addr, uint32_t len, bool on);
+// Changes to the registers in mask, C8_WATCH_V and C8_WATCH_I bits, stop the machine
+void c8_debugger_watch_regs(C8Debugger *dbg, uint32_t mask, bool on);
+
+void c8_debugger_pause(C8Debugger *dbg, const Chip8 *chip8);
+// Starts the machine back up, a breakpoint it stopped at letting the
+// instruction under it run
+void c8_debugger_resume(C8Debugger *dbg, const Chip8 *chip8);
+// c8_debugger_resume for n instructions, stopping with C8_STOP_STEP after them
+void c8_debugger_step(C8Debugger *dbg, const Chip8 *chip8, uint64_t n);
+
+bool c8_debugger_paused(const C8Debugger *dbg);
+const C8DebugStop *c8_debugger_stop(const C8Debugger *dbg);
+
+// Single steps at most n instructions through step, checking each of them,
+// until something stops the machine. Returns how many ran.
+typedef void (*C8DebugStepFn)(void *ctx, Chip8 *chip8);
+uint64_t c8_debugger_run(C8Debugger *dbg, Chip8 *chip8, uint64_t n, C8DebugStepFn step,
+                         void *ctx);
+
+#endif
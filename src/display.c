@@ -0,0 +1,148 @@
+#include "display.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// the word of one plane's row holding columns [64 * word, 64 * word + 64)
+#define SCREEN_WORD(screen, plane, word, y)                                              \
+    (screen)[((plane) * SCREEN_WORDS + (word)) * SCREEN_HEIGHT + (y)]
+
+uint64_t c8_dirty_texture_rows(const uint64_t *screen, const uint64_t *shown, bool hires) {
+    uint64_t dirty_rows = 0;
+
+    for(uint8_t y = 0; y < (hires ? SCREEN_HEIGHT : LORES_HEIGHT); y++) {
+        uint64_t differs = 0;
+        for(uint8_t plane = 0; plane < NUM_PLANES; plane++) {
+            for(uint8_t word = 0; word < SCREEN_WORDS; word++) {
+                differs |=
+                    SCREEN_WORD(screen, plane, word, y) ^ SCREEN_WORD(shown, plane, word, y);
+            }
+        }
+        if(differs) {
+            dirty_rows |= hires ? 1ULL << y : 3ULL << (2 * y);
+        }
+    }
+
+    return dirty_rows;
+}
+
+bool c8_dirty_span(uint64_t dirty_rows, uint8_t *first, uint8_t *count) {
+    if(!dirty_rows) {
+        return false;
+    }
+
+    uint8_t lo = __builtin_ctzll(dirty_rows);
+    uint8_t hi = 63 - __builtin_clzll(dirty_rows);
+    *first = lo;
+    *count = hi - lo + 1;
+    return true;
+}
+
+#ifdef __SSE2__
+
+// 8 pixels at a time: broadcast each plane's byte, test one bit per 32 bit
+// lane and turn the all-ones/all-zeros compare results into ARGB. The colour
+// is built with XORs, each mask flipping in the difference it makes. Doubled
+// pixels, for lo-res, come from interleaving the lanes with themselves.
+static void bytes_to_argb(uint8_t byte0, uint8_t byte1, bool doubled, uint32_t *out) {
+    const __m128i bits_lo = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+    const __m128i bits_hi = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+    const __m128i off = _mm_set1_epi32((int)PIXEL_OFF);
+    const __m128i on = _mm_set1_epi32((int)(PIXEL_ON ^ PIXEL_OFF));
+    const __m128i plane2 = _mm_set1_epi32((int)(PIXEL_PLANE2 ^ PIXEL_OFF));
+    const __m128i both = _mm_set1_epi32((int)(PIXEL_BOTH ^ PIXEL_ON ^ PIXEL_PLANE2 ^ PIXEL_OFF));
+    __m128i b0 = _mm_set1_epi32(byte0);
+    __m128i b1 = _mm_set1_epi32(byte1);
+    __m128i half[2];
+
+    for(int i = 0; i < 2; i++) {
+        __m128i bits = i ? bits_hi : bits_lo;
+        __m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(b0, bits), bits);
+        __m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(b1, bits), bits);
+        __m128i argb = _mm_xor_si128(off, _mm_and_si128(m0, on));
+        argb = _mm_xor_si128(argb, _mm_and_si128(m1, plane2));
+        half[i] = _mm_xor_si128(argb, _mm_and_si128(_mm_and_si128(m0, m1), both));
+    }
+
+    if(!doubled) {
+        _mm_storeu_si128((__m128i *)out, half[0]);
+        _mm_storeu_si128((__m128i *)(out + 4), half[1]);
+        return;
+    }
+    for(int i = 0; i < 2; i++) {
+        _mm_storeu_si128((__m128i *)(out + i * 8), _mm_unpacklo_epi32(half[i], half[i]));
+        _mm_storeu_si128((__m128i *)(out + i * 8 + 4), _mm_unpackhi_epi32(half[i], half[i]));
+    }
+}
+
+#else
+
+static void bytes_to_argb(uint8_t byte0, uint8_t byte1, bool doubled, uint32_t *out) {
+    static const uint32_t colours[] = {PIXEL_OFF, PIXEL_ON, PIXEL_PLANE2, PIXEL_BOTH};
+    for(int x = 0; x < 8; x++) {
+        uint32_t argb = colours[(byte0 >> (7 - x) & 1) | (byte1 >> (7 - x) & 1) << 1];
+        if(doubled) {
+            out[2 * x] = out[2 * x + 1] = argb;
+        } else {
+            out[x] = argb;
+        }
+    }
+}
+
+#endif
+
+// A lo-res row fills two texture rows, each of its pixels two texture pixels
+static void row_to_argb(const uint64_t *screen, bool hires, uint8_t row, uint32_t *out) {
+    uint8_t y = hires ? row : row / 2;
+    uint8_t words = hires ? SCREEN_WORDS : 1;
+    uint8_t step = hires ? 8 : 16;
+
+    for(uint8_t word = 0; word < words; word++) {
+        uint64_t bits0 = SCREEN_WORD(screen, 0, word, y);
+        uint64_t bits1 = SCREEN_WORD(screen, 1, word, y);
+        for(int i = 0; i < 8; i++) {
+            bytes_to_argb(bits0 >> (56 - i * 8), bits1 >> (56 - i * 8), !hires,
+                          out + (word * 8 + i) * step);
+        }
+    }
+}
+
+void c8_screen_to_argb(const uint64_t *screen, bool hires, uint8_t first, uint8_t count,
+                       uint32_t *pixels, size_t pitch) {
+    for(uint8_t y = 0; y < count; y++) {
+        row_to_argb(screen, hires, first + y, (uint32_t *)((uint8_t *)pixels + y * pitch));
+    }
+}
+
+bool c8_screen_save_pbm(const uint64_t *screen, bool hires, const char *path) {
+    uint8_t words = hires ? SCREEN_WORDS : 1;
+    uint8_t height = hires ? SCREEN_HEIGHT : LORES_HEIGHT;
+    // lo-res rows are the left half of the first word
+    uint8_t row_bytes = hires ? SCREEN_WIDTH / 8 : LORES_WIDTH / 8;
+
+    FILE *file = fopen(path, "wb");
+    if(!file) {
+        fprintf(stderr, "Couldn't open %s\n", path);
+        return false;
+    }
+
+    bool ok = fprintf(file, "P4\n%u %u\n", row_bytes * 8, height) > 0;
+    for(uint8_t y = 0; y < height && ok; y++) {
+        uint8_t row[SCREEN_WIDTH / 8];
+        for(uint8_t word = 0; word < words; word++) {
+            uint64_t bits =
+                SCREEN_WORD(screen, 0, word, y) | SCREEN_WORD(screen, 1, word, y);
+            for(int i = 0; i < 8; i++) {
+                row[word * 8 + i] = bits >> (56 - i * 8);
+            }
+        }
+        ok = fwrite(row, row_bytes, 1, file) == 1;
+    }
+    ok = fclose(file) == 0 && ok;
+
+    if(!ok) {
+        fprintf(stderr, "Couldn't write %s\n", path);
+    }
+    return ok;
+}
@@ -0,0 +1,31 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include "chip8.h"
+
+#define PIXEL_ON 0xFFFFFFFF
+#define PIXEL_OFF 0xFF000000
+// XO-CHIP's second plane on its own, and both planes on top of each other
+#define PIXEL_PLANE2 0xFFFF8C00
+#define PIXEL_BOTH 0xFF808080
+
+// Every resolution is shown in one SCREEN_WIDTH x SCREEN_HEIGHT texture,
+// lo-res with each pixel doubled both ways. screen and shown below point at
+// a Chip8 screen's first word.
+
+// Texture rows that differ between two screens in the same resolution
+uint64_t c8_dirty_texture_rows(const uint64_t *screen, const uint64_t *shown, bool hires);
+
+// Smallest run of rows covering every dirty row, false if nothing is dirty
+bool c8_dirty_span(uint64_t dirty_rows, uint8_t *first, uint8_t *count);
+
+// Expands texture rows [first, first + count) of the packed screen into
+// ARGB8888. pixels points at the first converted row, pitch is in bytes.
+void c8_screen_to_argb(const uint64_t *screen, bool hires, uint8_t first, uint8_t count,
+                       uint32_t *pixels, size_t pitch);
+
+// Writes the screen in its own resolution as a binary PBM, a pixel lit on
+// either plane coming out black
+bool c8_screen_save_pbm(const uint64_t *screen, bool hires, const char *path);
+
+#endif
@@ -0,0 +1,550 @@
+#include "engine.h"
+#include "debugger.h"
+#include "engine_aot.h"
+#include "engine_cached.h"
+#include "engine_jit.h"
+#include "savestate.h"
+
+// Everything an instruction without side effects can change
+typedef struct IdleState {
+    uint16_t pc;
+    uint16_t I;
+    uint8_t V[NUM_GPRS];
+} IdleState;
+
+// A frame that only ran pure instructions and left the machine as it found
+// it, but for the registers it last loaded from the delay timer. Every frame
+// after it does the same until the delay timer runs out or a key changes.
+typedef struct IdleFrame {
+    bool found;
+    IdleState end; // what the machine looks like at the end of every such frame
+    uint16_t timer_regs;
+    uint8_t quirks;
+    bool keypad[NUM_KEYS];
+} IdleFrame;
+
+struct C8Engine {
+    C8EngineKind kind;
+    Chip8 *chip8;
+    C8DecodeCache *cache;
+    C8Jit *jit;
+    C8Aot *aot;
+    C8Profile *prof;
+    C8TraceWriter *trace;
+    C8Debugger *debugger;
+    bool dbg;
+    bool idle_skip;
+    uint64_t skipped;
+    uint16_t frame_pc; // where the last frame started
+    IdleFrame idle;
+    uint8_t quirks; // the profile the cache and the JIT decoded for
+};
+
+static const char *ENGINE_NAMES[] = {
+    [C8_ENGINE_INTERP] = "interp",
+    [C8_ENGINE_CACHED] = "cached",
+    [C8_ENGINE_JIT] = "jit",
+    [C8_ENGINE_PROFILE] = "profile",
+    [C8_ENGINE_AOT] = "aot",
+};
+
+C8Engine *c8_engine_create(C8EngineKind kind, Chip8 *chip8) {
+    C8Engine *engine = c8_calloc(1, sizeof *engine);
+    engine->kind = kind;
+    engine->chip8 = chip8;
+    engine->idle_skip = true;
+    engine->quirks = chip8->quirks;
+
+    if(kind == C8_ENGINE_CACHED) {
+        engine->cache = c8_cache_create();
+    }
+
+    if(kind == C8_ENGINE_JIT) {
+        engine->jit = c8_jit_create();
+        if(!engine->jit) {
+            fprintf(stderr, "The JIT engine needs an x86-64 host\n");
+            exit(1);
+        }
+    }
+
+    if(kind == C8_ENGINE_AOT) {
+        engine->aot = c8_aot_create();
+        if(!engine->aot) {
+            fprintf(stderr, "The aot engine needs a binary built with make aot ROM=...\n");
+            exit(1);
+        }
+    }
+
+    if(kind == C8_ENGINE_PROFILE) {
+#ifdef C8_PROFILE
+        engine->prof = c8_profile_create();
+#else
+        fprintf(stderr, "The profile engine needs a build with C8_PROFILE (make PROFILE=1)\n");
+        exit(1);
+#endif
+    }
+
+    return engine;
+}
+
+void c8_engine_destroy(C8Engine *engine) {
+    free(engine->cache);
+    c8_jit_destroy(engine->jit);
+    c8_aot_destroy(engine->aot);
+    c8_profile_destroy(engine->prof);
+    free(engine);
+}
+
+void c8_engine_invalidate(C8Engine *engine, uint16_t addr, uint16_t len) {
+    // an idle loop may read what changed, even past the code
+    engine->idle.found = false;
+    if(engine->cache) {
+        c8_cache_invalidate(engine->cache, addr, len);
+    }
+    if(engine->jit) {
+        c8_jit_invalidate(engine->jit, addr, len);
+    }
+    if(engine->aot) {
+        c8_aot_invalidate(engine->aot, addr, len);
+    }
+}
+
+// Single steps the reference interpreter and keeps the engine's view of ram
+// in sync with whatever the instruction stored
+static void step_reference(C8Engine *engine, Chip8 *chip8) {
+#ifdef C8_PROFILE
+    // the profile engine has nothing derived from ram to invalidate
+    if(engine->prof) {
+        c8_profile_exec(engine->prof, chip8, engine->dbg);
+        return;
+    }
+#endif
+
+    C8Span stores[2];
+    int count = c8_code_stores(chip8, stores);
+
+    if(engine->trace) {
+        c8_trace_exec(engine->trace, chip8, engine->dbg);
+    } else {
+        c8_exec_instruction(chip8, engine->dbg);
+    }
+
+    for(int i = 0; i < count; i++) {
+        c8_engine_invalidate(engine, stores[i].addr, stores[i].len);
+    }
+}
+
+static void debug_step(void *engine, Chip8 *chip8) {
+    step_reference(engine, chip8);
+}
+
+// The longest spin loop looked for, in instructions. Probing only pays off
+// when there are a few loops' worth of instructions left to skip.
+#define IDLE_MAX_PROBE 32
+#define IDLE_MIN_RUN (2 * IDLE_MAX_PROBE)
+
+// Whether the reference interpreter only touches V, I and pc for this, the
+// keypad and timers being read but never written
+static bool is_pure(uint16_t opcode) {
+    switch(opcode & 0xF000) {
+        // the no-ops and 00FD, everything else there moves the screen or the stack.
+        // Like the reference, any 0NE0 clears and any 0NEE returns.
+        case 0x0000:
+            if(op_NN(opcode) == 0xE0 || op_NN(opcode) == 0xEE) {
+                return false;
+            }
+            return opcode > 0x00FF || opcode == 0x00FD ||
+                   ((opcode < 0x00C0 || opcode > 0x00DF) && opcode < 0x00FB);
+        // 5XY2 stores on XO-CHIP
+        case 0x5000:
+            return op_N(opcode) != 2;
+        case 0x2000:
+        case 0xC000:
+        case 0xD000:
+            return false;
+        case 0xF000:
+            return op_NN(opcode) != 0x01 && op_NN(opcode) != 0x15 && op_NN(opcode) != 0x18 &&
+                   op_NN(opcode) != 0x33 && op_NN(opcode) != 0x55 && op_NN(opcode) != 0x75;
+        default:
+            return true;
+    }
+}
+
+static IdleState idle_state(const Chip8 *chip8) {
+    IdleState state = {.pc = chip8->pc, .I = chip8->I};
+    memcpy(state.V, chip8->V, sizeof state.V);
+    return state;
+}
+
+// Single steps the machine while it only runs pure instructions, watching for
+// it to come back to a state it was already in. Nothing outside V, I and pc
+// moves in between and the keypad and timers hold still until the run is
+// over, so from then on it goes round the same loop until the run ends. The
+// whole laps left are skipped and only the partial lap at the end executes.
+// Returns the instructions this accounted for, executed or skipped.
+static uint64_t skip_idle(C8Engine *engine, Chip8 *chip8, uint64_t n) {
+    IdleState seen[IDLE_MAX_PROBE];
+    uint32_t steps = 0;
+
+    while(steps < IDLE_MAX_PROBE && chip8->pc <= CODE_MEM_SIZE - 2) {
+        uint16_t opcode = c8_fetch(chip8, chip8->pc);
+        if(!is_pure(opcode)) {
+            break;
+        }
+
+        seen[steps] = idle_state(chip8);
+        c8_exec_instruction(chip8, false);
+        steps++;
+
+        IdleState now = idle_state(chip8);
+        for(uint32_t i = 0; i < steps; i++) {
+            if(seen[i].pc == now.pc && memcmp(&seen[i], &now, sizeof now) == 0) {
+                uint64_t lap = steps - i;
+                uint64_t skip = (n - steps) / lap * lap;
+                engine->skipped += skip;
+                return steps + skip;
+            }
+        }
+    }
+
+    return steps;
+}
+
+// Registers a pure instruction reads or writes, not telling the two apart
+static uint16_t idle_regs(uint16_t opcode) {
+    uint32_t x = 1 << op_X(opcode);
+    uint32_t y = 1 << op_Y(opcode);
+
+    switch(opcode & 0xF000) {
+        case 0x0000:
+        case 0x1000:
+        case 0xA000:
+            return 0;
+        // 5XY3 loads VX to VY, in either order
+        case 0x5000:
+            if(op_N(opcode) != 0) {
+                uint32_t lo = x < y ? x : y;
+                uint32_t hi = x < y ? y : x;
+                return (hi << 1) - lo;
+            }
+            return x | y;
+        case 0x8000:
+            return x | y | 1 << 0xF;
+        case 0x9000:
+            return x | y;
+        case 0xB000:
+            return 1 | x;
+        case 0xF000:
+            if(opcode == 0xF000) {
+                return 0;
+            }
+            if(op_NN(opcode) == 0x65 || op_NN(opcode) == 0x85) {
+                return (x << 1) - 1;
+            }
+            return x;
+        default:
+            return x;
+    }
+}
+
+// Registers a pure instruction writes whatever the quirks and the keypad
+static uint16_t idle_writes(uint16_t opcode) {
+    uint32_t x = 1 << op_X(opcode);
+
+    switch(opcode & 0xF000) {
+        case 0x6000:
+        case 0x7000:
+            return x;
+        // the sums, differences and shifts set VF after VX
+        case 0x8000:
+            return x | ((op_N(opcode) >= 4 && op_N(opcode) <= 7) || op_N(opcode) == 0xE ? 1 << 0xF : 0);
+        case 0xF000:
+            if(op_NN(opcode) == 0x07) {
+                return x;
+            }
+            return op_NN(opcode) == 0x65 ? (x << 1) - 1 : 0;
+        default:
+            return 0;
+    }
+}
+
+// 3X00 or 4X00, the only way a register loaded from the delay timer may be
+// read. Until the timer runs out they go the same way whatever it holds.
+static bool is_zero_test(uint16_t opcode) {
+    return op_NN(opcode) == 0 && ((opcode & 0xF000) == 0x3000 || (opcode & 0xF000) == 0x4000);
+}
+
+// Runs a frame through the reference interpreter as long as it only executes
+// pure instructions. When it ends as it started, but for registers it loaded
+// from the delay timer and read nothing but zero tests of, every frame after it
+// takes the same path and ends the same way, with those registers a tick
+// lower, and the frame is remembered for skip_idle_frames.
+static void probe_frame(C8Engine *engine, Chip8 *chip8, uint32_t ipf) {
+    IdleState start = idle_state(chip8);
+    uint16_t timer_regs = 0;
+    uint16_t written = 0;
+    uint16_t read_first = 0;   // read before being written, not just zero tested
+    uint16_t tested_first = 0; // zero tested before being written
+    uint32_t steps = 0;
+
+    while(steps < ipf && chip8->pc <= CODE_MEM_SIZE - 2) {
+        uint16_t opcode = c8_fetch(chip8, chip8->pc);
+        uint16_t x = 1 << op_X(opcode);
+        // FX07 and 6XNN write VX without reading it
+        bool loads_timer = (opcode & 0xF0FF) == 0xF007;
+        bool sets = (opcode & 0xF000) == 0x6000;
+        if(!is_pure(opcode)) {
+            break;
+        }
+        if(is_zero_test(opcode)) {
+            tested_first |= x & ~written;
+        } else if(!loads_timer && !sets) {
+            uint16_t regs = idle_regs(opcode);
+            if(regs & timer_regs) {
+                break;
+            }
+            read_first |= regs & ~written;
+        }
+
+        c8_exec_instruction(chip8, false);
+        steps++;
+        written |= idle_writes(opcode);
+        timer_regs = loads_timer ? timer_regs | x : timer_regs & ~idle_writes(opcode);
+    }
+
+    chip8->cycles += steps;
+    if(steps < ipf) {
+        c8_engine_run(engine, ipf - steps);
+        return;
+    }
+
+    // a timer that's out stays out, along with what was loaded from it
+    if(chip8->delay_timer == 0) {
+        timer_regs = 0;
+    }
+    IdleState end = idle_state(chip8);
+    bool same = start.pc == end.pc && start.I == end.I;
+    for(int r = 0; r < NUM_GPRS; r++) {
+        if(timer_regs >> r & 1) {
+            // the next frame starts with the timer in these
+            same &= !(read_first >> r & 1) && (!(tested_first >> r & 1) || start.V[r] != 0);
+        } else {
+            same &= start.V[r] == end.V[r];
+        }
+    }
+    if(!same) {
+        return;
+    }
+
+    engine->idle = (IdleFrame){
+        .found = true,
+        .end = end,
+        .timer_regs = timer_regs,
+        .quirks = chip8->quirks,
+    };
+    memcpy(engine->idle.keypad, chip8->keypad, sizeof engine->idle.keypad);
+}
+
+// Skips up to frames whole frames of the idle frame probe_frame found, ticking
+// the timers for each, as long as the machine is still where that frame left
+// it with the same keys down. Registers loaded from the delay timer limit it
+// to the frames left before the timer runs out.
+static uint64_t skip_idle_frames(C8Engine *engine, Chip8 *chip8, uint64_t frames, uint32_t ipf) {
+    IdleFrame *idle = &engine->idle;
+    IdleState now = idle_state(chip8);
+    if(idle->quirks != chip8->quirks || memcmp(&now, &idle->end, sizeof now) != 0 ||
+       memcmp(idle->keypad, chip8->keypad, sizeof idle->keypad) != 0) {
+        idle->found = false;
+        return 0;
+    }
+
+    uint64_t skip = frames;
+    if(idle->timer_regs) {
+        skip = skip < chip8->delay_timer ? skip : chip8->delay_timer;
+        if(skip == 0) {
+            idle->found = false;
+            return 0;
+        }
+        // as the last skipped frame loaded them
+        for(int r = 0; r < NUM_GPRS; r++) {
+            if(idle->timer_regs >> r & 1) {
+                chip8->V[r] = chip8->delay_timer - (skip - 1);
+            }
+        }
+    }
+    chip8->delay_timer = chip8->delay_timer > skip ? chip8->delay_timer - skip : 0;
+    chip8->sound_timer = chip8->sound_timer > skip ? chip8->sound_timer - skip : 0;
+
+    chip8->cycles += skip * ipf;
+    engine->skipped += skip * ipf;
+    idle->end = idle_state(chip8);
+    return skip;
+}
+
+// The trace and the profile both want every instruction that ran, and the
+// debugger steps through them all itself
+static bool can_skip_idle(const C8Engine *engine) {
+    return engine->idle_skip && !engine->dbg && !engine->prof && !engine->trace &&
+           !engine->debugger;
+}
+
+// Runs as much of n as the engine can before it needs the reference
+// interpreter, which for the interpreters is nothing
+static uint64_t run_engine(C8Engine *engine, Chip8 *chip8, uint64_t n) {
+    switch(engine->kind) {
+        case C8_ENGINE_CACHED:
+            return c8_cache_run(engine->cache, chip8, n);
+        case C8_ENGINE_JIT:
+            return c8_jit_run(engine->jit, chip8, n);
+        case C8_ENGINE_AOT:
+            return c8_aot_run(engine->aot, chip8, n);
+        default:
+            return 0;
+    }
+}
+
+// Anything an engine stops in front of is single stepped through the
+// reference interpreter
+void c8_engine_run(C8Engine *engine, uint64_t n) {
+    Chip8 *chip8 = engine->chip8;
+
+    // decoded and translated code has the quirks built in
+    if(chip8->quirks != engine->quirks) {
+        engine->quirks = chip8->quirks;
+        c8_engine_invalidate(engine, 0, CODE_MEM_SIZE);
+    }
+
+    // the checks live in a loop of their own, one that may stop short of n
+    if(engine->debugger) {
+        chip8->cycles += c8_debugger_run(engine->debugger, chip8, n, debug_step, engine);
+        return;
+    }
+
+    // every engine runs exactly n, so the count is kept here once
+    chip8->cycles += n;
+
+    if(n >= IDLE_MIN_RUN && can_skip_idle(engine)) {
+        n -= skip_idle(engine, chip8, n);
+    }
+
+    while(n > 0) {
+        // only the reference interpreter hands the trace every instruction
+        n -= engine->trace ? 0 : run_engine(engine, chip8, n);
+
+        if(n > 0) {
+            step_reference(engine, chip8);
+            n--;
+        }
+    }
+}
+
+void c8_engine_end_frame(C8Engine *engine) {
+    if(c8_engine_paused(engine)) {
+        return;
+    }
+    c8_tick_timers(engine->chip8);
+#ifdef C8_PROFILE
+    if(engine->prof) {
+        c8_profile_end_frame(engine->prof);
+    }
+#endif
+}
+
+// A frame that starts where the last one did is probed for an idle loop, and
+// once one is found the frames it spends are skipped. Longer frames are left
+// to skip_idle, which finds the loop inside the frame.
+static void run_frames(C8Engine *engine, uint64_t frames, uint32_t ipf) {
+    Chip8 *chip8 = engine->chip8;
+    bool idle = ipf <= IDLE_MIN_RUN && can_skip_idle(engine);
+
+    while(frames > 0) {
+        if(idle && engine->idle.found) {
+            uint64_t skipped = skip_idle_frames(engine, chip8, frames, ipf);
+            frames -= skipped;
+            if(skipped > 0) {
+                continue;
+            }
+        }
+
+        uint16_t pc = chip8->pc;
+        if(idle && pc == engine->frame_pc) {
+            probe_frame(engine, chip8, ipf);
+        } else {
+            c8_engine_run(engine, ipf);
+        }
+        engine->frame_pc = pc;
+        c8_engine_end_frame(engine);
+        frames--;
+    }
+}
+
+void c8_engine_run_frame(C8Engine *engine, uint32_t ipf) {
+    run_frames(engine, 1, ipf);
+}
+
+void c8_engine_run_frames(C8Engine *engine, uint64_t n, uint32_t ipf) {
+    run_frames(engine, n / ipf, ipf);
+    c8_engine_run(engine, n % ipf);
+}
+
+void c8_engine_attach(C8Engine *engine, Chip8 *chip8) {
+    engine->chip8 = chip8;
+    engine->quirks = chip8->quirks;
+    c8_engine_invalidate(engine, 0, CODE_MEM_SIZE);
+}
+
+void c8_engine_restore(C8Engine *engine, const Chip8 *snapshot) {
+    // engines only care about the code in ram, and only in whole blocks of it
+    const uint16_t chunk = 64;
+
+    for(uint16_t addr = 0; addr < CODE_MEM_SIZE; addr += chunk) {
+        if(memcmp(engine->chip8->ram + addr, snapshot->ram + addr, chunk) != 0) {
+            c8_engine_invalidate(engine, addr, chunk);
+        }
+    }
+
+    c8_restore(engine->chip8, snapshot);
+    engine->idle.found = false;
+}
+
+void c8_engine_set_debug(C8Engine *engine, bool dbg) {
+    engine->dbg = dbg;
+}
+
+void c8_engine_set_trace(C8Engine *engine, C8TraceWriter *trace) {
+    engine->trace = trace;
+}
+
+void c8_engine_set_debugger(C8Engine *engine, C8Debugger *debugger) {
+    engine->debugger = debugger;
+}
+
+bool c8_engine_paused(const C8Engine *engine) {
+    return engine->debugger && c8_debugger_paused(engine->debugger);
+}
+
+void c8_engine_set_idle_skip(C8Engine *engine, bool skip) {
+    engine->idle_skip = skip;
+}
+
+uint64_t c8_engine_skipped(const C8Engine *engine) {
+    return engine->skipped;
+}
+
+const C8Profile *c8_engine_profile(const C8Engine *engine) {
+    return engine->prof;
+}
+
+const char *c8_engine_name(C8EngineKind kind) {
+    return ENGINE_NAMES[kind];
+}
+
+bool c8_engine_from_name(const char *name, C8EngineKind *kind) {
+    for(size_t i = 0; i < sizeof ENGINE_NAMES / sizeof *ENGINE_NAMES; i++) {
+        if(strcmp(name, ENGINE_NAMES[i]) == 0) {
+            *kind = i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,83 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "chip8.h"
+#include "debugger.h"
+#include "profile.h"
+#include "trace.h"
+
+typedef enum C8EngineKind {
+    C8_ENGINE_INTERP,  // reference switch interpreter (c8_exec_instruction)
+    C8_ENGINE_CACHED,  // pre-decoded instruction cache with threaded dispatch
+    C8_ENGINE_JIT,     // basic-block recompiler to x86-64
+    C8_ENGINE_PROFILE, // reference interpreter counting everything, C8_PROFILE only
+    C8_ENGINE_AOT,     // C translated ahead of time by chip8-aot and linked in
+} C8EngineKind;
+
+// An engine is bound to the one machine it was created for since the
+// faster engines keep state derived from that machine's ram
+typedef struct C8Engine C8Engine;
+
+C8Engine *c8_engine_create(C8EngineKind kind, Chip8 *chip8);
+void c8_engine_destroy(C8Engine *engine);
+
+// Runs n instructions. Timers are left alone, they belong to the frame.
+// A machine found spinning in a loop that can't change anything before the
+// run is over (waiting on the delay timer, FX0A with no key down, a jump to
+// itself) has the rest of its laps skipped, ending in the same state.
+void c8_engine_run(C8Engine *engine, uint64_t n);
+
+// One 60 Hz frame: ipf instructions followed by c8_engine_end_frame
+void c8_engine_run_frame(C8Engine *engine, uint32_t ipf);
+// The timer tick, plus closing the frame for the profiler. Timers hold still
+// while a debugger has the machine stopped.
+void c8_engine_end_frame(C8Engine *engine);
+
+// Runs n instructions as whole frames of ipf, then whatever is left over
+// without a timer tick. With idle skipping on, a frame that comes back to
+// where it started having only spun in a loop has the frames after it skipped
+// with just their timer ticks, until the delay timer runs out or a key changes.
+void c8_engine_run_frames(C8Engine *engine, uint64_t n, uint32_t ipf);
+
+// Rebinds the engine to another machine and drops everything it derived from
+// the old one, which is cheaper than a fresh engine for the JIT
+void c8_engine_attach(C8Engine *engine, Chip8 *chip8);
+
+// Only the reference interpreter prints the INFO trace
+void c8_engine_set_debug(C8Engine *engine, bool dbg);
+
+// While a trace is set every instruction goes through the reference
+// interpreter into it, whatever the engine. NULL stops tracing. The profile
+// engine doesn't trace.
+void c8_engine_set_trace(C8Engine *engine, C8TraceWriter *trace);
+
+// While a debugger is set every instruction goes through the reference
+// interpreter and the debugger's checks, and c8_engine_run stops short when
+// one of them stops the machine. The cycle count only covers what ran. NULL
+// goes back to running at full speed.
+void c8_engine_set_debugger(C8Engine *engine, C8Debugger *debugger);
+// Whether the debugger set has the machine stopped
+bool c8_engine_paused(const C8Engine *engine);
+
+// Idle loops are skipped unless this is turned off. Runs with the trace on, a
+// debugger set or under the profile engine always execute every instruction.
+void c8_engine_set_idle_skip(C8Engine *engine, bool skip);
+// Instructions skipped so far rather than executed
+uint64_t c8_engine_skipped(const C8Engine *engine);
+
+// c8_restore for a machine an engine runs. Only the parts of ram that differ
+// from the snapshot are invalidated, so translated code mostly survives.
+void c8_engine_restore(C8Engine *engine, const Chip8 *snapshot);
+
+// Must be called after anything other than the engine itself writes to ram.
+// Only the first CODE_MEM_SIZE bytes hold code engines translate, anything
+// past that is ignored.
+void c8_engine_invalidate(C8Engine *engine, uint16_t addr, uint16_t len);
+
+// NULL unless this is the profile engine
+const C8Profile *c8_engine_profile(const C8Engine *engine);
+
+const char *c8_engine_name(C8EngineKind kind);
+bool c8_engine_from_name(const char *name, C8EngineKind *kind);
+
+#endif
@@ -0,0 +1,99 @@
+#include "engine_aot.h"
+
+// chip8-aot's output defines this, every other binary gets the NULL
+__attribute__((weak)) const C8AotProgram *c8_aot_program;
+
+C8Aot *c8_aot_create(void) {
+    if(!c8_aot_program) {
+        return NULL;
+    }
+
+    C8Aot *aot = c8_malloc(sizeof *aot);
+    aot->prog = c8_aot_program;
+    aot->modified = 0;
+    // nothing is known about the machine yet
+    aot->unchecked = UINT64_MAX;
+    return aot;
+}
+
+void c8_aot_destroy(C8Aot *aot) {
+    free(aot);
+}
+
+static uint64_t chunk_mask(uint32_t addr, uint32_t len) {
+    uint32_t first = addr / CODE_CHUNK_SIZE;
+    uint32_t last = (addr + len - 1) / CODE_CHUNK_SIZE;
+    uint64_t upto = last >= 63 ? UINT64_MAX : (2ULL << last) - 1;
+    return upto & ~((1ULL << first) - 1);
+}
+
+void c8_aot_invalidate(C8Aot *aot, uint16_t addr, uint16_t len) {
+    if(len == 0 || addr >= CODE_MEM_SIZE) {
+        return;
+    }
+    if(len > CODE_MEM_SIZE - addr) {
+        len = CODE_MEM_SIZE - addr;
+    }
+    aot->unchecked |= chunk_mask(addr, len);
+}
+
+// Compares the chunks stored into since the last time against the image
+static void recheck(C8Aot *aot, const Chip8 *chip8) {
+    while(aot->unchecked) {
+        uint32_t chunk = __builtin_ctzll(aot->unchecked);
+        uint32_t addr = chunk * CODE_CHUNK_SIZE;
+        uint64_t bit = 1ULL << chunk;
+
+        if(memcmp(chip8->ram + addr, aot->prog->image + addr, CODE_CHUNK_SIZE) != 0) {
+            aot->modified |= bit;
+        } else {
+            aot->modified &= ~bit;
+        }
+        aot->unchecked &= ~bit;
+    }
+}
+
+bool c8_aot_interpret(Chip8 *chip8, C8Aot *aot, uint16_t pc) {
+    C8Span stores[2];
+    chip8->pc = pc;
+    int count = c8_code_stores(chip8, stores);
+
+    c8_exec_instruction(chip8, false);
+
+    for(int i = 0; i < count; i++) {
+        c8_aot_invalidate(aot, stores[i].addr, stores[i].len);
+    }
+    return count > 0;
+}
+
+uint64_t c8_aot_run(C8Aot *aot, Chip8 *chip8, uint64_t n) {
+    const C8AotProgram *prog = aot->prog;
+    uint64_t ran = 0;
+
+    if(chip8->quirks != prog->quirks) {
+        return 0;
+    }
+
+    while(ran < n) {
+        uint16_t pc = chip8->pc;
+        if(pc > CODE_MEM_SIZE - 2) {
+            break;
+        }
+
+        const C8AotBlock *block = &prog->blocks[pc];
+        if(!block->run) {
+            break;
+        }
+
+        recheck(aot, chip8);
+        // only a block in a chunk that changed needs its own bytes compared
+        if((block->chunks & aot->modified) &&
+           memcmp(chip8->ram + pc, prog->image + pc, block->len) != 0) {
+            break;
+        }
+
+        ran = block->run(chip8, aot, n, ran);
+    }
+
+    return ran;
+}
@@ -0,0 +1,90 @@
+#ifndef ENGINE_AOT_H
+#define ENGINE_AOT_H
+
+#include "chip8.h"
+
+// Runs ROMs chip8-aot translated to C ahead of time. The translation is
+// linked into the binary as c8_aot_program, one function per basic block.
+// Blocks only run while the ram they were translated from is unchanged and
+// the machine has the quirks they were translated for, everything else is
+// left to the reference interpreter.
+typedef struct C8AotProgram C8AotProgram;
+
+// Out in the open since translated code checks modified before going on
+// into the next block
+typedef struct C8Aot {
+    const C8AotProgram *prog;
+    uint64_t modified;  // chunks of code ram that differ from the image
+    uint64_t unchecked; // chunks stored into since they were last compared
+} C8Aot;
+
+// Carries on from ran instructions until n have run, through this block and
+// whichever blocks it goes on to, and returns the new ran with pc on the next
+// instruction. Blocks go on into each other with tail calls, which the
+// Makefile's -O2 makes jumps; without those the stack still only grows by
+// one frame per block run before the budget is used up.
+typedef uint64_t (*C8AotBlockFn)(Chip8 *chip8, C8Aot *aot, uint64_t n, uint64_t ran);
+
+typedef struct C8AotBlock {
+    C8AotBlockFn run; // NULL where no block starts
+    uint16_t len;     // bytes of ram it was translated from
+    uint64_t chunks;  // the CODE_CHUNK_SIZE chunks those lie in
+} C8AotBlock;
+
+struct C8AotProgram {
+    uint8_t quirks;           // C8QuirkProfile
+    const uint8_t *image;     // the first CODE_MEM_SIZE bytes of ram after loading
+    const C8AotBlock *blocks; // one per code address
+    const char *rom;          // the file it was translated from, for messages
+};
+
+// code ram is compared against the image in chunks of this many bytes
+#define CODE_CHUNK_SIZE (CODE_MEM_SIZE / 64)
+
+// NULL unless a translation was linked in
+extern const C8AotProgram *c8_aot_program;
+
+// NULL when there's no translation to run
+C8Aot *c8_aot_create(void);
+void c8_aot_destroy(C8Aot *aot);
+
+// Runs at most n instructions and returns how many ran. Stops early when pc
+// gets to somewhere without a block or to one that's stale.
+uint64_t c8_aot_run(C8Aot *aot, Chip8 *chip8, uint64_t n);
+
+void c8_aot_invalidate(C8Aot *aot, uint16_t addr, uint16_t len);
+
+// For translated code: runs the instruction at pc through the reference
+// interpreter. Returns true when it stored into code, which may have been the
+// calling block's own.
+bool c8_aot_interpret(Chip8 *chip8, C8Aot *aot, uint16_t pc);
+
+// For translated code, where left is what the budget had when the block was
+// entered. Leaves the block with pc at its k-th instruction when the budget
+// is used up before it.
+#define C8_AOT_BUDGET(k, next)                                                           \
+    if(left == (k)) {                                                                    \
+        chip8->pc = (next);                                                              \
+        return ran + (k);                                                                \
+    }
+
+// For translated code: the block's end after k instructions, with pc set.
+// Back at its own start it goes round again, anywhere else with a block that
+// is still fresh it goes on there. BLOCKS is the translation's block table,
+// for a pc known at translation time the compiler resolves the lookup.
+#define C8_AOT_EXIT(start, k)                                                            \
+    ran += (k);                                                                          \
+    if(ran < n) {                                                                        \
+        if(chip8->pc == (start)) {                                                       \
+            goto top;                                                                    \
+        }                                                                                \
+        if(chip8->pc <= CODE_MEM_SIZE - 2) {                                             \
+            const C8AotBlock *next = &BLOCKS[chip8->pc];                                 \
+            if(next->run && !(next->chunks & aot->modified)) {                           \
+                return next->run(chip8, aot, n, ran);                                    \
+            }                                                                            \
+        }                                                                                \
+    }                                                                                    \
+    return ran;
+
+#endif
@@ -0,0 +1,464 @@
+#include "engine_cached.h"
+
+// handler indices, in the order of the label table in c8_cache_run
+enum {
+    K_DECODE,
+    K_CLS,
+    K_RET,
+    K_UNKNOWN,
+    K_JP,
+    K_CALL,
+    K_SE_VX_NN,
+    K_SNE_VX_NN,
+    K_SE_VX_VY,
+    K_LD_VX_NN,
+    K_ADD_VX_NN,
+    K_LD_VX_VY,
+    K_OR,
+    K_AND,
+    K_XOR,
+    K_ADD_VX_VY,
+    K_SUB,
+    K_SHR,
+    K_SUBN,
+    K_SHL,
+    K_SNE_VX_VY,
+    K_LD_I,
+    K_JP_V0,
+    K_RND,
+    K_DRW,
+    K_SKP,
+    K_SKNP,
+    K_LD_VX_DT,
+    K_LD_VX_K,
+    K_LD_DT,
+    K_LD_ST,
+    K_ADD_I,
+    K_LD_F,
+    K_LD_B,
+    K_LD_MEM_VX,
+    K_LD_VX_MEM,
+    K_INTERPRET,
+};
+
+// Mirrors the dispatch in c8_exec_instruction, quirks included
+static uint8_t decode_kind(uint16_t opcode) {
+    switch(opcode & 0xF000) {
+        case 0x0000:
+            switch(opcode & 0x00FF) {
+                case 0x00E0:
+                    return K_CLS;
+                case 0x00EE:
+                    return K_RET;
+                default:
+                    return K_UNKNOWN;
+            }
+        case 0x1000:
+            return K_JP;
+        case 0x2000:
+            return K_CALL;
+        case 0x3000:
+            return K_SE_VX_NN;
+        case 0x4000:
+            return K_SNE_VX_NN;
+        case 0x5000:
+            return K_SE_VX_VY;
+        case 0x6000:
+            return K_LD_VX_NN;
+        case 0x7000:
+            return K_ADD_VX_NN;
+        case 0x8000:
+            switch(opcode & 0x000F) {
+                case 0x0000:
+                    return K_LD_VX_VY;
+                case 0x0001:
+                    return K_OR;
+                case 0x0002:
+                    return K_AND;
+                case 0x0003:
+                    return K_XOR;
+                case 0x0004:
+                    return K_ADD_VX_VY;
+                case 0x0005:
+                    return K_SUB;
+                case 0x0006:
+                    return K_SHR;
+                case 0x0007:
+                    return K_SUBN;
+                case 0x000E:
+                    return K_SHL;
+                default:
+                    return K_UNKNOWN;
+            }
+        case 0x9000:
+            return K_SNE_VX_VY;
+        case 0xA000:
+            return K_LD_I;
+        case 0xB000:
+            return K_JP_V0;
+        case 0xC000:
+            return K_RND;
+        case 0xD000:
+            return K_DRW;
+        case 0xE000:
+            switch(opcode & 0x00FF) {
+                case 0x009E:
+                    return K_SKP;
+                case 0x00A1:
+                    return K_SKNP;
+                default:
+                    return K_UNKNOWN;
+            }
+        default: // 0xF000
+            switch(opcode & 0x00FF) {
+                case 0x0007:
+                    return K_LD_VX_DT;
+                case 0x000A:
+                    return K_LD_VX_K;
+                case 0x0015:
+                    return K_LD_DT;
+                case 0x0018:
+                    return K_LD_ST;
+                case 0x001E:
+                    return K_ADD_I;
+                case 0x0029:
+                    return K_LD_F;
+                case 0x0033:
+                    return K_LD_B;
+                case 0x0055:
+                    return K_LD_MEM_VX;
+                case 0x0065:
+                    return K_LD_VX_MEM;
+                default:
+                    return K_UNKNOWN;
+            }
+    }
+}
+
+C8DecodeCache *c8_cache_create(void) {
+    C8DecodeCache *cache = c8_calloc(1, sizeof *cache);
+    // the handler addresses only exist inside c8_cache_run
+    c8_cache_run(cache, NULL, 0);
+    return cache;
+}
+
+void c8_cache_invalidate(C8DecodeCache *cache, uint16_t addr, uint16_t len) {
+    uint32_t to = (uint32_t)addr + len;
+    if(to > CODE_MEM_SIZE) {
+        to = CODE_MEM_SIZE;
+    }
+    // an instruction starting one byte earlier also covers addr
+    uint32_t from = addr > 0 ? addr - 1 : 0;
+
+    for(uint32_t i = from; i < to; i++) {
+        cache->ops[i].handler = cache->decode_handler;
+    }
+}
+
+uint64_t c8_cache_run(C8DecodeCache *cache, Chip8 *chip8, uint64_t n) {
+    static const void *const handlers[] = {
+        [K_DECODE] = &&op_decode,     [K_CLS] = &&op_cls,
+        [K_RET] = &&op_ret,           [K_UNKNOWN] = &&op_unknown,
+        [K_JP] = &&op_jp,             [K_CALL] = &&op_call,
+        [K_SE_VX_NN] = &&op_se_vx_nn, [K_SNE_VX_NN] = &&op_sne_vx_nn,
+        [K_SE_VX_VY] = &&op_se_vx_vy, [K_LD_VX_NN] = &&op_ld_vx_nn,
+        [K_ADD_VX_NN] = &&op_add_vx_nn, [K_LD_VX_VY] = &&op_ld_vx_vy,
+        [K_OR] = &&op_or,             [K_AND] = &&op_and,
+        [K_XOR] = &&op_xor,           [K_ADD_VX_VY] = &&op_add_vx_vy,
+        [K_SUB] = &&op_sub,           [K_SHR] = &&op_shr,
+        [K_SUBN] = &&op_subn,         [K_SHL] = &&op_shl,
+        [K_SNE_VX_VY] = &&op_sne_vx_vy, [K_LD_I] = &&op_ld_i,
+        [K_JP_V0] = &&op_jp_v0,       [K_RND] = &&op_rnd,
+        [K_DRW] = &&op_drw,           [K_SKP] = &&op_skp,
+        [K_SKNP] = &&op_sknp,         [K_LD_VX_DT] = &&op_ld_vx_dt,
+        [K_LD_VX_K] = &&op_ld_vx_k,   [K_LD_DT] = &&op_ld_dt,
+        [K_LD_ST] = &&op_ld_st,       [K_ADD_I] = &&op_add_i,
+        [K_LD_F] = &&op_ld_f,         [K_LD_B] = &&op_ld_b,
+        [K_LD_MEM_VX] = &&op_ld_mem_vx, [K_LD_VX_MEM] = &&op_ld_vx_mem,
+        [K_INTERPRET] = &&op_interpret,
+    };
+
+    if(!cache->decode_handler) {
+// label addresses stay valid after we return, they are code not stack
+#if __GNUC__ >= 12
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdangling-pointer"
+#endif
+        cache->decode_handler = handlers[K_DECODE];
+#if __GNUC__ >= 12
+#pragma GCC diagnostic pop
+#endif
+        for(size_t i = 0; i < CODE_MEM_SIZE; i++) {
+            cache->ops[i].handler = handlers[K_DECODE];
+        }
+    }
+
+    if(n == 0) {
+        return 0;
+    }
+
+    uint64_t ran = 0;
+    uint16_t pc = chip8->pc;
+    uint8_t *V = chip8->V;
+    C8DecodedOp *op;
+
+// anything fetching past the code space is left to the reference interpreter,
+// and so is every access that would fault or reach past it
+#define DISPATCH()                                                                       \
+    do {                                                                                 \
+        if(ran == n || pc > CODE_MEM_SIZE - 2) {                                         \
+            goto out;                                                                    \
+        }                                                                                \
+        op = &cache->ops[pc];                                                            \
+        goto *op->handler;                                                               \
+    } while(0)
+
+#define NEXT()                                                                           \
+    do {                                                                                 \
+        ran++;                                                                           \
+        DISPATCH();                                                                      \
+    } while(0)
+
+#define NEXT_PC()                                                                        \
+    do {                                                                                 \
+        pc += 2;                                                                         \
+        NEXT();                                                                          \
+    } while(0)
+
+    DISPATCH();
+
+op_decode: {
+    uint16_t opcode = (chip8->ram[pc] << 8) | chip8->ram[pc + 1];
+    bool quirky = c8_quirks_affect(c8_quirks(chip8->quirks), opcode);
+    op->handler = handlers[quirky ? K_INTERPRET : decode_kind(opcode)];
+    op->nnn = op_NNN(opcode);
+    op->x = op_X(opcode);
+    op->y = op_Y(opcode);
+    op->nn = op_NN(opcode);
+    op->n = op_N(opcode);
+    goto *op->handler;
+}
+
+op_cls:
+    c8_clear_screen(chip8);
+    NEXT_PC();
+
+op_ret:
+    if((uint8_t)(chip8->sp - 1) >= STACK_SIZE) {
+        goto op_interpret;
+    }
+    chip8->sp--;
+    pc = chip8->stack[chip8->sp] + 2;
+    NEXT();
+
+op_unknown:
+    NEXT_PC();
+
+op_jp:
+    pc = op->nnn;
+    NEXT();
+
+op_call:
+    if(chip8->sp >= STACK_SIZE) {
+        goto op_interpret;
+    }
+    chip8->stack[chip8->sp++] = pc;
+    pc = op->nnn;
+    NEXT();
+
+op_se_vx_nn:
+    pc += V[op->x] == op->nn ? 4 : 2;
+    NEXT();
+
+op_sne_vx_nn:
+    pc += V[op->x] != op->nn ? 4 : 2;
+    NEXT();
+
+op_se_vx_vy:
+    pc += V[op->x] == V[op->y] ? 4 : 2;
+    NEXT();
+
+op_ld_vx_nn:
+    V[op->x] = op->nn;
+    NEXT_PC();
+
+op_add_vx_nn:
+    V[op->x] += op->nn;
+    NEXT_PC();
+
+op_ld_vx_vy:
+    V[op->x] = V[op->y];
+    NEXT_PC();
+
+op_or:
+    V[op->x] |= V[op->y];
+    NEXT_PC();
+
+op_and:
+    V[op->x] &= V[op->y];
+    NEXT_PC();
+
+op_xor:
+    V[op->x] ^= V[op->y];
+    NEXT_PC();
+
+// the flag goes in last so it wins when X is F
+op_add_vx_vy: {
+    uint16_t sum = V[op->x] + V[op->y];
+    V[op->x] = sum;
+    V[0xF] = sum > 0xFF;
+    NEXT_PC();
+}
+
+op_sub: {
+    uint8_t no_borrow = V[op->x] >= V[op->y];
+    V[op->x] -= V[op->y];
+    V[0xF] = no_borrow;
+    NEXT_PC();
+}
+
+op_shr: {
+    uint8_t flag = V[op->x] & 0x1;
+    V[op->x] >>= 1;
+    V[0xF] = flag;
+    NEXT_PC();
+}
+
+op_subn: {
+    uint8_t no_borrow = V[op->y] >= V[op->x];
+    V[op->x] = V[op->y] - V[op->x];
+    V[0xF] = no_borrow;
+    NEXT_PC();
+}
+
+op_shl: {
+    uint8_t flag = V[op->x] >> 7;
+    V[op->x] <<= 1;
+    V[0xF] = flag;
+    NEXT_PC();
+}
+
+op_sne_vx_vy:
+    pc += V[op->x] != V[op->y] ? 4 : 2;
+    NEXT();
+
+op_ld_i:
+    chip8->I = op->nnn;
+    NEXT_PC();
+
+op_jp_v0:
+    pc = op->nnn + V[0];
+    NEXT();
+
+op_rnd:
+    V[op->x] = c8_random(chip8) & op->nn;
+    NEXT_PC();
+
+op_drw:
+    if(chip8->I + op->n > CODE_MEM_SIZE) {
+        goto op_interpret;
+    }
+    c8_draw_sprite(chip8, V[op->x], V[op->y], op->n);
+    NEXT_PC();
+
+op_skp:
+    if(V[op->x] >= NUM_KEYS) {
+        goto op_interpret;
+    }
+    pc += chip8->keypad[V[op->x]] != 0 ? 4 : 2;
+    NEXT();
+
+op_sknp:
+    if(V[op->x] >= NUM_KEYS) {
+        goto op_interpret;
+    }
+    pc += chip8->keypad[V[op->x]] == 0 ? 4 : 2;
+    NEXT();
+
+op_ld_vx_dt:
+    V[op->x] = chip8->delay_timer;
+    NEXT_PC();
+
+op_ld_vx_k: {
+    bool key_pressed = false;
+    for(uint32_t i = 0; i < NUM_KEYS; i++) {
+        if(chip8->keypad[i]) {
+            V[op->x] = i;
+            key_pressed = true;
+        }
+    }
+    // blocks by running again without moving pc
+    if(!key_pressed) {
+        NEXT();
+    }
+    NEXT_PC();
+}
+
+op_ld_dt:
+    chip8->delay_timer = V[op->x];
+    NEXT_PC();
+
+op_ld_st:
+    chip8->sound_timer = V[op->x];
+    NEXT_PC();
+
+op_add_i: {
+    uint16_t res = chip8->I + V[op->x];
+    chip8->I = res;
+    V[0xF] = res > 0xFFF;
+    NEXT_PC();
+}
+
+op_ld_f:
+    chip8->I = V[op->x] * 0x05;
+    NEXT_PC();
+
+op_ld_b:
+    if(chip8->I > CODE_MEM_SIZE - 3) {
+        goto op_interpret;
+    }
+    c8_store(chip8, CODE_MEM_SIZE, chip8->I, V[op->x] / 100);
+    c8_store(chip8, CODE_MEM_SIZE, chip8->I + 1, (V[op->x] / 10) % 10);
+    c8_store(chip8, CODE_MEM_SIZE, chip8->I + 2, V[op->x] % 10);
+    c8_cache_invalidate(cache, chip8->I, 3);
+    NEXT_PC();
+
+op_ld_mem_vx:
+    if(chip8->I + op->x >= CODE_MEM_SIZE) {
+        goto op_interpret;
+    }
+    for(uint8_t i = 0; i <= op->x; i++) {
+        c8_store(chip8, CODE_MEM_SIZE, chip8->I + i, V[i]);
+    }
+    c8_cache_invalidate(cache, chip8->I, op->x + 1);
+    NEXT_PC();
+
+op_ld_vx_mem:
+    if(chip8->I + op->x >= CODE_MEM_SIZE) {
+        goto op_interpret;
+    }
+    memcpy(V, &chip8->ram[chip8->I], op->x + 1);
+    NEXT_PC();
+
+// instructions the machine's quirks change, the handlers above being the
+// default profile's, and the ones about to fault
+op_interpret: {
+    C8Span stores[2];
+    chip8->pc = pc;
+    int count = c8_code_stores(chip8, stores);
+    c8_exec_instruction(chip8, false);
+    pc = chip8->pc;
+    for(int i = 0; i < count; i++) {
+        c8_cache_invalidate(cache, stores[i].addr, stores[i].len);
+    }
+    NEXT();
+}
+
+out:
+    chip8->pc = pc;
+    return ran;
+
+#undef NEXT_PC
+#undef NEXT
+#undef DISPATCH
+}
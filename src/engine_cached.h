@@ -0,0 +1,31 @@
+#ifndef ENGINE_CACHED_H
+#define ENGINE_CACHED_H
+
+#include "chip8.h"
+
+// An instruction decoded once: the address of the handler it dispatches to
+// and its operands, already pulled out of the opcode
+typedef struct C8DecodedOp {
+    const void *handler;
+    uint16_t nnn;
+    uint8_t x;
+    uint8_t y;
+    uint8_t nn;
+    uint8_t n;
+} C8DecodedOp;
+
+// One entry per code address since jumps are free to land on odd addresses
+typedef struct C8DecodeCache {
+    C8DecodedOp ops[CODE_MEM_SIZE];
+    const void *decode_handler;
+} C8DecodeCache;
+
+C8DecodeCache *c8_cache_create(void);
+
+// Runs at most n instructions and returns how many ran. Stops early only when
+// pc runs off the end of the code space.
+uint64_t c8_cache_run(C8DecodeCache *cache, Chip8 *chip8, uint64_t n);
+
+void c8_cache_invalidate(C8DecodeCache *cache, uint16_t addr, uint16_t len);
+
+#endif
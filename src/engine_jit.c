@@ -0,0 +1,697 @@
+#include "engine_jit.h"
+
+#if defined(__x86_64__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Register assignment inside translated code:
+//   rbx  Chip8 *                 r14  entry table
+//   r12d I                       r15  C8Jit *
+//   r13  instructions left       eax  pc on every block exit
+// V[] and the rest of the machine are addressed as memory operands off rbx.
+
+#define CODE_SIZE (1 << 20)
+#define MAX_BLOCK_INSTRUCTIONS 64
+// worst case bytes for one block, checked before translating it
+#define MAX_BLOCK_BYTES (MAX_BLOCK_INSTRUCTIONS * 128)
+
+#define OFF_V(x) ((int32_t)(offsetof(Chip8, V) + (x)))
+#define OFF_I ((int32_t)offsetof(Chip8, I))
+#define OFF_PC ((int32_t)offsetof(Chip8, pc))
+#define OFF_SP ((int32_t)offsetof(Chip8, sp))
+#define OFF_STACK ((int32_t)offsetof(Chip8, stack))
+#define OFF_KEYPAD ((int32_t)offsetof(Chip8, keypad))
+#define OFF_DELAY_TIMER ((int32_t)offsetof(Chip8, delay_timer))
+#define OFF_SOUND_TIMER ((int32_t)offsetof(Chip8, sound_timer))
+
+typedef uint64_t (*JitEnter)(Chip8 *chip8, void **entry, uint64_t budget, C8Jit *jit,
+                             void *code);
+
+struct C8Jit {
+    void *entry[CODE_MEM_SIZE];         // translated block per address, or exit_stub
+    uint16_t block_last[CODE_MEM_SIZE]; // last ram byte a block was translated from
+
+    uint8_t *code;
+    size_t code_used;
+    size_t prelude_size;
+    size_t page_size;
+
+    JitEnter enter;
+    uint8_t *exit_stub;
+};
+
+typedef struct Emitter {
+    uint8_t *buf;
+    size_t len;
+} Emitter;
+
+static void emit8(Emitter *e, uint8_t b) {
+    e->buf[e->len++] = b;
+}
+
+static void emit16(Emitter *e, uint16_t v) {
+    memcpy(e->buf + e->len, &v, 2);
+    e->len += 2;
+}
+
+static void emit32(Emitter *e, uint32_t v) {
+    memcpy(e->buf + e->len, &v, 4);
+    e->len += 4;
+}
+
+static void emit64(Emitter *e, uint64_t v) {
+    memcpy(e->buf + e->len, &v, 8);
+    e->len += 8;
+}
+
+static void emit_bytes(Emitter *e, const uint8_t *bytes, size_t n) {
+    memcpy(e->buf + e->len, bytes, n);
+    e->len += n;
+}
+
+// opcode bytes followed by a [rbx + disp32] operand whose ModRM is modrm
+static void emit_rbx(Emitter *e, const uint8_t *op, size_t n, uint8_t modrm, int32_t disp) {
+    emit_bytes(e, op, n);
+    emit8(e, modrm);
+    emit32(e, disp);
+}
+
+#define EMIT_RBX(e, modrm, disp, ...)                                                     \
+    emit_rbx(e, (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}),  \
+             modrm, disp)
+
+// rel32 jumps: returns where the displacement lives so it can be patched
+static size_t emit_jmp32(Emitter *e) {
+    emit8(e, 0xE9);
+    emit32(e, 0);
+    return e->len - 4;
+}
+
+static size_t emit_jcc32(Emitter *e, uint8_t cc) {
+    emit8(e, 0x0F);
+    emit8(e, cc);
+    emit32(e, 0);
+    return e->len - 4;
+}
+
+static void patch_rel32(Emitter *e, size_t at, const uint8_t *target) {
+    int32_t rel = (int32_t)(target - (e->buf + at + 4));
+    memcpy(e->buf + at, &rel, 4);
+}
+
+#define JCC_B 0x82
+#define JCC_E 0x84
+#define JCC_NE 0x85
+#define JCC_A 0x87
+
+static void emit_mov_eax_imm(Emitter *e, uint32_t v) {
+    emit8(e, 0xB8);
+    emit32(e, v);
+}
+
+// leave the block for a pc known at translation time
+static void emit_exit_static(C8Jit *jit, Emitter *e, uint32_t target) {
+    emit_mov_eax_imm(e, target);
+    if(target > CODE_MEM_SIZE - 2) {
+        patch_rel32(e, emit_jmp32(e), jit->exit_stub);
+        return;
+    }
+    // jmp [r14 + target * 8]
+    emit_bytes(e, (const uint8_t[]){0x41, 0xFF, 0xA6}, 3);
+    emit32(e, target * 8);
+}
+
+// leave the block for the pc in eax
+static void emit_exit_dynamic(C8Jit *jit, Emitter *e) {
+    // cmp eax, CODE_MEM_SIZE - 2; ja exit_stub
+    emit8(e, 0x3D);
+    emit32(e, CODE_MEM_SIZE - 2);
+    patch_rel32(e, emit_jcc32(e, JCC_A), jit->exit_stub);
+    // jmp [r14 + rax * 8]
+    emit_bytes(e, (const uint8_t[]){0x41, 0xFF, 0x24, 0xC6}, 4);
+}
+
+static int jit_interpret(Chip8 *chip8, C8Jit *jit);
+
+// Runs the instruction at pc through c8_exec_instruction. Returns with eax
+// set by the helper: non-zero when it threw away translated code.
+static void emit_interpret(Emitter *e, uint16_t pc) {
+    // mov word [rbx + pc], pc
+    EMIT_RBX(e, 0x83, OFF_PC, 0x66, 0xC7);
+    emit16(e, pc);
+    // mov [rbx + I], r12w
+    EMIT_RBX(e, 0xA3, OFF_I, 0x66, 0x44, 0x89);
+    // mov rdi, rbx; mov rsi, r15
+    emit_bytes(e, (const uint8_t[]){0x48, 0x89, 0xDF, 0x4C, 0x89, 0xFE}, 6);
+    // mov rax, jit_interpret; call rax
+    emit_bytes(e, (const uint8_t[]){0x48, 0xB8}, 2);
+    emit64(e, (uint64_t)(uintptr_t)jit_interpret);
+    emit_bytes(e, (const uint8_t[]){0xFF, 0xD0}, 2);
+    // movzx r12d, word [rbx + I]
+    EMIT_RBX(e, 0xA3, OFF_I, 0x44, 0x0F, 0xB7);
+}
+
+// emit_interpret for an instruction that ends the block, leaving for
+// wherever it put pc
+static void emit_interpret_exit(C8Jit *jit, Emitter *e, uint16_t pc) {
+    emit_interpret(e, pc);
+    // movzx eax, word [rbx + pc]
+    EMIT_RBX(e, 0x83, OFF_PC, 0x0F, 0xB7);
+    emit_exit_dynamic(jit, e);
+}
+
+// emit_interpret for an instruction that carries on to the next one, unless
+// it stored into the block it's part of
+static void emit_interpret_next(C8Jit *jit, Emitter *e, uint16_t pc) {
+    emit_interpret(e, pc);
+    // test eax, eax; jz next; leave if this very block may be stale
+    emit_bytes(e, (const uint8_t[]){0x85, 0xC0}, 2);
+    size_t keep_going = emit_jcc32(e, JCC_E);
+    emit_mov_eax_imm(e, pc + 2);
+    patch_rel32(e, emit_jmp32(e), jit->exit_stub);
+    patch_rel32(e, keep_going, e->buf + e->len);
+}
+
+// skip instructions end the block with one exit per outcome; the flags for
+// the comparison are already set and taken_cc jumps when the skip happens
+static void emit_skip(C8Jit *jit, Emitter *e, uint8_t taken_cc, uint16_t pc) {
+    size_t taken = emit_jcc32(e, taken_cc);
+    emit_exit_static(jit, e, pc + 2);
+    patch_rel32(e, taken, e->buf + e->len);
+    emit_exit_static(jit, e, pc + 4);
+}
+
+// Whether pc can end up anywhere but the next instruction
+static bool may_branch(uint16_t opcode) {
+    switch(opcode & 0xF000) {
+        case 0x0000:
+            return opcode == 0x00EE || opcode == 0x00FD;
+        case 0x5000:
+            return op_N(opcode) != 2 && op_N(opcode) != 3;
+        case 0x6000:
+        case 0x7000:
+        case 0x8000:
+        case 0xA000:
+        case 0xC000:
+        case 0xD000:
+            return false;
+        case 0xF000:
+            return opcode == 0xF000 || op_NN(opcode) == 0x0A;
+        default:
+            return true;
+    }
+}
+
+// Translates one instruction. Returns true when it ended the block.
+static bool emit_instruction(C8Jit *jit, Emitter *e, const C8Quirks *quirks, uint16_t opcode,
+                             uint16_t pc) {
+    uint8_t x = op_X(opcode);
+    uint8_t y = op_Y(opcode);
+    uint8_t nn = op_NN(opcode);
+    uint16_t nnn = op_NNN(opcode);
+
+    // the reference interpreter has the machine's quirks built in
+    if(c8_quirks_affect(quirks, opcode)) {
+        if(may_branch(opcode)) {
+            emit_interpret_exit(jit, e, pc);
+            return true;
+        }
+        emit_interpret_next(jit, e, pc);
+        return false;
+    }
+
+    switch(opcode & 0xF000) {
+        case 0x0000:
+            switch(opcode & 0x00FF) {
+                case 0x00E0:
+                    emit_interpret(e, pc);
+                    return false;
+
+                case 0x00EE: {
+                    // movzx eax, byte [rbx + sp]; sub eax, 1
+                    EMIT_RBX(e, 0x83, OFF_SP, 0x0F, 0xB6);
+                    emit_bytes(e, (const uint8_t[]){0x83, 0xE8, 0x01}, 3);
+                    // cmp eax, STACK_SIZE - 1; ja fault
+                    emit_bytes(e, (const uint8_t[]){0x83, 0xF8, STACK_SIZE - 1}, 3);
+                    size_t fault = emit_jcc32(e, JCC_A);
+                    // mov [rbx + sp], al
+                    EMIT_RBX(e, 0x83, OFF_SP, 0x88);
+                    // movzx eax, word [rbx + rax * 2 + stack]
+                    emit_bytes(e, (const uint8_t[]){0x0F, 0xB7, 0x84, 0x43}, 4);
+                    emit32(e, OFF_STACK);
+                    // add eax, 2; and eax, 0xFFFF
+                    emit8(e, 0x05);
+                    emit32(e, 2);
+                    emit8(e, 0x25);
+                    emit32(e, 0xFFFF);
+                    emit_exit_dynamic(jit, e);
+                    // an empty stack is for the reference to report
+                    patch_rel32(e, fault, e->buf + e->len);
+                    emit_interpret_exit(jit, e, pc);
+                    return true;
+                }
+
+                default:
+                    return false;
+            }
+
+        case 0x1000:
+            emit_exit_static(jit, e, nnn);
+            return true;
+
+        case 0x2000: {
+            // cmp byte [rbx + sp], STACK_SIZE - 1; ja fault
+            EMIT_RBX(e, 0xBB, OFF_SP, 0x80);
+            emit8(e, STACK_SIZE - 1);
+            size_t fault = emit_jcc32(e, JCC_A);
+            // movzx eax, byte [rbx + sp]
+            EMIT_RBX(e, 0x83, OFF_SP, 0x0F, 0xB6);
+            // mov word [rbx + rax * 2 + stack], pc
+            emit_bytes(e, (const uint8_t[]){0x66, 0xC7, 0x84, 0x43}, 4);
+            emit32(e, OFF_STACK);
+            emit16(e, pc);
+            // inc byte [rbx + sp]
+            EMIT_RBX(e, 0x83, OFF_SP, 0xFE);
+            emit_exit_static(jit, e, nnn);
+            // so is a full one
+            patch_rel32(e, fault, e->buf + e->len);
+            emit_interpret_exit(jit, e, pc);
+            return true;
+        }
+
+        case 0x3000:
+        case 0x4000:
+            // cmp byte [rbx + V[x]], nn
+            EMIT_RBX(e, 0xBB, OFF_V(x), 0x80);
+            emit8(e, nn);
+            emit_skip(jit, e, (opcode & 0xF000) == 0x3000 ? JCC_E : JCC_NE, pc);
+            return true;
+
+        case 0x5000:
+        case 0x9000:
+            // mov al, [rbx + V[x]]; cmp al, [rbx + V[y]]
+            EMIT_RBX(e, 0x83, OFF_V(x), 0x8A);
+            EMIT_RBX(e, 0x83, OFF_V(y), 0x3A);
+            emit_skip(jit, e, (opcode & 0xF000) == 0x5000 ? JCC_E : JCC_NE, pc);
+            return true;
+
+        case 0x6000:
+            // mov byte [rbx + V[x]], nn
+            EMIT_RBX(e, 0x83, OFF_V(x), 0xC6);
+            emit8(e, nn);
+            return false;
+
+        case 0x7000:
+            // add byte [rbx + V[x]], nn
+            EMIT_RBX(e, 0x83, OFF_V(x), 0x80);
+            emit8(e, nn);
+            return false;
+
+        case 0x8000:
+            switch(opcode & 0x000F) {
+                case 0x0000:
+                case 0x0001:
+                case 0x0002:
+                case 0x0003: {
+                    static const uint8_t alu[] = {0x88, 0x08, 0x20, 0x30};
+                    // mov al, [rbx + V[y]]; mov/or/and/xor [rbx + V[x]], al
+                    EMIT_RBX(e, 0x83, OFF_V(y), 0x8A);
+                    EMIT_RBX(e, 0x83, OFF_V(x), alu[opcode & 0x000F]);
+                    return false;
+                }
+
+                // the flag goes in last so it wins when X is F
+                case 0x0004:
+                    // mov al, [V[x]]; add al, [V[y]]; setc cl
+                    EMIT_RBX(e, 0x83, OFF_V(x), 0x8A);
+                    EMIT_RBX(e, 0x83, OFF_V(y), 0x02);
+                    emit_bytes(e, (const uint8_t[]){0x0F, 0x92, 0xC1}, 3);
+                    // mov [V[x]], al; mov [V[F]], cl
+                    EMIT_RBX(e, 0x83, OFF_V(x), 0x88);
+                    EMIT_RBX(e, 0x8B, OFF_V(0xF), 0x88);
+                    return false;
+
+                case 0x0005:
+                case 0x0007: {
+                    uint8_t from = op_N(opcode) == 0x5 ? x : y;
+                    uint8_t by = op_N(opcode) == 0x5 ? y : x;
+                    // mov al, [V[from]]; sub al, [V[by]]; setnc cl
+                    EMIT_RBX(e, 0x83, OFF_V(from), 0x8A);
+                    EMIT_RBX(e, 0x83, OFF_V(by), 0x2A);
+                    emit_bytes(e, (const uint8_t[]){0x0F, 0x93, 0xC1}, 3);
+                    // mov [V[x]], al; mov [V[F]], cl
+                    EMIT_RBX(e, 0x83, OFF_V(x), 0x88);
+                    EMIT_RBX(e, 0x8B, OFF_V(0xF), 0x88);
+                    return false;
+                }
+
+                case 0x0006:
+                    // mov al, [V[x]]; mov ecx, eax; and cl, 1; shr al, 1
+                    EMIT_RBX(e, 0x83, OFF_V(x), 0x8A);
+                    emit_bytes(e, (const uint8_t[]){0x89, 0xC1, 0x80, 0xE1, 0x01, 0xD0, 0xE8},
+                               7);
+                    // mov [V[x]], al; mov [V[F]], cl
+                    EMIT_RBX(e, 0x83, OFF_V(x), 0x88);
+                    EMIT_RBX(e, 0x8B, OFF_V(0xF), 0x88);
+                    return false;
+
+                case 0x000E:
+                    // mov al, [V[x]]; mov ecx, eax; shr cl, 7; add al, al
+                    EMIT_RBX(e, 0x83, OFF_V(x), 0x8A);
+                    emit_bytes(e, (const uint8_t[]){0x89, 0xC1, 0xC0, 0xE9, 0x07, 0x00, 0xC0},
+                               7);
+                    // mov [V[x]], al; mov [V[F]], cl
+                    EMIT_RBX(e, 0x83, OFF_V(x), 0x88);
+                    EMIT_RBX(e, 0x8B, OFF_V(0xF), 0x88);
+                    return false;
+
+                default:
+                    return false;
+            }
+
+        case 0xA000:
+            // mov r12d, nnn
+            emit_bytes(e, (const uint8_t[]){0x41, 0xBC}, 2);
+            emit32(e, nnn);
+            return false;
+
+        case 0xB000:
+            // movzx eax, byte [V[0]]; add eax, nnn
+            EMIT_RBX(e, 0x83, OFF_V(0), 0x0F, 0xB6);
+            emit8(e, 0x05);
+            emit32(e, nnn);
+            emit_exit_dynamic(jit, e);
+            return true;
+
+        case 0xC000:
+        case 0xD000:
+            emit_interpret(e, pc);
+            return false;
+
+        case 0xE000:
+            switch(opcode & 0x00FF) {
+                case 0x009E:
+                case 0x00A1: {
+                    // cmp byte [V[x]], NUM_KEYS - 1; ja fault
+                    EMIT_RBX(e, 0xBB, OFF_V(x), 0x80);
+                    emit8(e, NUM_KEYS - 1);
+                    size_t fault = emit_jcc32(e, JCC_A);
+                    // movzx eax, byte [V[x]]; cmp byte [rbx + rax + keypad], 0
+                    EMIT_RBX(e, 0x83, OFF_V(x), 0x0F, 0xB6);
+                    emit_bytes(e, (const uint8_t[]){0x80, 0xBC, 0x03}, 3);
+                    emit32(e, OFF_KEYPAD);
+                    emit8(e, 0x00);
+                    emit_skip(jit, e, (opcode & 0x00FF) == 0x009E ? JCC_NE : JCC_E, pc);
+                    patch_rel32(e, fault, e->buf + e->len);
+                    emit_interpret_exit(jit, e, pc);
+                    return true;
+                }
+
+                default:
+                    return false;
+            }
+
+        default: // 0xF000
+            switch(opcode & 0x00FF) {
+                case 0x0007:
+                    // mov al, [delay_timer]; mov [V[x]], al
+                    EMIT_RBX(e, 0x83, OFF_DELAY_TIMER, 0x8A);
+                    EMIT_RBX(e, 0x83, OFF_V(x), 0x88);
+                    return false;
+
+                case 0x000A:
+                    // blocks by leaving pc where it is
+                    emit_interpret_exit(jit, e, pc);
+                    return true;
+
+                case 0x0015:
+                case 0x0018:
+                    // mov al, [V[x]]; mov [delay_timer / sound_timer], al
+                    EMIT_RBX(e, 0x83, OFF_V(x), 0x8A);
+                    EMIT_RBX(e, 0x83,
+                             (opcode & 0x00FF) == 0x0015 ? OFF_DELAY_TIMER : OFF_SOUND_TIMER,
+                             0x88);
+                    return false;
+
+                case 0x001E:
+                    // movzx eax, byte [V[x]]; add r12d, eax; and r12d, 0xFFFF
+                    EMIT_RBX(e, 0x83, OFF_V(x), 0x0F, 0xB6);
+                    emit_bytes(e, (const uint8_t[]){0x41, 0x01, 0xC4, 0x41, 0x81, 0xE4}, 6);
+                    emit32(e, 0xFFFF);
+                    // cmp r12d, 0xFFF; seta al; mov [V[F]], al
+                    emit_bytes(e, (const uint8_t[]){0x41, 0x81, 0xFC}, 3);
+                    emit32(e, 0xFFF);
+                    emit_bytes(e, (const uint8_t[]){0x0F, 0x97, 0xC0}, 3);
+                    EMIT_RBX(e, 0x83, OFF_V(0xF), 0x88);
+                    return false;
+
+                case 0x0029:
+                    // movzx r12d, byte [V[x]]; lea r12d, [r12 + r12 * 4]
+                    EMIT_RBX(e, 0xA3, OFF_V(x), 0x44, 0x0F, 0xB6);
+                    emit_bytes(e, (const uint8_t[]){0x47, 0x8D, 0x24, 0xA4}, 4);
+                    return false;
+
+                case 0x0033:
+                case 0x0055:
+                    emit_interpret_next(jit, e, pc);
+                    return false;
+
+                case 0x0065:
+                    emit_interpret(e, pc);
+                    return false;
+
+                default:
+                    return false;
+            }
+    }
+}
+
+// The code buffer is never writable and executable at once: the pages a block
+// goes into are made writable just for emitting it, then executable again.
+// Blocks only reach each other through entry[], so invalidating them never
+// writes to code.
+static void protect_code(C8Jit *jit, size_t from, size_t len, int prot) {
+    size_t start = from / jit->page_size * jit->page_size;
+    size_t end = (from + len + jit->page_size - 1) / jit->page_size * jit->page_size;
+
+    if(end > CODE_SIZE) {
+        end = CODE_SIZE;
+    }
+    if(mprotect(jit->code + start, end - start, prot) != 0) {
+        fprintf(stderr, "Couldn't change the protection of JIT code\n");
+        exit(1);
+    }
+}
+
+// Returns the entry point for the block at start
+static void *jit_translate(C8Jit *jit, Chip8 *chip8, uint16_t start) {
+    if(CODE_SIZE - jit->code_used < MAX_BLOCK_BYTES) {
+        // out of room: drop every block and start over
+        for(size_t i = 0; i < CODE_MEM_SIZE; i++) {
+            jit->entry[i] = jit->exit_stub;
+        }
+        jit->code_used = jit->prelude_size;
+    }
+
+    size_t from = jit->code_used;
+    protect_code(jit, from, MAX_BLOCK_BYTES, PROT_READ | PROT_WRITE);
+    Emitter e = {jit->code + jit->code_used, 0};
+    size_t budget_exits[MAX_BLOCK_INSTRUCTIONS];
+    uint16_t budget_pcs[MAX_BLOCK_INSTRUCTIONS];
+    uint32_t count = 0;
+    uint16_t pc = start;
+
+    for(;;) {
+        if(pc > CODE_MEM_SIZE - 2 || count == MAX_BLOCK_INSTRUCTIONS) {
+            emit_exit_static(jit, &e, pc);
+            break;
+        }
+
+        uint16_t opcode = (chip8->ram[pc] << 8) | chip8->ram[pc + 1];
+
+        // sub r13, 1; jb out_of_budget
+        emit_bytes(&e, (const uint8_t[]){0x49, 0x83, 0xED, 0x01}, 4);
+        budget_exits[count] = emit_jcc32(&e, JCC_B);
+        budget_pcs[count] = pc;
+        count++;
+
+        if(emit_instruction(jit, &e, c8_quirks(chip8->quirks), opcode, pc)) {
+            break;
+        }
+        pc += 2;
+    }
+
+    // out of budget: undo the decrement and leave with pc at that instruction
+    for(uint32_t i = 0; i < count; i++) {
+        patch_rel32(&e, budget_exits[i], e.buf + e.len);
+        // add r13, 1
+        emit_bytes(&e, (const uint8_t[]){0x49, 0x83, 0xC5, 0x01}, 4);
+        emit_mov_eax_imm(&e, budget_pcs[i]);
+        patch_rel32(&e, emit_jmp32(&e), jit->exit_stub);
+    }
+
+    jit->code_used += e.len;
+    protect_code(jit, from, MAX_BLOCK_BYTES, PROT_READ | PROT_EXEC);
+    jit->entry[start] = e.buf;
+    jit->block_last[start] = budget_pcs[count - 1] + 1;
+
+    return e.buf;
+}
+
+static bool jit_invalidate_range(C8Jit *jit, uint32_t addr, uint32_t len) {
+    uint32_t last = addr + len - 1;
+    uint32_t from = addr > MAX_BLOCK_INSTRUCTIONS * 2 ? addr - MAX_BLOCK_INSTRUCTIONS * 2 : 0;
+    bool hit = false;
+
+    if(last >= CODE_MEM_SIZE) {
+        last = CODE_MEM_SIZE - 1;
+    }
+
+    for(uint32_t start = from; start <= last; start++) {
+        if(jit->entry[start] != jit->exit_stub && jit->block_last[start] >= addr) {
+            jit->entry[start] = jit->exit_stub;
+            hit = true;
+        }
+    }
+
+    return hit;
+}
+
+void c8_jit_invalidate(C8Jit *jit, uint16_t addr, uint16_t len) {
+    if(addr == 0 && len >= CODE_MEM_SIZE) {
+        // nothing survives, so the arena can be reused from the start
+        for(size_t i = 0; i < CODE_MEM_SIZE; i++) {
+            jit->entry[i] = jit->exit_stub;
+        }
+        jit->code_used = jit->prelude_size;
+    } else if(len > 0 && addr < CODE_MEM_SIZE) {
+        jit_invalidate_range(jit, addr, len);
+    }
+}
+
+static int jit_interpret(Chip8 *chip8, C8Jit *jit) {
+    C8Span stores[2];
+    int count = c8_code_stores(chip8, stores);
+    bool hit = false;
+
+    c8_exec_instruction(chip8, false);
+
+    for(int i = 0; i < count; i++) {
+        hit |= jit_invalidate_range(jit, stores[i].addr, stores[i].len);
+    }
+    return hit;
+}
+
+static void emit_prelude(C8Jit *jit) {
+    Emitter e = {jit->code, 0};
+
+    // exit: store pc and I, return the instructions left
+    jit->exit_stub = e.buf + e.len;
+    EMIT_RBX(&e, 0x83, OFF_PC, 0x66, 0x89);
+    EMIT_RBX(&e, 0xA3, OFF_I, 0x66, 0x44, 0x89);
+    emit_bytes(&e,
+               (const uint8_t[]){
+                   0x4C, 0x89, 0xE8,       // mov rax, r13
+                   0x48, 0x83, 0xC4, 0x08, // add rsp, 8
+                   0x41, 0x5F,             // pop r15
+                   0x41, 0x5E,             // pop r14
+                   0x41, 0x5D,             // pop r13
+                   0x41, 0x5C,             // pop r12
+                   0x5B,                   // pop rbx
+                   0x5D,                   // pop rbp
+                   0xC3,                   // ret
+               },
+               18);
+
+    // enter(chip8, entry, budget, jit, code)
+    jit->enter = (JitEnter)(void *)(e.buf + e.len);
+    emit_bytes(&e,
+               (const uint8_t[]){
+                   0x55,                   // push rbp
+                   0x53,                   // push rbx
+                   0x41, 0x54,             // push r12
+                   0x41, 0x55,             // push r13
+                   0x41, 0x56,             // push r14
+                   0x41, 0x57,             // push r15
+                   0x48, 0x83, 0xEC, 0x08, // sub rsp, 8
+                   0x48, 0x89, 0xFB,       // mov rbx, rdi
+                   0x49, 0x89, 0xF6,       // mov r14, rsi
+                   0x49, 0x89, 0xD5,       // mov r13, rdx
+                   0x49, 0x89, 0xCF,       // mov r15, rcx
+               },
+               26);
+    EMIT_RBX(&e, 0xA3, OFF_I, 0x44, 0x0F, 0xB7);
+    emit_bytes(&e, (const uint8_t[]){0x41, 0xFF, 0xE0}, 3); // jmp r8
+
+    jit->prelude_size = e.len;
+    jit->code_used = e.len;
+}
+
+C8Jit *c8_jit_create(void) {
+    C8Jit *jit = c8_calloc(1, sizeof *jit);
+
+    jit->code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                     0);
+    if(jit->code == MAP_FAILED) {
+        fprintf(stderr, "Couldn't map memory for JIT code\n");
+        exit(1);
+    }
+    jit->page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    emit_prelude(jit);
+    protect_code(jit, 0, CODE_SIZE, PROT_READ | PROT_EXEC);
+    for(size_t i = 0; i < CODE_MEM_SIZE; i++) {
+        jit->entry[i] = jit->exit_stub;
+    }
+
+    return jit;
+}
+
+void c8_jit_destroy(C8Jit *jit) {
+    if(!jit) {
+        return;
+    }
+    munmap(jit->code, CODE_SIZE);
+    free(jit);
+}
+
+uint64_t c8_jit_run(C8Jit *jit, Chip8 *chip8, uint64_t n) {
+    uint64_t left = n;
+
+    while(left > 0 && chip8->pc <= CODE_MEM_SIZE - 2) {
+        void *code = jit->entry[chip8->pc];
+        if(code == jit->exit_stub) {
+            code = jit_translate(jit, chip8, chip8->pc);
+        }
+        left = jit->enter(chip8, jit->entry, left, jit, code);
+    }
+
+    return n - left;
+}
+
+#else
+
+C8Jit *c8_jit_create(void) {
+    return NULL;
+}
+
+void c8_jit_destroy(C8Jit *jit) {
+    (void)jit;
+}
+
+uint64_t c8_jit_run(C8Jit *jit, Chip8 *chip8, uint64_t n) {
+    (void)jit;
+    (void)chip8;
+    (void)n;
+    return 0;
+}
+
+void c8_jit_invalidate(C8Jit *jit, uint16_t addr, uint16_t len) {
+    (void)jit;
+    (void)addr;
+    (void)len;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef ENGINE_JIT_H
+#define ENGINE_JIT_H
+
+#include "chip8.h"
+
+// Basic-block recompiler to x86-64. Blocks end at jumps, calls, returns and
+// skips, and hand off to their successor through a per-address entry table
+// without going back to C. Returns NULL when the host isn't x86-64.
+typedef struct C8Jit C8Jit;
+
+C8Jit *c8_jit_create(void);
+void c8_jit_destroy(C8Jit *jit);
+
+// Runs at most n instructions and returns how many ran. Like the cached engine
+// it stops early only when pc runs off the end of the code space.
+uint64_t c8_jit_run(C8Jit *jit, Chip8 *chip8, uint64_t n);
+
+void c8_jit_invalidate(C8Jit *jit, uint16_t addr, uint16_t len);
+
+#endif
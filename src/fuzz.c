@@ -0,0 +1,283 @@
+#include "fuzz.h"
+#include "replay.h"
+
+// pc to pc edges are hashed into this many bits, the way AFL does it
+#define EDGE_MAP_BITS (1 << 16)
+#define MAX_MUTATIONS 4
+// longest span of frames one mutation holds or releases a key for
+#define MAX_SPAN FRAMES_PER_SECOND
+// loaded, the one runs go on and the one a finding is saved from
+#define MACHINES 3
+
+typedef struct FuzzInput {
+    uint64_t seed;
+    uint16_t *keys;
+} FuzzInput;
+
+struct C8Fuzzer {
+    C8Pool *machines;
+    Chip8 *loaded;
+    Chip8 *chip8;
+    uint32_t frames;
+    uint32_t ipf;
+    uint64_t rng;
+
+    FuzzInput *corpus;
+    size_t corpus_cap;
+    FuzzInput next; // the input being mutated and run
+
+    uint64_t pcs[MEM_SIZE / 64];
+    uint64_t edges[EDGE_MAP_BITS / 64];
+
+    C8FuzzFinding *findings;
+    size_t findings_cap;
+    C8FuzzStats stats;
+};
+
+// xorshift64*, kept apart from the machine's own generator
+static uint32_t fuzz_random(C8Fuzzer *fuzz) {
+    uint64_t x = fuzz->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    fuzz->rng = x;
+    return (x * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+// Returns 1 if the bit wasn't set yet
+static inline uint32_t mark(uint64_t *map, uint32_t bit) {
+    uint64_t mask = 1ULL << (bit % 64);
+    if(map[bit / 64] & mask) {
+        return 0;
+    }
+    map[bit / 64] |= mask;
+    return 1;
+}
+
+// What a run ran into first
+typedef struct Fault {
+    uint32_t frame; // counting from 1, 0 when nothing went wrong
+    uint8_t faults;
+    uint16_t pc;
+} Fault;
+
+// Runs fuzz->next from the loaded machine through the reference interpreter,
+// one instruction at a time for the coverage. Returns how much of it was new.
+static uint32_t execute(C8Fuzzer *fuzz, Fault *fault) {
+    Chip8 *chip8 = fuzz->chip8;
+    const uint16_t *keys = fuzz->next.keys;
+    uint16_t held = 0;
+    uint32_t new_pcs = 0;
+    uint32_t new_edges = 0;
+
+    c8_reset_dirty(chip8, fuzz->loaded);
+    c8_seed(chip8, fuzz->next.seed);
+    fault->frame = 0;
+
+    for(uint32_t frame = 0; frame < fuzz->frames; frame++) {
+        if(keys[frame] != held) {
+            held = keys[frame];
+            for(uint8_t key = 0; key < NUM_KEYS; key++) {
+                chip8->keypad[key] = held >> key & 1;
+            }
+        }
+
+        for(uint32_t i = 0; i < fuzz->ipf; i++) {
+            uint16_t from = chip8->pc & (MEM_SIZE - 1);
+            c8_exec_instruction(chip8, false);
+            uint16_t to = chip8->pc & (MEM_SIZE - 1);
+            new_pcs += mark(fuzz->pcs, from);
+            new_edges += mark(fuzz->edges, (from << 4 ^ to >> 1) % EDGE_MAP_BITS);
+        }
+        c8_tick_timers(chip8);
+
+        if(chip8->faults && !fault->frame) {
+            *fault = (Fault){frame + 1, chip8->faults, chip8->fault_pc};
+        }
+    }
+
+    fuzz->stats.execs++;
+    fuzz->stats.instructions += (uint64_t)fuzz->frames * fuzz->ipf;
+    fuzz->stats.pcs += new_pcs;
+    fuzz->stats.edges += new_edges;
+    return new_pcs + new_edges;
+}
+
+static void keep_input(C8Fuzzer *fuzz) {
+    if(fuzz->stats.corpus == fuzz->corpus_cap) {
+        fuzz->corpus_cap = fuzz->corpus_cap ? fuzz->corpus_cap * 2 : 64;
+        fuzz->corpus = c8_realloc(fuzz->corpus, fuzz->corpus_cap * sizeof *fuzz->corpus);
+    }
+
+    FuzzInput *input = &fuzz->corpus[fuzz->stats.corpus++];
+    input->seed = fuzz->next.seed;
+    input->keys = c8_malloc(fuzz->frames * sizeof *input->keys);
+    memcpy(input->keys, fuzz->next.keys, fuzz->frames * sizeof *input->keys);
+}
+
+// One finding per combination of faults and the pc that caused the first
+static void keep_finding(C8Fuzzer *fuzz, const Fault *fault) {
+    for(size_t i = 0; i < fuzz->stats.findings; i++) {
+        if(fuzz->findings[i].faults == fault->faults && fuzz->findings[i].fault_pc == fault->pc) {
+            return;
+        }
+    }
+
+    if(fuzz->stats.findings == fuzz->findings_cap) {
+        fuzz->findings_cap = fuzz->findings_cap ? fuzz->findings_cap * 2 : 16;
+        fuzz->findings =
+            c8_realloc(fuzz->findings, fuzz->findings_cap * sizeof *fuzz->findings);
+    }
+
+    uint16_t *keys = c8_malloc(fault->frame * sizeof *keys);
+    memcpy(keys, fuzz->next.keys, fault->frame * sizeof *keys);
+    fuzz->findings[fuzz->stats.findings++] = (C8FuzzFinding){
+        .faults = fault->faults,
+        .fault_pc = fault->pc,
+        .frames = fault->frame,
+        .seed = fuzz->next.seed,
+        .keys = keys,
+    };
+}
+
+// Builds the next input out of a random one from the corpus
+static void mutate(C8Fuzzer *fuzz) {
+    const FuzzInput *base = &fuzz->corpus[fuzz_random(fuzz) % fuzz->stats.corpus];
+    uint16_t *keys = fuzz->next.keys;
+    uint32_t mutations = 1 + fuzz_random(fuzz) % MAX_MUTATIONS;
+
+    memcpy(keys, base->keys, fuzz->frames * sizeof *keys);
+    fuzz->next.seed = base->seed;
+
+    for(uint32_t m = 0; m < mutations; m++) {
+        uint32_t at = fuzz_random(fuzz) % fuzz->frames;
+        uint32_t span = 1 + fuzz_random(fuzz) % MAX_SPAN;
+        uint16_t key = 1u << (fuzz_random(fuzz) % NUM_KEYS);
+        if(span > fuzz->frames - at) {
+            span = fuzz->frames - at;
+        }
+
+        switch(fuzz_random(fuzz) % 5) {
+            // hold a key down for a while
+            case 0:
+                for(uint32_t i = at; i < at + span; i++) {
+                    keys[i] |= key;
+                }
+                break;
+
+            // let go of it for a while
+            case 1:
+                for(uint32_t i = at; i < at + span; i++) {
+                    keys[i] &= ~key;
+                }
+                break;
+
+            // a single frame tap or release
+            case 2:
+                keys[at] ^= key;
+                break;
+
+            case 3:
+                fuzz->next.seed = (uint64_t)fuzz_random(fuzz) << 32 | fuzz_random(fuzz);
+                break;
+
+            // the same frames from another input
+            case 4: {
+                const FuzzInput *other =
+                    &fuzz->corpus[fuzz_random(fuzz) % fuzz->stats.corpus];
+                memcpy(keys + at, other->keys + at, span * sizeof *keys);
+                break;
+            }
+        }
+    }
+}
+
+static void run_next(C8Fuzzer *fuzz) {
+    Fault fault;
+    if(execute(fuzz, &fault) > 0) {
+        keep_input(fuzz);
+    }
+    if(fault.frame) {
+        keep_finding(fuzz, &fault);
+    }
+}
+
+C8Fuzzer *c8_fuzz_create(const Chip8 *loaded, uint32_t frames, uint32_t ipf, uint64_t seed) {
+    C8Fuzzer *fuzz = c8_calloc(1, sizeof *fuzz);
+    fuzz->machines = c8_pool_create(sizeof(Chip8), MACHINES);
+    fuzz->loaded = c8_pool_alloc(fuzz->machines);
+    fuzz->chip8 = c8_pool_alloc(fuzz->machines);
+    // every run copies back what it dirtied against this
+    c8_reset_to(fuzz->loaded, loaded);
+    fuzz->loaded->dirty_ram = 0;
+    fuzz->loaded->faults = 0;
+    memset(fuzz->loaded->keypad, 0, sizeof fuzz->loaded->keypad);
+    c8_reset_to(fuzz->chip8, fuzz->loaded);
+
+    fuzz->frames = frames ? frames : 1;
+    fuzz->ipf = ipf;
+    fuzz->rng = seed ? seed : C8_DEFAULT_SEED;
+    fuzz->next.keys = c8_calloc(fuzz->frames, sizeof *fuzz->next.keys);
+
+    // nothing pressed, the machine's own seed
+    fuzz->next.seed = loaded->rng;
+    run_next(fuzz);
+    if(fuzz->stats.corpus == 0) {
+        keep_input(fuzz);
+    }
+
+    return fuzz;
+}
+
+void c8_fuzz_destroy(C8Fuzzer *fuzz) {
+    for(size_t i = 0; i < fuzz->stats.corpus; i++) {
+        free(fuzz->corpus[i].keys);
+    }
+    for(size_t i = 0; i < fuzz->stats.findings; i++) {
+        free((void *)fuzz->findings[i].keys);
+    }
+    free(fuzz->corpus);
+    free(fuzz->findings);
+    free(fuzz->next.keys);
+    c8_pool_destroy(fuzz->machines);
+    free(fuzz);
+}
+
+void c8_fuzz_run(C8Fuzzer *fuzz, uint64_t execs) {
+    for(uint64_t i = 0; i < execs; i++) {
+        mutate(fuzz);
+        run_next(fuzz);
+    }
+}
+
+const C8FuzzStats *c8_fuzz_stats(const C8Fuzzer *fuzz) {
+    return &fuzz->stats;
+}
+
+const C8FuzzFinding *c8_fuzz_finding(const C8Fuzzer *fuzz, size_t index) {
+    return &fuzz->findings[index];
+}
+
+void c8_fuzz_save(const C8Fuzzer *fuzz, size_t index, const char *path) {
+    const C8FuzzFinding *finding = &fuzz->findings[index];
+    Chip8 *chip8 = c8_pool_alloc(fuzz->machines);
+    uint16_t held = 0;
+
+    c8_reset_to(chip8, fuzz->loaded);
+    c8_seed(chip8, finding->seed);
+    C8Recorder *rec = c8_recorder_create(path, chip8, fuzz->ipf);
+
+    for(uint32_t frame = 0; frame < finding->frames; frame++) {
+        uint16_t changed = finding->keys[frame] ^ held;
+        for(uint8_t key = 0; key < NUM_KEYS; key++) {
+            if(changed >> key & 1) {
+                c8_recorder_key(rec, (uint64_t)frame * fuzz->ipf, key,
+                                finding->keys[frame] >> key & 1);
+            }
+        }
+        held = finding->keys[frame];
+    }
+
+    c8_recorder_close(rec, (uint64_t)finding->frames * fuzz->ipf);
+    c8_pool_free(fuzz->machines, chip8);
+}
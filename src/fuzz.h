@@ -0,0 +1,44 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include "chip8.h"
+
+// Coverage guided fuzzing of one ROM. An input is the keys held during each
+// frame plus the seed behind CXNN. Every run starts from the machine as it was
+// right after loading and only the ram pages the last run stored into get
+// copied back. Runs that reach pcs or pc to pc edges never seen before join
+// the corpus that later inputs are mutated from, runs that fault in a way not
+// seen before are findings.
+typedef struct C8Fuzzer C8Fuzzer;
+
+typedef struct C8FuzzStats {
+    uint64_t execs;
+    uint64_t instructions;
+    size_t corpus;
+    uint32_t pcs;
+    uint32_t edges;
+    size_t findings;
+} C8FuzzStats;
+
+typedef struct C8FuzzFinding {
+    uint8_t faults; // C8Fault bits at the end of the frame with the first
+    uint16_t fault_pc;
+    uint32_t frames; // up to and including the frame with the first fault
+    uint64_t seed;
+    const uint16_t *keys; // keys held in each of those frames, bit n for key n
+} C8FuzzFinding;
+
+// loaded is the machine with its ROM loaded, seed drives the mutations
+C8Fuzzer *c8_fuzz_create(const Chip8 *loaded, uint32_t frames, uint32_t ipf, uint64_t seed);
+void c8_fuzz_destroy(C8Fuzzer *fuzz);
+
+// Runs execs mutated inputs
+void c8_fuzz_run(C8Fuzzer *fuzz, uint64_t execs);
+
+const C8FuzzStats *c8_fuzz_stats(const C8Fuzzer *fuzz);
+const C8FuzzFinding *c8_fuzz_finding(const C8Fuzzer *fuzz, size_t index);
+
+// Writes a finding as an input log, so chip8-headless -p replays it
+void c8_fuzz_save(const C8Fuzzer *fuzz, size_t index, const char *path);
+
+#endif
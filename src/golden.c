@@ -0,0 +1,104 @@
+#include "golden.h"
+
+#define HEADER                                                                           \
+    "# Runs the reference interpreter ends in a known state, checked with\n"             \
+    "# chip8-headless -C and regenerated with -G.\n"                                     \
+    "# rom                        quirks     frames  ipf   hash\n"
+
+// The directory part of path, slash included, empty for a bare file name
+static size_t dir_len(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t)(slash - path + 1) : 0;
+}
+
+static bool parse_run(const char *line, const char *dir, size_t dir_bytes,
+                      C8GoldenRun *run) {
+    char quirks[32], hash[32];
+    C8QuirkProfile profile;
+
+    if(sscanf(line, "%255s %31s %u %u %31s", run->rom, quirks, &run->frames, &run->ipf,
+              hash) != 5 ||
+       !c8_quirks_from_name(quirks, &profile) || run->frames == 0 || run->ipf == 0) {
+        return false;
+    }
+    run->quirks = profile;
+
+    run->has_hash = strcmp(hash, "-") != 0;
+    if(run->has_hash) {
+        char *end;
+        run->hash = strtoull(hash, &end, 16);
+        if(*end != '\0') {
+            return false;
+        }
+    }
+
+    snprintf(run->path, sizeof run->path, "%.*s%s", (int)dir_bytes, dir, run->rom);
+    return true;
+}
+
+C8Golden *c8_golden_load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if(!f) {
+        fprintf(stderr, "Couldn't open the golden manifest %s\n", path);
+        return NULL;
+    }
+
+    C8Golden *golden = c8_calloc(1, sizeof *golden);
+    size_t capacity = 0;
+    char line[512];
+    int line_number = 0;
+
+    while(fgets(line, sizeof line, f)) {
+        line_number++;
+        size_t skip = strspn(line, " \t");
+        if(line[skip] == '#' || line[skip] == '\n' || line[skip] == '\0') {
+            continue;
+        }
+
+        if(golden->count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            golden->runs = c8_realloc(golden->runs, capacity * sizeof *golden->runs);
+        }
+        if(!parse_run(line, path, dir_len(path), &golden->runs[golden->count])) {
+            fprintf(stderr, "%s:%d isn't a golden run\n", path, line_number);
+            fclose(f);
+            c8_golden_free(golden);
+            return NULL;
+        }
+        golden->count++;
+    }
+
+    fclose(f);
+    return golden;
+}
+
+void c8_golden_free(C8Golden *golden) {
+    free(golden->runs);
+    free(golden);
+}
+
+bool c8_golden_save(const C8Golden *golden, const char *path) {
+    FILE *f = fopen(path, "w");
+    if(!f) {
+        fprintf(stderr, "Couldn't write the golden manifest %s\n", path);
+        return false;
+    }
+
+    fputs(HEADER, f);
+    for(size_t i = 0; i < golden->count; i++) {
+        const C8GoldenRun *run = &golden->runs[i];
+        fprintf(f, "%-28s %-10s %6u  %-4u  ", run->rom, c8_quirks_name(run->quirks),
+                run->frames, run->ipf);
+        if(run->has_hash) {
+            fprintf(f, "%016llx\n", (unsigned long long)run->hash);
+        } else {
+            fprintf(f, "-\n");
+        }
+    }
+
+    if(fclose(f) != 0) {
+        fprintf(stderr, "Couldn't write the golden manifest %s\n", path);
+        return false;
+    }
+    return true;
+}
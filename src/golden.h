@@ -0,0 +1,32 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include "chip8.h"
+
+// A golden manifest lists ROM runs and the c8_state_hash the reference
+// interpreter ends each of them on, one run per line:
+//   rom quirks frames ipf hash
+// ROM paths are relative to the manifest, quirks is a profile name and a
+// hash of - is one still to be generated. Lines starting with # are comments.
+typedef struct C8GoldenRun {
+    char rom[256];
+    char path[4096]; // rom as seen from the working directory
+    uint8_t quirks;  // C8QuirkProfile
+    uint32_t frames;
+    uint32_t ipf;
+    bool has_hash;
+    uint64_t hash;
+} C8GoldenRun;
+
+typedef struct C8Golden {
+    C8GoldenRun *runs;
+    size_t count;
+} C8Golden;
+
+// NULL when the file can't be read or a line doesn't parse
+C8Golden *c8_golden_load(const char *path);
+void c8_golden_free(C8Golden *golden);
+// Comments other than the header aren't kept
+bool c8_golden_save(const C8Golden *golden, const char *path);
+
+#endif
@@ -0,0 +1,808 @@
+#include <unistd.h>
+
+#include "debug_server.h"
+#include "display.h"
+#include "engine_aot.h"
+#include "engine_jit.h"
+#include "fuzz.h"
+#include "golden.h"
+#include "replay.h"
+#include "rewind.h"
+#include "romlib.h"
+#include "runner.h"
+#include "savestate.h"
+#include "scheduler.h"
+#include "stream.h"
+
+static void usage(void) {
+    fprintf(stderr, "Usage: chip8-headless [-i instructions | -f frames] [-s ipf] [-e engine] [-c] "
+                    "[-n machines] [-j threads] [-S seed] [-p log] [-l state] [-o state] [-w MiB] "
+                    "[-I] [-q quirks] [-x trace] [-D socket] [-V target [-t]] [-R archive] "
+                    "[-F runs [-O prefix]] "
+                    "<ROM file>\n"
+                    "       chip8-headless -B archive <ROM file>...\n"
+                    "       chip8-headless -C manifest [-O prefix] | -G manifest\n"
+                    "  -s  instructions per 60 Hz frame (default %d)\n"
+                    "  -e  interp (default), cached, jit, profile or aot\n"
+                    "  -c  check the engine against the reference interpreter every frame\n"
+                    "  -n  run this many copies of the machine in parallel\n"
+                    "  -j  worker threads for -n (default one per cpu)\n"
+                    "  -S  seed for the random number generator\n"
+                    "  -p  replay an input log recorded by chip8 -r\n"
+                    "  -l  start from a savestate\n"
+                    "  -o  write a savestate at the end\n"
+                    "  -w  keep a rewind buffer of this size, pushing every frame\n"
+                    "  -P  write the profile engine's counts as JSON (.json) or CSV\n"
+                    "  -I  execute idle loops instead of skipping them\n"
+                    "  -q  modern, cosmac, chip48, superchip or xochip, overriding the ROM's\n"
+                    "  -x  trace every instruction into a file for chip8-trace\n"
+                    "  -D  take debugger commands on this Unix socket, stopping for them\n"
+                    "  -V  stream the screen to fd:<out>[:<in>] or consumers of a Unix\n"
+                    "      socket, taking keys back, at 60 Hz (see stream.h)\n"
+                    "  -t  stream frames as fast as they run\n"
+                    "  -R  take the ROM by name from an archive, without one run all of them\n"
+                    "  -B  pack the ROM files into an archive\n"
+                    "  -F  fuzz the keypad and seed for this many runs of -f frames each\n"
+                    "  -O  save each fuzzing finding as an input log <prefix><n>.log\n"
+                    "  -C  run every engine through a golden manifest, saving the screens\n"
+                    "      of mismatches as <prefix><rom>-<quirks>-<engine>.pbm\n"
+                    "  -G  regenerate a golden manifest's hashes with the reference\n"
+                    "      interpreter\n",
+            INSTRUCTIONS_PER_FRAME);
+    exit(1);
+}
+
+// the most machines a mode runs by itself at once, the golden check's one per
+// engine, reference and loaded template. -n takes its own from the runner.
+#define MAX_MACHINES 7
+
+// every machine headless runs by itself comes out of this, made in main
+static C8Pool *pool;
+
+static Chip8 *new_machine(void) {
+    Chip8 *chip8 = chip8_init_pooled(pool);
+    if(!chip8) {
+        fprintf(stderr, "More than %d machines at once\n", MAX_MACHINES);
+        exit(1);
+    }
+    return chip8;
+}
+
+static const char *FAULT_NAMES[] = {"pc", "ram", "stack", "key"};
+
+static void print_faults(uint8_t faults, uint16_t pc) {
+    if(!faults) {
+        printf("none");
+        return;
+    }
+    for(size_t i = 0; i < sizeof FAULT_NAMES / sizeof *FAULT_NAMES; i++) {
+        if(faults >> i & 1) {
+            printf("%s ", FAULT_NAMES[i]);
+        }
+    }
+    printf("from 0x%03x", pc);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// With an archive the ROM is looked up by name instead of read from a file
+static void load_rom(Chip8 *chip8, const C8RomLib *lib, const char *rom,
+                     const C8QuirkProfile *quirks) {
+    size_t index;
+
+    if(!lib) {
+        c8_load_rom(chip8, rom, quirks);
+        return;
+    }
+    if(!c8_romlib_find_name(lib, rom, &index)) {
+        fprintf(stderr, "%s isn't in the ROM archive\n", rom);
+        exit(1);
+    }
+    c8_romlib_load(lib, index, chip8, quirks);
+}
+
+// Steps the engine and the reference interpreter side by side a frame at a time
+// and reports the first frame where their machines differ. Without quirks the
+// profile comes from the ROM.
+static bool check_engine(C8EngineKind kind, const C8RomLib *lib, const char *rom,
+                         uint64_t instructions, uint32_t ipf, uint64_t seed,
+                         const C8QuirkProfile *quirks) {
+    Chip8 *chip8 = new_machine();
+    Chip8 *ref = new_machine();
+    load_rom(chip8, lib, rom, quirks);
+    c8_reset_to(ref, chip8);
+    // both machines draw the same random numbers
+    c8_seed(chip8, seed);
+    c8_seed(ref, seed);
+
+    C8Engine *engine = c8_engine_create(kind, chip8);
+    C8Engine *ref_engine = c8_engine_create(C8_ENGINE_INTERP, ref);
+    // the reference executes every instruction, so skipped loops get checked too
+    c8_engine_set_idle_skip(ref_engine, false);
+    bool ok = true;
+
+    for(uint64_t done = 0; done < instructions; done += ipf) {
+        uint64_t n = instructions - done < ipf ? instructions - done : ipf;
+        c8_engine_run_frames(engine, n, ipf);
+        c8_engine_run_frames(ref_engine, n, ipf);
+
+        if(memcmp(chip8, ref, sizeof *chip8) != 0) {
+            fprintf(stderr, "%s diverged from interp after %llu instructions (pc 0x%03x vs 0x%03x)\n",
+                    c8_engine_name(kind), (unsigned long long)(done + n), chip8->pc,
+                    ref->pc);
+            ok = false;
+            break;
+        }
+    }
+
+    c8_engine_destroy(engine);
+    c8_engine_destroy(ref_engine);
+    c8_pool_free(pool, chip8);
+    c8_pool_free(pool, ref);
+
+    return ok;
+}
+
+// Every machine runs the same ROM from the same seed, so they should all end
+// on the same screen
+static void run_many(C8EngineKind kind, const C8RomLib *lib, const char *rom,
+                     uint64_t instructions, uint32_t ipf, uint64_t seed,
+                     const C8QuirkProfile *quirks, size_t count, uint32_t threads) {
+    C8Runner *runner = c8_runner_create(kind, count, threads);
+    // load once and copy the machine
+    Chip8 *loaded = new_machine();
+    load_rom(loaded, lib, rom, quirks);
+    c8_seed(loaded, seed);
+
+    for(size_t i = 0; i < count; i++) {
+        c8_reset_to(c8_runner_machine(runner, i), loaded);
+        c8_runner_set_budget(runner, i, instructions, ipf);
+    }
+    c8_pool_free(pool, loaded);
+
+    double start = now_seconds();
+    c8_runner_run(runner);
+    double elapsed = now_seconds() - start;
+
+    uint64_t total = 0;
+    size_t matching = 0;
+    uint64_t first_hash = c8_runner_result(runner, 0)->screen_hash;
+    for(size_t i = 0; i < count; i++) {
+        const C8RunResult *result = c8_runner_result(runner, i);
+        total += result->instructions;
+        matching += result->screen_hash == first_hash;
+    }
+
+    printf("rom:          %s\n", rom);
+    printf("engine:       %s\n", c8_engine_name(kind));
+    printf("machines:     %zu\n", count);
+    printf("threads:      %u\n", c8_runner_threads(runner));
+    printf("instructions: %llu\n", (unsigned long long)total);
+    printf("screen hash:  %016llx (%zu of %zu machines)\n", (unsigned long long)first_hash,
+           matching, count);
+    printf("elapsed:      %.6f s\n", elapsed);
+    printf("ips:          %.0f\n", elapsed > 0 ? total / elapsed : 0.0);
+
+    c8_runner_destroy(runner);
+}
+
+// One machine per ROM in the archive, each printed with the screen it ends on
+static void run_library(C8EngineKind kind, const C8RomLib *lib, uint64_t instructions,
+                        uint32_t ipf, uint64_t seed, const C8QuirkProfile *quirks,
+                        uint32_t threads) {
+    size_t count = c8_romlib_count(lib);
+    if(count == 0) {
+        printf("roms:         0\n");
+        return;
+    }
+
+    C8Runner *runner = c8_runner_create(kind, count, threads);
+    double start = now_seconds();
+    for(size_t i = 0; i < count; i++) {
+        Chip8 *chip8 = c8_runner_machine(runner, i);
+        c8_romlib_load(lib, i, chip8, quirks);
+        c8_seed(chip8, seed);
+        c8_runner_set_budget(runner, i, instructions, ipf);
+    }
+    double loading = now_seconds() - start;
+
+    start = now_seconds();
+    c8_runner_run(runner);
+    double elapsed = now_seconds() - start;
+
+    uint64_t total = 0;
+    for(size_t i = 0; i < count; i++) {
+        const C8RunResult *result = c8_runner_result(runner, i);
+        total += result->instructions;
+        printf("%016llx  %-10s %s\n", (unsigned long long)result->screen_hash,
+               c8_quirks_name(c8_runner_machine(runner, i)->quirks),
+               c8_romlib_name(lib, i));
+    }
+
+    printf("roms:         %zu\n", count);
+    printf("engine:       %s\n", c8_engine_name(kind));
+    printf("threads:      %u\n", c8_runner_threads(runner));
+    printf("instructions: %llu\n", (unsigned long long)total);
+    printf("loading:      %.0f ns per rom\n", loading / count * 1e9);
+    printf("elapsed:      %.6f s\n", elapsed);
+    printf("ips:          %.0f\n", elapsed > 0 ? total / elapsed : 0.0);
+
+    c8_runner_destroy(runner);
+}
+
+// Runs mutated keypad schedules and seeds against the ROM and lists every new
+// way it found to fault
+static void fuzz(const C8RomLib *lib, const char *rom, uint64_t frames, uint32_t ipf,
+                 uint64_t seed, const C8QuirkProfile *quirks, uint64_t runs,
+                 const char *prefix) {
+    Chip8 *loaded = new_machine();
+    load_rom(loaded, lib, rom, quirks);
+    c8_seed(loaded, seed);
+    if(frames > UINT32_MAX) {
+        frames = UINT32_MAX;
+    }
+
+    C8Fuzzer *fuzzer = c8_fuzz_create(loaded, frames, ipf, seed);
+    double start = now_seconds();
+    c8_fuzz_run(fuzzer, runs);
+    double elapsed = now_seconds() - start;
+    const C8FuzzStats *stats = c8_fuzz_stats(fuzzer);
+
+    for(size_t i = 0; i < stats->findings; i++) {
+        const C8FuzzFinding *finding = c8_fuzz_finding(fuzzer, i);
+        printf("finding %zu:    ", i);
+        print_faults(finding->faults, finding->fault_pc);
+        printf(" in frame %u\n", finding->frames);
+
+        if(prefix) {
+            char path[4096];
+            snprintf(path, sizeof path, "%s%zu.log", prefix, i);
+            c8_fuzz_save(fuzzer, i, path);
+        }
+    }
+
+    printf("rom:          %s\n", rom);
+    printf("runs:         %llu\n", (unsigned long long)stats->execs);
+    printf("instructions: %llu\n", (unsigned long long)stats->instructions);
+    printf("coverage:     %u pcs, %u edges\n", stats->pcs, stats->edges);
+    printf("corpus:       %zu\n", stats->corpus);
+    printf("findings:     %zu\n", stats->findings);
+    printf("elapsed:      %.6f s\n", elapsed);
+    printf("runs/s:       %.0f\n", elapsed > 0 ? runs / elapsed : 0.0);
+
+    c8_fuzz_destroy(fuzzer);
+    c8_pool_free(pool, loaded);
+}
+
+// c8_engine_run_frames with the debugger server polled every frame. The
+// instructions a stopped machine didn't run are still owed, and the frame
+// it stopped in carries on where it left off.
+static void run_debugged(C8Engine *engine, Chip8 *chip8, C8DebugServer *server,
+                         uint64_t instructions, uint32_t ipf) {
+    uint64_t end = chip8->cycles + instructions;
+    uint32_t frame_left = ipf;
+
+    while(chip8->cycles < end) {
+        // a stopped machine waits on the client instead of spinning
+        c8_debug_server_poll(server, engine, chip8, c8_engine_paused(engine) ? 100 : 0);
+        if(c8_engine_paused(engine)) {
+            continue;
+        }
+
+        uint64_t left = end - chip8->cycles;
+        uint64_t start = chip8->cycles;
+        c8_engine_run(engine, left < frame_left ? left : frame_left);
+        frame_left -= chip8->cycles - start;
+        if(frame_left == 0) {
+            c8_engine_end_frame(engine);
+            frame_left = ipf;
+        }
+    }
+}
+
+// c8_engine_run_frames paced to 60 Hz unless turbo, the screen going out to
+// the stream's consumers and their keys coming back every frame
+static void run_streamed(C8Engine *engine, Chip8 *chip8, C8Stream *stream,
+                         uint64_t instructions, uint32_t ipf, bool turbo) {
+    C8Scheduler sched;
+    c8_scheduler_init(&sched, ipf, turbo);
+    uint64_t frames = instructions / ipf;
+
+    for(uint64_t frame = 0; frame < frames; frame++) {
+        c8_stream_poll(stream, chip8);
+        c8_engine_run_frame(engine, ipf);
+        c8_stream_frame(stream, chip8, frame);
+        chip8->needs_draw = false;
+        c8_scheduler_wait(&sched);
+    }
+    c8_engine_run(engine, instructions % ipf);
+}
+
+// Every engine this binary can run, the JIT only on hosts it generates code
+// for and aot only with a translation linked in
+static size_t available_engines(C8EngineKind kinds[5]) {
+    size_t count = 0;
+    kinds[count++] = C8_ENGINE_INTERP;
+    kinds[count++] = C8_ENGINE_CACHED;
+
+    C8Jit *jit = c8_jit_create();
+    if(jit) {
+        kinds[count++] = C8_ENGINE_JIT;
+        c8_jit_destroy(jit);
+    }
+#ifdef C8_PROFILE
+    kinds[count++] = C8_ENGINE_PROFILE;
+#endif
+    if(c8_aot_program) {
+        kinds[count++] = C8_ENGINE_AOT;
+    }
+    return count;
+}
+
+// Puts the engine's machine back to loaded and runs the golden run on it
+static uint64_t golden_hash(C8Engine *engine, const Chip8 *chip8, const Chip8 *loaded,
+                            const C8GoldenRun *run) {
+    c8_engine_restore(engine, loaded);
+    c8_engine_run_frames(engine, (uint64_t)run->frames * run->ipf, run->ipf);
+    return c8_state_hash(chip8);
+}
+
+static void save_screen(const Chip8 *chip8, const C8GoldenRun *run, const char *prefix,
+                        const char *what, char *path, size_t size) {
+    const char *name = strrchr(run->rom, '/') ? strrchr(run->rom, '/') + 1 : run->rom;
+    const char *dot = strrchr(name, '.');
+    int stem = dot ? (int)(dot - name) : (int)strlen(name);
+
+    snprintf(path, size, "%s%.*s-%s-%s.pbm", prefix, stem, name,
+             c8_quirks_name(run->quirks), what);
+    if(!c8_screen_save_pbm(chip8->screen[0][0], chip8->hires, path)) {
+        exit(1);
+    }
+}
+
+// Runs every manifest entry on every engine and compares the state each ends
+// on with the manifest's. With update the reference interpreter, executing
+// every instruction, writes the hashes instead.
+static int conformance(const char *manifest, bool update, const char *prefix) {
+    C8Golden *golden = c8_golden_load(manifest);
+    if(!golden) {
+        exit(1);
+    }
+
+    // one machine and engine per kind for the whole manifest, so the JIT keeps
+    // its code buffer
+    C8EngineKind kinds[5];
+    size_t num_engines = update ? 0 : available_engines(kinds);
+    Chip8 *machines[5];
+    C8Engine *engines[5];
+    for(size_t e = 0; e < num_engines; e++) {
+        machines[e] = new_machine();
+        engines[e] = c8_engine_create(kinds[e], machines[e]);
+    }
+    Chip8 *ref = new_machine();
+    C8Engine *ref_engine = c8_engine_create(C8_ENGINE_INTERP, ref);
+    c8_engine_set_idle_skip(ref_engine, false);
+    Chip8 *loaded = new_machine();
+
+    size_t failures = 0;
+    double start = now_seconds();
+
+    for(size_t i = 0; i < golden->count; i++) {
+        C8GoldenRun *run = &golden->runs[i];
+        c8_reset(loaded);
+        C8QuirkProfile profile = run->quirks;
+        c8_load_rom(loaded, run->path, &profile);
+
+        if(update) {
+            run->hash = golden_hash(ref_engine, ref, loaded, run);
+            run->has_hash = true;
+            printf("%016llx  %-10s %s\n", (unsigned long long)run->hash,
+                   c8_quirks_name(run->quirks), run->rom);
+            continue;
+        }
+
+        uint64_t hashes[5];
+        bool ok = run->has_hash;
+        for(size_t e = 0; e < num_engines && run->has_hash; e++) {
+            hashes[e] = golden_hash(engines[e], machines[e], loaded, run);
+            ok &= hashes[e] == run->hash;
+        }
+        printf("%-4s  %-28s %-10s %u frames at %u\n", ok ? "ok" : "FAIL", run->rom,
+               c8_quirks_name(run->quirks), run->frames, run->ipf);
+        if(ok) {
+            continue;
+        }
+
+        failures++;
+        if(!run->has_hash) {
+            printf("  no hash yet, regenerate the manifest with -G\n");
+            continue;
+        }
+        char path[4096];
+        for(size_t e = 0; e < num_engines; e++) {
+            if(hashes[e] != run->hash) {
+                save_screen(machines[e], run, prefix, c8_engine_name(kinds[e]), path,
+                            sizeof path);
+                printf("  %-7s %016llx, screen in %s\n", c8_engine_name(kinds[e]),
+                       (unsigned long long)hashes[e], path);
+            }
+        }
+        // what the reference shows now, to hold the other screens against
+        golden_hash(ref_engine, ref, loaded, run);
+        save_screen(ref, run, prefix, "reference", path, sizeof path);
+        printf("  wanted  %016llx, reference screen in %s\n",
+               (unsigned long long)run->hash, path);
+    }
+    double elapsed = now_seconds() - start;
+
+    if(update) {
+        if(!c8_golden_save(golden, manifest)) {
+            exit(1);
+        }
+    } else {
+        printf("runs:         %zu on %zu engines\n", golden->count, num_engines);
+        printf("failures:     %zu\n", failures);
+        printf("elapsed:      %.6f s\n", elapsed);
+    }
+
+    for(size_t e = 0; e < num_engines; e++) {
+        c8_engine_destroy(engines[e]);
+        c8_pool_free(pool, machines[e]);
+    }
+    c8_engine_destroy(ref_engine);
+    c8_pool_free(pool, ref);
+    c8_pool_free(pool, loaded);
+    c8_golden_free(golden);
+
+    return failures > 0;
+}
+
+// Same as c8_engine_run_frames, but the state after every frame goes into
+// the rewind buffer and the time that takes is reported
+static void run_with_rewind(C8Engine *engine, Chip8 *chip8, uint64_t instructions,
+                            uint32_t ipf, size_t budget) {
+    C8Rewind *rw = c8_rewind_create(budget, FRAMES_PER_SECOND);
+    uint64_t frames = instructions / ipf;
+    double pushing = 0;
+
+    for(uint64_t frame = 0; frame < frames; frame++) {
+        c8_engine_run_frame(engine, ipf);
+        double start = now_seconds();
+        c8_rewind_push(rw, chip8);
+        pushing += now_seconds() - start;
+    }
+    c8_engine_run(engine, instructions % ipf);
+
+    printf("rewind:       %zu frames in %zu bytes, %.0f ns per push\n", c8_rewind_frames(rw),
+           c8_rewind_bytes(rw), frames ? pushing / frames * 1e9 : 0.0);
+    c8_rewind_destroy(rw);
+}
+
+int main(int argc, char **argv) {
+    // run one minute of emulated time unless told otherwise
+    uint64_t frames = 60 * FRAMES_PER_SECOND;
+    uint64_t instructions = 0;
+    uint32_t ipf = INSTRUCTIONS_PER_FRAME;
+    C8EngineKind kind = C8_ENGINE_INTERP;
+    bool check = false;
+    size_t machines = 0;
+    uint32_t threads = 0;
+    uint64_t seed = C8_DEFAULT_SEED;
+    const char *log_path = NULL;
+    const char *load_path = NULL;
+    const char *save_path = NULL;
+    size_t rewind_budget = 0;
+    const char *profile_path = NULL;
+    bool idle_skip = true;
+    C8QuirkProfile quirks;
+    bool force_quirks = false;
+    const char *lib_path = NULL;
+    const char *build_path = NULL;
+    uint64_t fuzz_runs = 0;
+    const char *fuzz_prefix = NULL;
+    const char *trace_path = NULL;
+    const char *manifest = NULL;
+    const char *debug_path = NULL;
+    const char *stream_target = NULL;
+    bool turbo = false;
+    bool update_golden = false;
+    int opt;
+
+    while((opt = getopt(argc, argv, "i:f:s:e:cn:j:S:p:l:o:w:P:Iq:x:D:V:tR:B:F:O:C:G:")) !=
+          -1) {
+        switch(opt) {
+            case 'i':
+                instructions = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                frames = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                ipf = strtoul(optarg, NULL, 10);
+                if(ipf == 0) {
+                    usage();
+                }
+                break;
+            case 'e':
+                if(!c8_engine_from_name(optarg, &kind)) {
+                    fprintf(stderr, "Unknown engine %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'c':
+                check = true;
+                break;
+            case 'n':
+                machines = strtoull(optarg, NULL, 10);
+                if(machines == 0) {
+                    usage();
+                }
+                break;
+            case 'j':
+                threads = strtoul(optarg, NULL, 10);
+                break;
+            case 'S':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'p':
+                log_path = optarg;
+                break;
+            case 'l':
+                load_path = optarg;
+                break;
+            case 'o':
+                save_path = optarg;
+                break;
+            case 'w':
+                rewind_budget = strtoull(optarg, NULL, 10) << 20;
+                break;
+            case 'P':
+                profile_path = optarg;
+                break;
+            case 'I':
+                idle_skip = false;
+                break;
+            case 'q':
+                if(!c8_quirks_from_name(optarg, &quirks)) {
+                    fprintf(stderr, "Unknown quirk profile %s\n", optarg);
+                    usage();
+                }
+                force_quirks = true;
+                break;
+            case 'x':
+                trace_path = optarg;
+                break;
+            case 'D':
+                debug_path = optarg;
+                break;
+            case 'V':
+                stream_target = optarg;
+                break;
+            case 't':
+                turbo = true;
+                break;
+            case 'R':
+                lib_path = optarg;
+                break;
+            case 'B':
+                build_path = optarg;
+                break;
+            case 'F':
+                fuzz_runs = strtoull(optarg, NULL, 10);
+                if(fuzz_runs == 0) {
+                    usage();
+                }
+                break;
+            case 'O':
+                fuzz_prefix = optarg;
+                break;
+            case 'C':
+                manifest = optarg;
+                break;
+            case 'G':
+                manifest = optarg;
+                update_golden = true;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if(build_path) {
+        if(optind >= argc) {
+            usage();
+        }
+        if(!c8_romlib_build(build_path, argv + optind, argc - optind)) {
+            exit(1);
+        }
+        C8RomLib *lib = c8_romlib_open(build_path);
+        if(!lib) {
+            exit(1);
+        }
+        printf("%s: %zu roms from %d files\n", build_path, c8_romlib_count(lib),
+               argc - optind);
+        c8_romlib_close(lib);
+        return 0;
+    }
+
+    pool = c8_pool_create(sizeof(Chip8), MAX_MACHINES);
+    if(manifest) {
+        int status = conformance(manifest, update_golden, fuzz_prefix ? fuzz_prefix : "");
+        c8_pool_destroy(pool);
+        return status;
+    }
+
+    if(instructions == 0) {
+        instructions = frames * ipf;
+    }
+
+    C8RomLib *lib = NULL;
+    if(lib_path) {
+        lib = c8_romlib_open(lib_path);
+        if(!lib) {
+            exit(1);
+        }
+    }
+
+    if(lib && optind >= argc) {
+        run_library(kind, lib, instructions, ipf, seed, force_quirks ? &quirks : NULL,
+                    threads);
+        c8_romlib_close(lib);
+        c8_pool_destroy(pool);
+        return 0;
+    }
+
+    // a replay has to start from power on
+    if(optind >= argc || (log_path && load_path)) {
+        usage();
+    }
+
+    if(profile_path && kind != C8_ENGINE_PROFILE) {
+        fprintf(stderr, "-P needs -e profile\n");
+        usage();
+    }
+
+    if(trace_path && kind == C8_ENGINE_PROFILE) {
+        fprintf(stderr, "-x doesn't work with -e profile\n");
+        usage();
+    }
+
+    if(debug_path && (log_path || rewind_budget > 0)) {
+        fprintf(stderr, "-D doesn't work with -p or -w\n");
+        usage();
+    }
+
+    if(stream_target && (log_path || rewind_budget > 0 || debug_path)) {
+        fprintf(stderr, "-V doesn't work with -p, -w or -D\n");
+        usage();
+    }
+
+    if(fuzz_runs > 0) {
+        fuzz(lib, argv[optind], frames, ipf, seed, force_quirks ? &quirks : NULL, fuzz_runs,
+             fuzz_prefix);
+        c8_pool_destroy(pool);
+        return 0;
+    }
+
+    if(check) {
+        bool ok = check_engine(kind, lib, argv[optind], instructions, ipf, seed,
+                               force_quirks ? &quirks : NULL);
+        printf("%s: %s matches interp: %s\n", argv[optind], c8_engine_name(kind),
+               ok ? "yes" : "no");
+        c8_pool_destroy(pool);
+        return ok ? 0 : 1;
+    }
+
+    if(machines > 0) {
+        run_many(kind, lib, argv[optind], instructions, ipf, seed, force_quirks ? &quirks : NULL,
+                 machines, threads);
+        c8_pool_destroy(pool);
+        return 0;
+    }
+
+    Chip8 *chip8 = new_machine();
+    load_rom(chip8, lib, argv[optind], force_quirks ? &quirks : NULL);
+    c8_seed(chip8, seed);
+    C8Engine *engine = c8_engine_create(kind, chip8);
+    c8_engine_set_idle_skip(engine, idle_skip);
+    C8Replay *replay = log_path ? c8_replay_open(log_path) : NULL;
+
+    if(load_path) {
+        C8Savestate *state = c8_savestate_open(load_path);
+        if(!state) {
+            exit(1);
+        }
+        c8_engine_restore(engine, c8_savestate_state(state));
+        c8_savestate_close(state);
+    }
+
+    // the trace takes the machine as the first instruction finds it, so after
+    // the savestate and whatever the replay sets up
+    C8TraceWriter *trace = trace_path ? c8_trace_writer_create(trace_path) : NULL;
+    c8_engine_set_trace(engine, trace);
+
+    // nobody could attach to a run this fast, so it waits for the client
+    C8DebugServer *server = NULL;
+    if(debug_path) {
+        server = c8_debug_server_create(debug_path);
+        if(!server) {
+            exit(1);
+        }
+        printf("waiting for a debugger on %s\n", debug_path);
+        fflush(stdout);
+        c8_debug_server_wait(server, engine, chip8);
+    }
+
+    C8Stream *stream = NULL;
+    if(stream_target) {
+        stream = c8_stream_open(stream_target);
+        if(!stream) {
+            exit(1);
+        }
+    }
+
+    double start = now_seconds();
+    if(replay) {
+        // the log decides how long the session lasts
+        ipf = c8_replay_ipf(replay);
+        instructions = c8_replay_run(replay, engine, chip8);
+    } else if(rewind_budget > 0) {
+        run_with_rewind(engine, chip8, instructions, ipf, rewind_budget);
+    } else if(server) {
+        run_debugged(engine, chip8, server, instructions, ipf);
+        c8_debug_server_destroy(server, engine);
+    } else if(stream) {
+        run_streamed(engine, chip8, stream, instructions, ipf, turbo);
+    } else {
+        c8_engine_run_frames(engine, instructions, ipf);
+    }
+    // the trace counts as written once it's all in the file
+    if(trace) {
+        c8_engine_set_trace(engine, NULL);
+        c8_trace_writer_close(trace);
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("rom:          %s\n", argv[optind]);
+    printf("engine:       %s\n", c8_engine_name(kind));
+    printf("quirks:       %s\n", c8_quirks_name(chip8->quirks));
+    printf("instructions: %llu\n", (unsigned long long)instructions);
+    printf("frames:       %llu\n", (unsigned long long)(instructions / ipf));
+    printf("screen hash:  %016llx\n", (unsigned long long)c8_screen_hash(chip8));
+    printf("state hash:   %016llx\n", (unsigned long long)c8_state_hash(chip8));
+    printf("faults:       ");
+    print_faults(chip8->faults, chip8->fault_pc);
+    printf("\n");
+    printf("idle skipped: %llu instructions\n",
+           (unsigned long long)c8_engine_skipped(engine));
+    if(stream) {
+        printf("dropped:      %llu frames\n", (unsigned long long)c8_stream_dropped(stream));
+        c8_stream_close(stream);
+    }
+    printf("elapsed:      %.6f s\n", elapsed);
+    printf("ips:          %.0f\n", elapsed > 0 ? instructions / elapsed : 0.0);
+
+    if(save_path && !c8_savestate_save(chip8, save_path)) {
+        exit(1);
+    }
+
+    if(profile_path && !c8_profile_export(c8_engine_profile(engine), profile_path)) {
+        exit(1);
+    }
+
+    if(replay) {
+        c8_replay_close(replay);
+    }
+    if(lib) {
+        c8_romlib_close(lib);
+    }
+    c8_engine_destroy(engine);
+    c8_pool_free(pool, chip8);
+    c8_pool_destroy(pool);
+
+    return 0;
+}
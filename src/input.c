@@ -0,0 +1,38 @@
+#include "input.h"
+
+void c8_input_init(C8Input *in) {
+    memset(in, 0, sizeof *in);
+}
+
+bool c8_input_push(C8Input *in, uint64_t time, uint8_t key, bool pressed) {
+    uint32_t tail = in->tail;
+    if(tail - __atomic_load_n(&in->head, __ATOMIC_ACQUIRE) == C8_INPUT_QUEUE) {
+        return false;
+    }
+
+    in->events[tail % C8_INPUT_QUEUE] = (C8KeyEvent){time, key, pressed};
+    __atomic_store_n(&in->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint16_t c8_input_frame(C8Input *in, uint64_t *time) {
+    uint32_t tail = __atomic_load_n(&in->tail, __ATOMIC_ACQUIRE);
+    uint32_t head = in->head;
+    uint16_t pressed = 0;
+
+    for(; head != tail; head++) {
+        const C8KeyEvent *event = &in->events[head % C8_INPUT_QUEUE];
+        uint16_t bit = 1u << event->key;
+
+        if(event->pressed) {
+            in->held |= bit;
+            pressed |= bit;
+        } else {
+            in->held &= ~bit;
+        }
+        *time = event->time;
+    }
+
+    __atomic_store_n(&in->head, head, __ATOMIC_RELEASE);
+    return in->held | pressed;
+}
@@ -0,0 +1,36 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "chip8.h"
+
+#define C8_INPUT_QUEUE 64 // a power of two
+
+// Key events on their way from the thread reading them to the one running
+// the machine, which collects them once per frame. A single producer, single
+// consumer queue, so neither side ever waits on the other.
+typedef struct C8KeyEvent {
+    uint64_t time; // when the frontend read the event, on a clock of its choosing
+    uint8_t key;
+    bool pressed;
+} C8KeyEvent;
+
+typedef struct C8Input {
+    C8KeyEvent events[C8_INPUT_QUEUE];
+    uint32_t tail __attribute__((aligned(64))); // producer only
+    uint32_t head __attribute__((aligned(64))); // consumer only
+    uint16_t held; // consumer only, bit i while key i is down
+} C8Input;
+
+void c8_input_init(C8Input *in);
+
+// Producer side, false when the queue is full and the event was dropped
+bool c8_input_push(C8Input *in, uint64_t time, uint8_t key, bool pressed);
+
+// Consumer side, once per frame. Returns bit i set for every key the machine
+// should see down during the next frame. A key pressed and let go again
+// since the last call stays down for that one frame, so taps shorter than a
+// frame still reach EX9E and FX0A. When there were events, time is set to
+// the newest one's.
+uint16_t c8_input_frame(C8Input *in, uint64_t *time);
+
+#endif
@@ -1,21 +1,368 @@
+#include <SDL2/SDL.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "beeper.h"
 #include "chip8.h"
+#include "debug_server.h"
+#include "display.h"
+#include "engine.h"
+#include "input.h"
+#include "replay.h"
+#include "rewind.h"
+#include "savestate.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "triple_buffer.h"
+
+// present at most once per host frame however often the ROM draws
+#define PRESENT_INTERVAL_MS (1000 / 60)
+// several minutes of rewind for most ROMs
+#define REWIND_BUDGET (16 << 20)
+// a 256 sample buffer keeps the buzzer about 5 ms behind the machine
+#define AUDIO_RATE 48000
+#define AUDIO_BUFFER 256
+
+// requests from the render thread, carried out between two frames
+#define CMD_SAVE 0x1
+#define CMD_LOAD 0x2
+#define CMD_RESTART 0x4
+
+// Keypad key plus one by scancode, 0 for everything else. Scancodes name a
+// position on the keyboard, so the 4x4 block stays put on any layout.
+#define KEY(k) ((k) + 1)
+static const uint8_t SCANCODE_KEYS[SDL_NUM_SCANCODES] = {
+    [SDL_SCANCODE_X] = KEY(0x0),
+    [SDL_SCANCODE_1] = KEY(0x1),
+    [SDL_SCANCODE_2] = KEY(0x2),
+    [SDL_SCANCODE_3] = KEY(0x3),
+    [SDL_SCANCODE_Q] = KEY(0x4),
+    [SDL_SCANCODE_W] = KEY(0x5),
+    [SDL_SCANCODE_E] = KEY(0x6),
+    [SDL_SCANCODE_A] = KEY(0x7),
+    [SDL_SCANCODE_S] = KEY(0x8),
+    [SDL_SCANCODE_D] = KEY(0x9),
+    [SDL_SCANCODE_Z] = KEY(0xA),
+    [SDL_SCANCODE_C] = KEY(0xB),
+    [SDL_SCANCODE_4] = KEY(0xC),
+    [SDL_SCANCODE_R] = KEY(0xD),
+    [SDL_SCANCODE_F] = KEY(0xE),
+    [SDL_SCANCODE_V] = KEY(0xF),
+};
+#undef KEY
+
+// SDL wants video and events on the main thread, so that's the render thread
+// and the machine runs on a thread of its own. Nothing here is locked: frames
+// go one way through the triple buffer, key events the other way through the
+// input queue, everything else is a single atomic.
+typedef struct Emulator {
+    Chip8 *chip8;
+    Chip8 *loaded; // the machine right after the ROM was loaded, for restarts
+    C8Engine *engine;
+    C8Scheduler sched;
+    C8Recorder *rec;
+    C8TraceWriter *trace;
+    C8Rewind *rw;
+    C8Beeper *beeper;
+    C8DebugServer *server;
+    const char *state_path;
+
+    C8TripleBuffer frames;
+    C8Input input;
+    uint64_t input_time; // newest key event the machine has seen
+    uint32_t commands;   // CMD_* bits
+    bool rewinding;
+    bool quit;
+
+    // emulation thread time spent per frame, not counting the wait
+    uint64_t frames_run;
+    uint64_t busy_ticks;
+} Emulator;
+
+typedef struct Display {
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+    uint64_t shown[NUM_PLANES][SCREEN_WORDS][SCREEN_HEIGHT];
+    bool shown_hires;
+    bool uploaded;
+
+    uint64_t presents;
+    uint64_t present_ticks;
+
+    // from reading a key event to presenting the first frame run after it
+    uint64_t shown_input;
+    uint64_t inputs;
+    uint64_t input_ticks;
+    uint64_t input_ticks_max;
+} Display;
+
+// Key changes only reach the machine here, once per frame, which is also
+// where they go into the input log
+static void apply_keys(Emulator *emu) {
+    Chip8 *chip8 = emu->chip8;
+    uint16_t keys = c8_input_frame(&emu->input, &emu->input_time);
+
+    for(uint8_t i = 0; i < NUM_KEYS; i++) {
+        bool pressed = keys >> i & 1;
+        if(pressed != chip8->keypad[i]) {
+            if(emu->rec) {
+                c8_recorder_key(emu->rec, chip8->cycles, i, pressed);
+            }
+            chip8->keypad[i] = pressed;
+        }
+    }
+}
+
+static void run_commands(Emulator *emu) {
+    uint32_t commands = __atomic_exchange_n(&emu->commands, 0, __ATOMIC_ACQUIRE);
+
+    if(commands & CMD_SAVE) {
+        c8_savestate_save(emu->chip8, emu->state_path);
+    }
+
+    if(commands & CMD_LOAD) {
+        C8Savestate *state = c8_savestate_open(emu->state_path);
+        if(state) {
+            c8_engine_restore(emu->engine, c8_savestate_state(state));
+            c8_savestate_close(state);
+        }
+    }
+
+    if(commands & CMD_RESTART) {
+        c8_engine_restore(emu->engine, emu->loaded);
+    }
+}
+
+static void *emulate(void *arg) {
+    Emulator *emu = arg;
+    Chip8 *chip8 = emu->chip8;
+
+    while(!__atomic_load_n(&emu->quit, __ATOMIC_ACQUIRE)) {
+        uint64_t start = SDL_GetPerformanceCounter();
+
+        apply_keys(emu);
+        run_commands(emu);
+        if(emu->server) {
+            c8_debug_server_poll(emu->server, emu->engine, chip8, 0);
+        }
+
+        // rewinding is silent
+        bool sound = false;
+        if(__atomic_load_n(&emu->rewinding, __ATOMIC_RELAXED)) {
+            Chip8 state;
+            if(c8_rewind_pop(emu->rw, &state)) {
+                c8_engine_restore(emu->engine, &state);
+            }
+        } else {
+            c8_engine_run(emu->engine, emu->sched.ipf);
+            // before the tick, so a timer set to 1 still sounds for its frame
+            sound = chip8->sound_timer > 0;
+            c8_engine_end_frame(emu->engine);
+            // a paused machine would fill the history with copies of one frame
+            if(!c8_engine_paused(emu->engine)) {
+                c8_rewind_push(emu->rw, chip8);
+            }
+        }
+
+        if(emu->beeper) {
+            c8_beeper_frame(emu->beeper, emu->frames_run, sound);
+        }
+
+        if(chip8->needs_draw) {
+            C8Frame *frame = c8_triple_back(&emu->frames);
+            memcpy(frame->screen, chip8->screen, sizeof frame->screen);
+            frame->hires = chip8->hires;
+            frame->number = emu->frames_run;
+            frame->input_time = emu->input_time;
+            c8_triple_publish(&emu->frames);
+            chip8->needs_draw = false;
+        }
+
+        emu->frames_run++;
+        emu->busy_ticks += SDL_GetPerformanceCounter() - start;
+        c8_scheduler_wait(&emu->sched);
+    }
+
+    return NULL;
+}
+
+// Converts and uploads only the rows that differ from what's on screen, the
+// texture being hi-res sized whatever the resolution
+static void present(Display *display, const C8Frame *frame) {
+    uint64_t start = SDL_GetPerformanceCounter();
+    bool redraw = !display->uploaded || frame->hires != display->shown_hires;
+    uint64_t dirty_rows =
+        redraw ? UINT64_MAX
+               : c8_dirty_texture_rows(frame->screen[0][0], display->shown[0][0], frame->hires);
+    uint8_t first, count;
+
+    if(c8_dirty_span(dirty_rows, &first, &count)) {
+        SDL_Rect rect = {0, first, SCREEN_WIDTH, count};
+        void *pixels;
+        int pitch;
+
+        if(SDL_LockTexture(display->texture, &rect, &pixels, &pitch) == 0) {
+            c8_screen_to_argb(frame->screen[0][0], frame->hires, first, count, pixels, pitch);
+            SDL_UnlockTexture(display->texture);
+        }
+        memcpy(display->shown, frame->screen, sizeof display->shown);
+        display->shown_hires = frame->hires;
+        display->uploaded = true;
+    }
+
+    SDL_RenderClear(display->renderer);
+    SDL_RenderCopy(display->renderer, display->texture, NULL, NULL);
+    SDL_RenderPresent(display->renderer);
+
+    uint64_t end = SDL_GetPerformanceCounter();
+    display->presents++;
+    display->present_ticks += end - start;
+
+    if(frame->input_time != display->shown_input) {
+        uint64_t latency = end - frame->input_time;
+        display->shown_input = frame->input_time;
+        display->inputs++;
+        display->input_ticks += latency;
+        if(latency > display->input_ticks_max) {
+            display->input_ticks_max = latency;
+        }
+    }
+}
+
+static void play_audio(void *userdata, Uint8 *stream, int len) {
+    c8_beeper_render(userdata, (int16_t *)stream, len / sizeof(int16_t));
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: chip8 [-s ipf] [-t] [-e engine] [-r log] [-x trace] [-P file] [-T] "
+                    "[-L] [-a samples] [-q quirks] [-D socket] <ROM file> [DEBUG]\n"
+                    "  -s  instructions per 60 Hz frame (default %d)\n"
+                    "  -t  turbo, run frames as fast as possible\n"
+                    "  -e  interp (default), cached, jit or profile\n"
+                    "  -r  record key presses to an input log for chip8-headless -p\n"
+                    "  -x  trace every instruction into a file for chip8-trace\n"
+                    "  -P  on exit, write the profile engine's counts as JSON (.json) or CSV\n"
+                    "  -T  on exit, print how long each thread spent on a frame\n"
+                    "  -L  on exit, print the latency from key press to present\n"
+                    "  -a  audio buffer, a power of two (default %d), 0 for no sound\n"
+                    "  -q  modern, cosmac, chip48, superchip or xochip, overriding the ROM's\n"
+                    "  -D  serve a debugger on a Unix socket, see debug_server.h\n"
+                    "F5 saves to <ROM file>.state, F9 loads it back, F2 restarts the ROM and "
+                    "holding backspace rewinds\n",
+            INSTRUCTIONS_PER_FRAME, AUDIO_BUFFER);
+    exit(1);
+}
 
 int main(int argc, char **argv) {
-    if(argc < 2) {
-        fprintf(stderr, "Usage: chip8 <ROM file>\n");
-        exit(1);
+    uint32_t ipf = INSTRUCTIONS_PER_FRAME;
+    bool turbo = false;
+    C8EngineKind kind = C8_ENGINE_INTERP;
+    const char *log_path = NULL;
+    const char *trace_path = NULL;
+    const char *profile_path = NULL;
+    const char *debug_path = NULL;
+    bool timing = false;
+    bool latency = false;
+    uint32_t audio_buffer = AUDIO_BUFFER;
+    C8QuirkProfile quirks;
+    bool force_quirks = false;
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:te:r:x:P:TLa:q:D:")) != -1) {
+        switch(opt) {
+            case 's':
+                ipf = strtoul(optarg, NULL, 10);
+                if(ipf == 0) {
+                    usage();
+                }
+                break;
+            case 't':
+                turbo = true;
+                break;
+            case 'e':
+                if(!c8_engine_from_name(optarg, &kind)) {
+                    fprintf(stderr, "Unknown engine %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'r':
+                log_path = optarg;
+                break;
+            case 'x':
+                trace_path = optarg;
+                break;
+            case 'P':
+                profile_path = optarg;
+                break;
+            case 'T':
+                timing = true;
+                break;
+            case 'L':
+                latency = true;
+                break;
+            case 'q':
+                if(!c8_quirks_from_name(optarg, &quirks)) {
+                    fprintf(stderr, "Unknown quirk profile %s\n", optarg);
+                    usage();
+                }
+                force_quirks = true;
+                break;
+            case 'D':
+                debug_path = optarg;
+                break;
+            case 'a':
+                audio_buffer = strtoul(optarg, NULL, 10);
+                if(audio_buffer & (audio_buffer - 1) || audio_buffer > 8192) {
+                    usage();
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if(optind >= argc) {
+        usage();
     }
 
-    bool dbg = argc > 2 && strcmp(argv[2], "DEBUG") == 0;
+    if(profile_path && kind != C8_ENGINE_PROFILE) {
+        fprintf(stderr, "-P needs -e profile\n");
+        usage();
+    }
+
+    if(trace_path && kind == C8_ENGINE_PROFILE) {
+        fprintf(stderr, "-x doesn't work with -e profile\n");
+        usage();
+    }
+
+    bool dbg = optind + 1 < argc && strcmp(argv[optind + 1], "DEBUG") == 0;
+
+    Emulator emu = {0};
+    emu.chip8 = chip8_init();
+    c8_load_rom(emu.chip8, argv[optind], force_quirks ? &quirks : NULL);
+    emu.loaded = chip8_init();
+    c8_reset_to(emu.loaded, emu.chip8);
+    emu.engine = c8_engine_create(kind, emu.chip8);
+    c8_engine_set_debug(emu.engine, dbg);
+    emu.rec = log_path ? c8_recorder_create(log_path, emu.chip8, ipf) : NULL;
+    emu.trace = trace_path ? c8_trace_writer_create(trace_path) : NULL;
+    c8_engine_set_trace(emu.engine, emu.trace);
+    emu.rw = c8_rewind_create(REWIND_BUDGET, FRAMES_PER_SECOND);
+    c8_triple_init(&emu.frames);
+    c8_input_init(&emu.input);
+    if(debug_path) {
+        emu.server = c8_debug_server_create(debug_path);
+        if(!emu.server) {
+            exit(1);
+        }
+    }
 
-    Chip8 *chip8 = chip8_init();
-    c8_load_rom(chip8, argv[1]);
+    char *state_path = c8_malloc(strlen(argv[optind]) + sizeof ".state");
+    sprintf(state_path, "%s.state", argv[optind]);
+    emu.state_path = state_path;
 
     SDL_Window *c8_window;
-    SDL_Renderer *c8_renderer;
-    SDL_Texture *c8_texture;
-    uint32_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
-    memset(pixels, 0, sizeof(pixels));
+    Display display = {0};
 
     if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
         fprintf(stderr, "Couldn't initialize SDL: %s\n", SDL_GetError());
@@ -30,71 +377,100 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    c8_renderer = SDL_CreateRenderer(c8_window, -1, 0);
-    if(!c8_renderer) {
+    // waiting on vsync only holds up this thread now, never the machine
+    display.renderer = SDL_CreateRenderer(c8_window, -1, SDL_RENDERER_PRESENTVSYNC);
+    if(!display.renderer) {
         fprintf(stderr, "Couldn't create SDL renderer: %s\n", SDL_GetError());
         exit(1);
     }
 
-    c8_texture =
-        SDL_CreateTexture(c8_renderer, SDL_PIXELFORMAT_ARGB8888,
+    display.texture =
+        SDL_CreateTexture(display.renderer, SDL_PIXELFORMAT_ARGB8888,
                           SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
-    if(!c8_renderer) {
-        fprintf(stderr, "Couldn't create SDL renderer: %s\n", SDL_GetError());
+    if(!display.texture) {
+        fprintf(stderr, "Couldn't create SDL texture: %s\n", SDL_GetError());
         exit(1);
     }
 
-    SDL_SetRenderDrawColor(c8_renderer, 0, 0, 0, 0);
-    SDL_RenderClear(c8_renderer);
-    SDL_RenderPresent(c8_renderer);
-
-    SDL_Event e;
-    bool quit = false;
-    struct timespec ts = {0, 1200 * 1000};
-
-    while(!quit) {
-        c8_exec_instruction(chip8, dbg);
-        chip8->delay_cycles++;
-        chip8->sound_cycles++;
+    SDL_SetRenderDrawColor(display.renderer, 0, 0, 0, 0);
+    SDL_RenderClear(display.renderer);
+    SDL_RenderPresent(display.renderer);
 
-        if(chip8->needs_draw) {
-            for(int i = 0; i < 2048; i++) {
-                uint8_t pixel = chip8->screen[i];
-                pixels[i] = (0x00FFFFFF * pixel) | 0xFF000000;
-            }
+    SDL_AudioDeviceID audio = 0;
+    if(audio_buffer > 0) {
+        emu.beeper = c8_beeper_create(AUDIO_RATE, audio_buffer);
+        SDL_AudioSpec want = {.freq = AUDIO_RATE,
+                              .format = AUDIO_S16SYS,
+                              .channels = 1,
+                              .samples = audio_buffer,
+                              .callback = play_audio,
+                              .userdata = emu.beeper};
 
-            SDL_UpdateTexture(c8_texture, NULL, pixels, SCREEN_WIDTH * sizeof(uint32_t));
-            SDL_RenderClear(c8_renderer);
-            SDL_RenderCopy(c8_renderer, c8_texture, NULL, NULL);
-            SDL_RenderPresent(c8_renderer);
-
-            chip8->needs_draw = false;
+        // SDL converts if the device wants something else
+        audio = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+        if(audio) {
+            SDL_PauseAudioDevice(audio, 0);
+        } else {
+            fprintf(stderr, "Couldn't open audio, running without sound: %s\n", SDL_GetError());
+            c8_beeper_destroy(emu.beeper);
+            emu.beeper = NULL;
         }
+    }
 
-        // makes up for the difference betweeen timer decr rate (60 Hz)
-        // and chip8 cpu clock speed (540 Hz)
-        c8_tick_timers(chip8);
+    c8_scheduler_init(&emu.sched, ipf, turbo);
+    pthread_t emu_thread;
+    if(pthread_create(&emu_thread, NULL, emulate, &emu) != 0) {
+        fprintf(stderr, "Couldn't start emulation thread\n");
+        exit(1);
+    }
 
+    SDL_Event e;
+    bool quit = false;
+    uint32_t last_present = 0;
+
+    while(!quit) {
         while(SDL_PollEvent(&e)) {
             if(e.type == SDL_KEYDOWN) {
+                // neither the input log nor the trace can describe a jump in
+                // time, so recording sessions only go forwards
                 switch(e.key.keysym.sym) {
                     case SDLK_ESCAPE:
                         quit = true;
                         break;
+                    case SDLK_F5:
+                        __atomic_fetch_or(&emu.commands, CMD_SAVE, __ATOMIC_RELEASE);
+                        break;
+                    case SDLK_F9:
+                        if(!emu.rec && !emu.trace) {
+                            __atomic_fetch_or(&emu.commands, CMD_LOAD, __ATOMIC_RELEASE);
+                        }
+                        break;
+                    case SDLK_F2:
+                        if(!emu.rec && !emu.trace) {
+                            __atomic_fetch_or(&emu.commands, CMD_RESTART, __ATOMIC_RELEASE);
+                        }
+                        break;
+                    case SDLK_BACKSPACE:
+                        __atomic_store_n(&emu.rewinding, !emu.rec && !emu.trace,
+                                         __ATOMIC_RELAXED);
+                        break;
                 }
+            }
 
-                for(uint32_t i = 0; i < NUM_KEYS; i++) {
-                    if(e.key.keysym.sym == KEYMAP[i]) {
-                        chip8->keypad[i] = true;
-                        INFO("KEY PRESSED %s", SDL_GetKeyName(e.key.keysym.sym));
-                    }
-                }
+            if(e.type == SDL_KEYUP && e.key.keysym.sym == SDLK_BACKSPACE) {
+                __atomic_store_n(&emu.rewinding, false, __ATOMIC_RELAXED);
             }
 
-            if(e.type == SDL_KEYUP) {
-                for(uint32_t i = 0; i < NUM_KEYS; i++) {
-                    if(e.key.keysym.sym == KEYMAP[i]) {
-                        chip8->keypad[i] = false;
+            // held keys repeat, but the machine only cares about the edges
+            if((e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) && !e.key.repeat) {
+                uint8_t key = SCANCODE_KEYS[e.key.keysym.scancode];
+                bool pressed = e.type == SDL_KEYDOWN;
+
+                // the queue only fills up if the machine stops taking events
+                if(key && c8_input_push(&emu.input, SDL_GetPerformanceCounter(), key - 1,
+                                        pressed)) {
+                    if(pressed) {
+                        INFO("KEY PRESSED %s", SDL_GetKeyName(e.key.keysym.sym));
                     }
                 }
             }
@@ -104,14 +480,71 @@ int main(int argc, char **argv) {
             }
         }
 
-        nanosleep(&ts, NULL);
+        // without vsync this keeps the thread from spinning, with it a no-op
+        const C8Frame *frame = NULL;
+        if(SDL_GetTicks() - last_present >= PRESENT_INTERVAL_MS) {
+            frame = c8_triple_acquire(&emu.frames);
+        }
+        if(frame) {
+            present(&display, frame);
+            last_present = SDL_GetTicks();
+        } else {
+            SDL_Delay(1);
+        }
+    }
+
+    __atomic_store_n(&emu.quit, true, __ATOMIC_RELEASE);
+    pthread_join(emu_thread, NULL);
+    if(audio) {
+        SDL_CloseAudioDevice(audio);
+    }
+
+    if(timing) {
+        double tick_us = 1e6 / SDL_GetPerformanceFrequency();
+        fprintf(stderr, "emulation: %llu frames, %.1f us busy per frame\n",
+                (unsigned long long)emu.frames_run,
+                emu.frames_run ? emu.busy_ticks * tick_us / emu.frames_run : 0.0);
+        fprintf(stderr, "render:    %llu presents, %.1f us per present\n",
+                (unsigned long long)display.presents,
+                display.presents ? display.present_ticks * tick_us / display.presents : 0.0);
+    }
+
+    if(latency) {
+        double tick_ms = 1e3 / SDL_GetPerformanceFrequency();
+        fprintf(stderr, "input:     %llu key events presented, %.2f ms mean, %.2f ms worst\n",
+                (unsigned long long)display.inputs,
+                display.inputs ? display.input_ticks * tick_ms / display.inputs : 0.0,
+                display.input_ticks_max * tick_ms);
+    }
+
+    if(emu.rec) {
+        c8_recorder_close(emu.rec, emu.chip8->cycles);
+    }
+
+    if(emu.server) {
+        c8_debug_server_destroy(emu.server, emu.engine);
+    }
+
+    if(emu.trace) {
+        c8_trace_writer_close(emu.trace);
+    }
+
+    if(profile_path) {
+        c8_profile_export(c8_engine_profile(emu.engine), profile_path);
     }
 
     SDL_DestroyWindow(c8_window);
-    SDL_DestroyRenderer(c8_renderer);
-    SDL_DestroyTexture(c8_texture);
+    SDL_DestroyRenderer(display.renderer);
+    SDL_DestroyTexture(display.texture);
 
-    free(chip8);
+    c8_rewind_destroy(emu.rw);
+    if(emu.beeper) {
+        c8_beeper_destroy(emu.beeper);
+    }
+    free(state_path);
+    c8_engine_destroy(emu.engine);
+    free(emu.chip8);
+    free(emu.loaded);
 
     return 0;
 }
@@ -0,0 +1,266 @@
+#include "profile.h"
+
+#define C8_OP_NAME(name) #name,
+static const char *OP_CLASS_NAMES[] = {C8_OP_CLASSES(C8_OP_NAME)};
+#undef C8_OP_NAME
+
+C8Profile *c8_profile_create(void) {
+    return c8_calloc(1, sizeof(C8Profile));
+}
+
+void c8_profile_destroy(C8Profile *prof) {
+    if(!prof) {
+        return;
+    }
+    free(prof->frames);
+    free(prof);
+}
+
+C8OpClass c8_op_class(uint16_t opcode) {
+    switch(opcode & 0xF000) {
+        case 0x0000:
+            return opcode == 0x00E0 ? C8_OP_CLS : opcode == 0x00EE ? C8_OP_RET : C8_OP_SYS;
+        case 0x1000:
+            return C8_OP_JP;
+        case 0x2000:
+            return C8_OP_CALL;
+        case 0x3000:
+            return C8_OP_SE_VX_NN;
+        case 0x4000:
+            return C8_OP_SNE_VX_NN;
+        case 0x5000:
+            return op_N(opcode) == 0 ? C8_OP_SE_VX_VY : C8_OP_UNKNOWN;
+        case 0x6000:
+            return C8_OP_LD_VX_NN;
+        case 0x7000:
+            return C8_OP_ADD_VX_NN;
+        case 0x8000:
+            switch(op_N(opcode)) {
+                case 0x0:
+                    return C8_OP_LD_VX_VY;
+                case 0x1:
+                    return C8_OP_OR;
+                case 0x2:
+                    return C8_OP_AND;
+                case 0x3:
+                    return C8_OP_XOR;
+                case 0x4:
+                    return C8_OP_ADD_VX_VY;
+                case 0x5:
+                    return C8_OP_SUB;
+                case 0x6:
+                    return C8_OP_SHR;
+                case 0x7:
+                    return C8_OP_SUBN;
+                case 0xE:
+                    return C8_OP_SHL;
+                default:
+                    return C8_OP_UNKNOWN;
+            }
+        case 0x9000:
+            return op_N(opcode) == 0 ? C8_OP_SNE_VX_VY : C8_OP_UNKNOWN;
+        case 0xA000:
+            return C8_OP_LD_I;
+        case 0xB000:
+            return C8_OP_JP_V0;
+        case 0xC000:
+            return C8_OP_RND;
+        case 0xD000:
+            return C8_OP_DRW;
+        case 0xE000:
+            switch(op_NN(opcode)) {
+                case 0x9E:
+                    return C8_OP_SKP;
+                case 0xA1:
+                    return C8_OP_SKNP;
+                default:
+                    return C8_OP_UNKNOWN;
+            }
+        default:
+            switch(op_NN(opcode)) {
+                case 0x07:
+                    return C8_OP_LD_VX_DT;
+                case 0x0A:
+                    return C8_OP_LD_VX_K;
+                case 0x15:
+                    return C8_OP_LD_DT;
+                case 0x18:
+                    return C8_OP_LD_ST;
+                case 0x1E:
+                    return C8_OP_ADD_I;
+                case 0x29:
+                    return C8_OP_LD_F;
+                case 0x33:
+                    return C8_OP_LD_B;
+                case 0x55:
+                    return C8_OP_LD_MEM_VX;
+                case 0x65:
+                    return C8_OP_LD_VX_MEM;
+                default:
+                    return C8_OP_UNKNOWN;
+            }
+    }
+}
+
+const char *c8_op_class_name(C8OpClass op) {
+    return OP_CLASS_NAMES[op];
+}
+
+void c8_profile_exec(C8Profile *prof, Chip8 *chip8, bool dbg) {
+    uint16_t pc = chip8->pc;
+    uint16_t opcode = c8_fetch(chip8, pc);
+    C8OpClass op = c8_op_class(opcode);
+
+    prof->instructions++;
+    prof->ops[op]++;
+    prof->pcs[pc]++;
+
+    c8_exec_instruction(chip8, dbg);
+
+    switch(op) {
+        case C8_OP_CALL:
+            prof->calls[op_NNN(opcode)]++;
+            if(prof->depth < STACK_SIZE) {
+                prof->call_target[prof->depth] = op_NNN(opcode);
+                prof->call_start[prof->depth] = prof->instructions;
+            }
+            prof->depth++;
+            break;
+        case C8_OP_RET:
+            // a return without a call has nothing to close
+            if(prof->depth > 0 && --prof->depth < STACK_SIZE) {
+                prof->call_instructions[prof->call_target[prof->depth]] +=
+                    prof->instructions - prof->call_start[prof->depth];
+            }
+            break;
+        case C8_OP_DRW:
+            prof->current.draws++;
+            prof->current.collisions += chip8->V[0xF];
+            break;
+        default:
+            break;
+    }
+}
+
+void c8_profile_end_frame(C8Profile *prof) {
+    if(prof->num_frames == prof->frames_cap) {
+        prof->frames_cap = prof->frames_cap ? prof->frames_cap * 2 : 1024;
+        prof->frames = c8_realloc(prof->frames, prof->frames_cap * sizeof *prof->frames);
+    }
+
+    prof->frames[prof->num_frames++] = prof->current;
+    prof->current = (C8FrameProfile){0, 0};
+}
+
+// Instructions spent in a subroutine, counting the calls still running
+static uint64_t call_instructions(const C8Profile *prof, uint16_t addr) {
+    uint64_t total = prof->call_instructions[addr];
+    uint32_t depth = prof->depth < STACK_SIZE ? prof->depth : STACK_SIZE;
+
+    for(uint32_t i = 0; i < depth; i++) {
+        if(prof->call_target[i] == addr) {
+            total += prof->instructions - prof->call_start[i];
+        }
+    }
+
+    return total;
+}
+
+static void write_json(const C8Profile *prof, FILE *out) {
+    const char *sep = "";
+
+    fprintf(out, "{\n  \"instructions\": %llu,\n  \"opcodes\": {",
+            (unsigned long long)prof->instructions);
+    for(int op = 0; op < C8_NUM_OP_CLASSES; op++) {
+        if(prof->ops[op]) {
+            fprintf(out, "%s\n    \"%s\": %llu", sep, OP_CLASS_NAMES[op],
+                    (unsigned long long)prof->ops[op]);
+            sep = ",";
+        }
+    }
+
+    fprintf(out, "\n  },\n  \"pcs\": [");
+    sep = "";
+    for(int pc = 0; pc < MEM_SIZE; pc++) {
+        if(prof->pcs[pc]) {
+            fprintf(out, "%s\n    {\"pc\": %d, \"count\": %llu}", sep, pc,
+                    (unsigned long long)prof->pcs[pc]);
+            sep = ",";
+        }
+    }
+
+    fprintf(out, "\n  ],\n  \"subroutines\": [");
+    sep = "";
+    for(int addr = 0; addr < CODE_MEM_SIZE; addr++) {
+        if(prof->calls[addr]) {
+            fprintf(out, "%s\n    {\"address\": %d, \"calls\": %llu, \"instructions\": %llu}",
+                    sep, addr, (unsigned long long)prof->calls[addr],
+                    (unsigned long long)call_instructions(prof, addr));
+            sep = ",";
+        }
+    }
+
+    fprintf(out, "\n  ],\n  \"frames\": [");
+    sep = "";
+    for(size_t i = 0; i < prof->num_frames; i++) {
+        fprintf(out, "%s\n    {\"draws\": %u, \"collisions\": %u}", sep, prof->frames[i].draws,
+                prof->frames[i].collisions);
+        sep = ",";
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+// One table for everything, the first column says which part a row is from
+static void write_csv(const C8Profile *prof, FILE *out) {
+    fprintf(out, "section,key,count,extra\n");
+    fprintf(out, "total,instructions,%llu,\n", (unsigned long long)prof->instructions);
+
+    for(int op = 0; op < C8_NUM_OP_CLASSES; op++) {
+        if(prof->ops[op]) {
+            fprintf(out, "opcode,%s,%llu,\n", OP_CLASS_NAMES[op],
+                    (unsigned long long)prof->ops[op]);
+        }
+    }
+
+    for(int pc = 0; pc < MEM_SIZE; pc++) {
+        if(prof->pcs[pc]) {
+            fprintf(out, "pc,0x%03X,%llu,\n", pc, (unsigned long long)prof->pcs[pc]);
+        }
+    }
+
+    // extra is the instructions spent inside, nested calls included
+    for(int addr = 0; addr < CODE_MEM_SIZE; addr++) {
+        if(prof->calls[addr]) {
+            fprintf(out, "subroutine,0x%03X,%llu,%llu\n", addr,
+                    (unsigned long long)prof->calls[addr],
+                    (unsigned long long)call_instructions(prof, addr));
+        }
+    }
+
+    // count is draws, extra is collisions
+    for(size_t i = 0; i < prof->num_frames; i++) {
+        fprintf(out, "frame,%zu,%u,%u\n", i, prof->frames[i].draws,
+                prof->frames[i].collisions);
+    }
+}
+
+bool c8_profile_export(const C8Profile *prof, const char *path) {
+    FILE *out = fopen(path, "w");
+    if(!out) {
+        fprintf(stderr, "Couldn't open profile output %s\n", path);
+        return false;
+    }
+
+    size_t len = strlen(path);
+    if(len >= 5 && strcmp(path + len - 5, ".json") == 0) {
+        write_json(prof, out);
+    } else {
+        write_csv(prof, out);
+    }
+
+    if(fclose(out) != 0) {
+        fprintf(stderr, "Couldn't write profile output %s\n", path);
+        return false;
+    }
+    return true;
+}
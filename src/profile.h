@@ -0,0 +1,61 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "chip8.h"
+
+// Execution profile gathered by the profile engine, which wraps the reference
+// interpreter. The engine only exists in builds made with C8_PROFILE defined
+// (make PROFILE=1), the others don't pay for it at all.
+
+// one per instruction as the ROM wrote it, quirks of the interpreter aside
+#define C8_OP_CLASSES(X)                                                                 \
+    X(CLS) X(RET) X(SYS) X(JP) X(CALL) X(SE_VX_NN) X(SNE_VX_NN) X(SE_VX_VY) X(LD_VX_NN)   \
+    X(ADD_VX_NN) X(LD_VX_VY) X(OR) X(AND) X(XOR) X(ADD_VX_VY) X(SUB) X(SHR) X(SUBN)       \
+    X(SHL) X(SNE_VX_VY) X(LD_I) X(JP_V0) X(RND) X(DRW) X(SKP) X(SKNP) X(LD_VX_DT)        \
+    X(LD_VX_K) X(LD_DT) X(LD_ST) X(ADD_I) X(LD_F) X(LD_B) X(LD_MEM_VX) X(LD_VX_MEM)      \
+    X(UNKNOWN)
+
+#define C8_OP_ENUM(name) C8_OP_##name,
+typedef enum C8OpClass { C8_OP_CLASSES(C8_OP_ENUM) C8_NUM_OP_CLASSES } C8OpClass;
+#undef C8_OP_ENUM
+
+typedef struct C8FrameProfile {
+    uint32_t draws;
+    uint32_t collisions;
+} C8FrameProfile;
+
+typedef struct C8Profile {
+    uint64_t instructions;
+    uint64_t ops[C8_NUM_OP_CLASSES];
+    uint64_t pcs[MEM_SIZE];
+
+    // per subroutine entry point, instructions include nested calls
+    uint64_t calls[CODE_MEM_SIZE];
+    uint64_t call_instructions[CODE_MEM_SIZE];
+
+    // the calls the ROM is inside of right now, deeper ones aren't tracked
+    uint16_t call_target[STACK_SIZE];
+    uint64_t call_start[STACK_SIZE];
+    uint32_t depth;
+
+    C8FrameProfile current;
+    C8FrameProfile *frames;
+    size_t num_frames;
+    size_t frames_cap;
+} C8Profile;
+
+C8Profile *c8_profile_create(void);
+void c8_profile_destroy(C8Profile *prof);
+
+C8OpClass c8_op_class(uint16_t opcode);
+const char *c8_op_class_name(C8OpClass op);
+
+// c8_exec_instruction with everything it does counted
+void c8_profile_exec(C8Profile *prof, Chip8 *chip8, bool dbg);
+// Closes the frame the instructions so far belong to
+void c8_profile_end_frame(C8Profile *prof);
+
+// JSON when path ends in .json, CSV otherwise. Returns false on I/O errors.
+bool c8_profile_export(const C8Profile *prof, const char *path);
+
+#endif
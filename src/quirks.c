@@ -0,0 +1,116 @@
+#include "chip8.h"
+
+#define C8_QUIRK_ROW(id, name, shift_vy, mem_i, jump_vx, wrap, vf_reset, ext)            \
+    [C8_QUIRKS_##id] = {shift_vy, mem_i, jump_vx, wrap, vf_reset, ext},
+static const C8Quirks PROFILES[] = {C8_QUIRK_PROFILES(C8_QUIRK_ROW)};
+#undef C8_QUIRK_ROW
+
+#define C8_QUIRK_NAME(id, name, ...) [C8_QUIRKS_##id] = #name,
+static const char *PROFILE_NAMES[] = {C8_QUIRK_PROFILES(C8_QUIRK_NAME)};
+#undef C8_QUIRK_NAME
+
+typedef struct KnownRom {
+    uint64_t hash; // c8_hash of the ROM file
+    uint8_t profile;
+} KnownRom;
+
+// Sorted by hash. Only ROMs whose target is known for sure belong here,
+// everything else runs with the default profile.
+static const KnownRom KNOWN_ROMS[] = {
+    {0x64e45391ba0238a1, C8_QUIRKS_COSMAC}, // IBM Logo
+};
+
+const C8Quirks *c8_quirks(C8QuirkProfile profile) {
+    return &PROFILES[profile];
+}
+
+const char *c8_quirks_name(C8QuirkProfile profile) {
+    return PROFILE_NAMES[profile];
+}
+
+bool c8_quirks_from_name(const char *name, C8QuirkProfile *profile) {
+    for(int i = 0; i < C8_NUM_QUIRK_PROFILES; i++) {
+        if(strcmp(name, PROFILE_NAMES[i]) == 0) {
+            *profile = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+C8QuirkProfile c8_quirks_for_rom(const uint8_t *rom, size_t len) {
+    uint64_t hash = c8_hash(rom, len);
+    size_t lo = 0;
+    size_t hi = sizeof KNOWN_ROMS / sizeof *KNOWN_ROMS;
+
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(KNOWN_ROMS[mid].hash == hash) {
+            return KNOWN_ROMS[mid].profile;
+        }
+        if(KNOWN_ROMS[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return C8_QUIRKS_MODERN;
+}
+
+bool c8_quirks_affect(const C8Quirks *quirks, uint16_t opcode) {
+    bool xo = quirks->ext == C8_EXT_XOCHIP;
+
+    switch(opcode & 0xF000) {
+        // 00CN, 00DN and 00FB to 00FF, no-ops on plain CHIP-8
+        case 0x0000:
+            if((opcode & 0xFFF0) == 0x00C0 || (opcode >= 0x00FB && opcode <= 0x00FF)) {
+                return quirks->ext != C8_EXT_NONE;
+            }
+            return xo && (opcode & 0xFFF0) == 0x00D0;
+        // XO-CHIP skips step over all four bytes of F000 NNNN
+        case 0x3000:
+        case 0x4000:
+        case 0x9000:
+        case 0xE000:
+            return xo;
+        // and 5XY2/5XY3 store and load a range of registers
+        case 0x5000:
+            return xo;
+        case 0x8000:
+            switch(op_N(opcode)) {
+                case 0x1:
+                case 0x2:
+                case 0x3:
+                    return quirks->vf_reset;
+                case 0x6:
+                case 0xE:
+                    return quirks->shift_vy;
+                default:
+                    return false;
+            }
+        case 0xB000:
+            return quirks->jump_vx;
+        // resolution, 16x16 sprites and planes
+        case 0xD000:
+            return quirks->wrap || quirks->ext != C8_EXT_NONE;
+        case 0xF000:
+            switch(op_NN(opcode)) {
+                case 0x55:
+                case 0x65:
+                    return quirks->mem_i != C8_MEM_KEEP_I;
+                case 0x30:
+                case 0x75:
+                case 0x85:
+                    return quirks->ext != C8_EXT_NONE;
+                // F000 NNNN and FN01
+                case 0x00:
+                case 0x01:
+                    return xo;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
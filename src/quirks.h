@@ -0,0 +1,59 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// What FX55 does to I afterwards
+typedef enum C8MemQuirk {
+    C8_MEM_KEEP_I,   // leaves it alone
+    C8_MEM_I_PLUS_X, // adds X
+    C8_MEM_I_PLUS_X1 // adds X + 1, pointing past the last register
+} C8MemQuirk;
+
+// Which machine's extra instructions there are on top of CHIP-8's
+typedef enum C8Extension {
+    C8_EXT_NONE,
+    C8_EXT_SCHIP,  // 128x64 hi-res, 16x16 sprites, scrolling, the big font
+    C8_EXT_XOCHIP, // SUPER-CHIP's plus a second plane and 64k of memory
+} C8Extension;
+
+// Behaviour that ROMs written for different interpreters disagree on
+typedef struct C8Quirks {
+    bool shift_vy; // 8XY6/8XYE shift VY into VX rather than VX in place
+    uint8_t mem_i; // C8MemQuirk
+    bool jump_vx;  // BXNN jumps to XNN + VX rather than NNN + V0
+    bool wrap;     // sprites wrap around the edges rather than being clipped
+    bool vf_reset; // 8XY1/8XY2/8XY3 clear VF
+    uint8_t ext;   // C8Extension
+} C8Quirks;
+
+// One row per profile, the first is the default. Each one gets its own copy
+// of the reference interpreter with its quirks folded in as constants.
+//   profile    name         shift_vy mem_i             jump_vx wrap   vf_reset ext
+#define C8_QUIRK_PROFILES(X)                                                            \
+    X(MODERN,    modern,    false, C8_MEM_KEEP_I,    false, false, false, C8_EXT_NONE)  \
+    X(COSMAC,    cosmac,    true,  C8_MEM_I_PLUS_X1, false, false, true,  C8_EXT_NONE)  \
+    X(CHIP48,    chip48,    false, C8_MEM_I_PLUS_X,  true,  false, false, C8_EXT_NONE)  \
+    X(SUPERCHIP, superchip, false, C8_MEM_KEEP_I,    true,  false, false, C8_EXT_SCHIP) \
+    X(XOCHIP,    xochip,    true,  C8_MEM_I_PLUS_X1, false, true,  false, C8_EXT_XOCHIP)
+
+#define C8_QUIRK_ENUM(id, ...) C8_QUIRKS_##id,
+typedef enum C8QuirkProfile {
+    C8_QUIRK_PROFILES(C8_QUIRK_ENUM) C8_NUM_QUIRK_PROFILES
+} C8QuirkProfile;
+#undef C8_QUIRK_ENUM
+
+const C8Quirks *c8_quirks(C8QuirkProfile profile);
+const char *c8_quirks_name(C8QuirkProfile profile);
+bool c8_quirks_from_name(const char *name, C8QuirkProfile *profile);
+
+// The profile a ROM is known to want, by its contents, or the default
+C8QuirkProfile c8_quirks_for_rom(const uint8_t *rom, size_t len);
+
+// Whether the instruction does something else under these quirks than it
+// does under the default ones. Engines leave those to the reference.
+bool c8_quirks_affect(const C8Quirks *quirks, uint16_t opcode);
+
+#endif
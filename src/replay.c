@@ -0,0 +1,208 @@
+#include "replay.h"
+
+#define LOG_MAGIC "C8IL"
+#define HEADER_SIZE 28
+#define END_MARKER 0xFF
+
+struct C8Recorder {
+    FILE *file;
+    uint64_t last_cycle;
+};
+
+struct C8Replay {
+    uint8_t *data;
+    size_t len;
+    uint32_t ipf;
+    uint8_t quirks;
+    uint64_t seed;
+    uint64_t rom_hash;
+};
+
+// what the ROM looks like once loaded, so the log doesn't need the file
+static uint64_t hash_program(const Chip8 *chip8) {
+    return c8_hash(chip8->ram + PROG_START_ADDR, PROG_REGION_SIZE);
+}
+
+static void put_le(uint8_t *buf, uint64_t v, size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        buf[i] = v >> (8 * i);
+    }
+}
+
+static uint64_t get_le(const uint8_t *buf, size_t n) {
+    uint64_t v = 0;
+    for(size_t i = 0; i < n; i++) {
+        v |= (uint64_t)buf[i] << (8 * i);
+    }
+    return v;
+}
+
+static void write_event(C8Recorder *rec, uint64_t cycle, uint8_t code) {
+    uint8_t buf[11];
+    size_t len = 0;
+    uint64_t delta = cycle - rec->last_cycle;
+
+    do {
+        buf[len++] = (delta & 0x7F) | (delta > 0x7F ? 0x80 : 0);
+        delta >>= 7;
+    } while(delta);
+    buf[len++] = code;
+
+    fwrite(buf, 1, len, rec->file);
+    rec->last_cycle = cycle;
+}
+
+C8Recorder *c8_recorder_create(const char *path, const Chip8 *chip8, uint32_t ipf) {
+    FILE *file = fopen(path, "wb");
+    if(!file) {
+        fprintf(stderr, "Couldn't open input log %s\n", path);
+        exit(1);
+    }
+
+    uint8_t header[HEADER_SIZE] = LOG_MAGIC;
+    header[4] = C8_LOG_VERSION;
+    // logs from before profiles existed have 0 here, which is the default
+    header[5] = chip8->quirks;
+    put_le(header + 8, ipf, 4);
+    put_le(header + 12, chip8->rng, 8);
+    put_le(header + 20, hash_program(chip8), 8);
+    fwrite(header, 1, sizeof header, file);
+
+    C8Recorder *rec = c8_calloc(1, sizeof *rec);
+    rec->file = file;
+    rec->last_cycle = chip8->cycles;
+
+    return rec;
+}
+
+void c8_recorder_key(C8Recorder *rec, uint64_t cycle, uint8_t key, bool pressed) {
+    write_event(rec, cycle, key | pressed << 4);
+}
+
+void c8_recorder_close(C8Recorder *rec, uint64_t cycle) {
+    write_event(rec, cycle, END_MARKER);
+
+    if(fclose(rec->file) != 0) {
+        fprintf(stderr, "Couldn't write input log\n");
+    }
+    free(rec);
+}
+
+C8Replay *c8_replay_open(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if(!file) {
+        fprintf(stderr, "Couldn't open input log %s\n", path);
+        exit(1);
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = c8_malloc(len ? len : 1);
+    if(fread(data, 1, len, file) != len) {
+        fprintf(stderr, "Couldn't read input log\n");
+        exit(1);
+    }
+    fclose(file);
+
+    if(len < HEADER_SIZE || memcmp(data, LOG_MAGIC, 4) != 0) {
+        fprintf(stderr, "%s is not an input log\n", path);
+        exit(1);
+    }
+    if(data[4] != C8_LOG_VERSION) {
+        fprintf(stderr, "Unsupported input log version %d\n", data[4]);
+        exit(1);
+    }
+
+    C8Replay *replay = c8_calloc(1, sizeof *replay);
+    replay->data = data;
+    replay->len = len;
+    replay->ipf = get_le(data + 8, 4);
+    replay->quirks = data[5];
+    replay->seed = get_le(data + 12, 8);
+    replay->rom_hash = get_le(data + 20, 8);
+
+    if(replay->ipf == 0) {
+        fprintf(stderr, "Input log has no instructions per frame\n");
+        exit(1);
+    }
+    if(replay->quirks >= C8_NUM_QUIRK_PROFILES) {
+        fprintf(stderr, "Input log has an unknown quirk profile %d\n", replay->quirks);
+        exit(1);
+    }
+
+    return replay;
+}
+
+void c8_replay_close(C8Replay *replay) {
+    free(replay->data);
+    free(replay);
+}
+
+uint32_t c8_replay_ipf(const C8Replay *replay) {
+    return replay->ipf;
+}
+
+// Runs up to cycle ending a frame on every frame boundary on the way, the
+// same as the live loop does with c8_engine_run_frame
+static void run_until(C8Engine *engine, Chip8 *chip8, uint64_t cycle, uint32_t ipf) {
+    // finish the frame the last key landed in, then whole frames
+    if(chip8->cycles % ipf != 0 && chip8->cycles < cycle) {
+        uint64_t frame_left = ipf - chip8->cycles % ipf;
+        uint64_t n = cycle - chip8->cycles;
+
+        c8_engine_run(engine, n < frame_left ? n : frame_left);
+        if(chip8->cycles % ipf == 0) {
+            c8_engine_end_frame(engine);
+        }
+    }
+    if(chip8->cycles < cycle) {
+        c8_engine_run_frames(engine, cycle - chip8->cycles, ipf);
+    }
+}
+
+uint64_t c8_replay_run(C8Replay *replay, C8Engine *engine, Chip8 *chip8) {
+    if(hash_program(chip8) != replay->rom_hash) {
+        fprintf(stderr, "Input log was recorded with a different ROM\n");
+        exit(1);
+    }
+
+    c8_seed(chip8, replay->seed);
+    chip8->quirks = replay->quirks;
+    uint64_t start = chip8->cycles;
+    uint64_t cycle = start;
+    size_t pos = HEADER_SIZE;
+
+    for(;;) {
+        uint64_t delta = 0;
+        uint8_t byte;
+        uint8_t shift = 0;
+
+        do {
+            if(pos >= replay->len || shift > 63) {
+                fprintf(stderr, "Input log is truncated\n");
+                exit(1);
+            }
+            byte = replay->data[pos++];
+            delta |= (uint64_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while(byte & 0x80);
+
+        if(pos >= replay->len) {
+            fprintf(stderr, "Input log is truncated\n");
+            exit(1);
+        }
+        uint8_t code = replay->data[pos++];
+
+        cycle += delta;
+        run_until(engine, chip8, cycle, replay->ipf);
+
+        if(code == END_MARKER) {
+            break;
+        }
+        chip8->keypad[code & 0x0F] = code & 0x10;
+    }
+
+    return chip8->cycles - start;
+}
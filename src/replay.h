@@ -0,0 +1,34 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "engine.h"
+
+// Input logs record keypad transitions against the instruction count, together
+// with everything else a session depends on (rng seed, ROM hash, instructions
+// per frame, quirk profile), so they replay bit for bit on any engine.
+//
+// File layout, little endian:
+//   "C8IL" version:u8 quirks:u8 pad:u8[2] ipf:u32 seed:u64 rom_hash:u64
+//   events: cycle delta as a LEB128 varint, then key | pressed << 4
+//   end:    cycle delta varint, then 0xFF
+// bumped whenever a change to the machine makes an old log play out differently
+#define C8_LOG_VERSION 3
+
+typedef struct C8Recorder C8Recorder;
+typedef struct C8Replay C8Replay;
+
+// Must be created before the machine runs its first instruction
+C8Recorder *c8_recorder_create(const char *path, const Chip8 *chip8, uint32_t ipf);
+void c8_recorder_key(C8Recorder *rec, uint64_t cycle, uint8_t key, bool pressed);
+// Writes the end of the session and frees the recorder
+void c8_recorder_close(C8Recorder *rec, uint64_t cycle);
+
+C8Replay *c8_replay_open(const char *path);
+void c8_replay_close(C8Replay *replay);
+uint32_t c8_replay_ipf(const C8Replay *replay);
+
+// Runs the whole session from power on, frames and timer ticks included, on a
+// machine holding the recorded ROM. Returns the instructions executed.
+uint64_t c8_replay_run(C8Replay *replay, C8Engine *engine, Chip8 *chip8);
+
+#endif
@@ -0,0 +1,304 @@
+#include "rewind.h"
+
+// Chip8 holds uint64_t fields, so its size is always a whole number of words
+#define WORDS (sizeof(Chip8) / sizeof(uint64_t))
+#define RAM_WORDS (MEM_SIZE / sizeof(uint64_t))
+// everything in Chip8 after ram
+#define TAIL_SIZE (sizeof(Chip8) - MEM_SIZE)
+// past half a keyframe a delta saves too little to be worth it
+#define MAX_DELTA_SIZE (sizeof(Chip8) / 2)
+#define NO_RECORD SIZE_MAX
+
+// Records sit back to back in the ring, each one a header and its payload.
+// A keyframe's payload is the machine with ram cut short where the quirk
+// profile stops reaching, a delta's is a list of runs over the same words:
+// words to skip:u16, words that follow:u16, then those words.
+typedef struct Record {
+    size_t prev;     // the next older record
+    size_t keyframe; // the keyframe a delta applies to, itself for keyframes
+    uint32_t size;   // payload bytes
+    uint32_t index;  // frames since the keyframe
+} Record;
+
+struct C8Rewind {
+    uint8_t *buf;
+    size_t capacity;
+    uint32_t interval;
+
+    // live records run from head to tail, unless tail <= head in which case
+    // they run from head to wrap and carry on from the start of buf
+    size_t head;
+    size_t tail;
+    size_t wrap;
+    size_t newest;
+    size_t count;
+
+    // the newest keyframe, kept unpacked to diff every frame against
+    bool have_key;
+    Chip8 key;
+    size_t key_offset;
+    uint32_t since_key;
+
+    uint8_t delta[MAX_DELTA_SIZE];
+};
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+static Record *record_at(const C8Rewind *rw, size_t offset) {
+    return (Record *)(rw->buf + offset);
+}
+
+static uint8_t *payload_at(const C8Rewind *rw, size_t offset) {
+    return rw->buf + offset + sizeof(Record);
+}
+
+static size_t record_span(const Record *rec) {
+    return sizeof(Record) + align8(rec->size);
+}
+
+static void clear(C8Rewind *rw) {
+    rw->head = rw->tail = 0;
+    rw->wrap = rw->capacity;
+    rw->newest = NO_RECORD;
+    rw->count = 0;
+    rw->have_key = false;
+}
+
+C8Rewind *c8_rewind_create(size_t budget, uint32_t interval) {
+    // room for a few keyframes at the very least
+    size_t min_budget = 4 * (sizeof(Record) + sizeof(Chip8));
+
+    C8Rewind *rw = c8_calloc(1, sizeof *rw);
+    rw->capacity = align8(budget > min_budget ? budget : min_budget);
+    rw->buf = c8_malloc(rw->capacity);
+    rw->interval = interval ? interval : 1;
+    clear(rw);
+
+    return rw;
+}
+
+void c8_rewind_destroy(C8Rewind *rw) {
+    free(rw->buf);
+    free(rw);
+}
+
+// Drops the oldest keyframe and every delta that depends on it
+static void evict_segment(C8Rewind *rw) {
+    do {
+        size_t next = rw->head + record_span(record_at(rw, rw->head));
+        if(--rw->count == 0) {
+            clear(rw);
+            return;
+        }
+        if(next >= rw->wrap) {
+            // the records at the end of buf are gone, the rest start at 0
+            next = 0;
+            rw->wrap = rw->capacity;
+        }
+        rw->head = next;
+    } while(record_at(rw, rw->head)->index != 0);
+}
+
+// Makes room for need bytes, evicting as it goes, and returns where they are
+static size_t reserve(C8Rewind *rw, size_t need) {
+    for(;;) {
+        if(rw->count == 0) {
+            return 0;
+        }
+
+        if(rw->head < rw->tail) {
+            if(rw->tail + need <= rw->capacity) {
+                return rw->tail;
+            }
+            if(rw->head >= need) {
+                rw->wrap = rw->tail;
+                return 0;
+            }
+        } else if(rw->tail + need <= rw->head) {
+            return rw->tail;
+        }
+
+        evict_segment(rw);
+    }
+}
+
+static void commit(C8Rewind *rw, size_t at, size_t size, uint32_t index) {
+    Record *rec = record_at(rw, at);
+    rec->prev = rw->newest;
+    rec->keyframe = index == 0 ? at : rw->key_offset;
+    rec->size = size;
+    rec->index = index;
+
+    rw->tail = at + record_span(rec);
+    rw->newest = at;
+    rw->count++;
+}
+
+static size_t key_size(const Chip8 *chip8) {
+    return c8_quirks_mem(c8_quirks(chip8->quirks)) + TAIL_SIZE;
+}
+
+static void pack_key(uint8_t *out, const Chip8 *chip8) {
+    size_t mem = c8_quirks_mem(c8_quirks(chip8->quirks));
+    memcpy(out, chip8->ram, mem);
+    memcpy(out + mem, (const uint8_t *)chip8 + MEM_SIZE, TAIL_SIZE);
+}
+
+// Ram past what the profile reaches is left as it was
+static void unpack_key(Chip8 *state, const uint8_t *payload, size_t size) {
+    size_t mem = size - TAIL_SIZE;
+    memcpy(state->ram, payload, mem);
+    memcpy((uint8_t *)state + MEM_SIZE, payload + mem, TAIL_SIZE);
+}
+
+// Returns the encoded size, or 0 when the delta would be too big to bother.
+// key and state have to share a quirk profile.
+static size_t encode_delta(const Chip8 *key, const Chip8 *state, uint8_t *out) {
+    const uint8_t *a = (const uint8_t *)key;
+    const uint8_t *b = (const uint8_t *)state;
+    // ram the profile can't reach is neither kept nor compared
+    size_t gap = c8_quirks_mem(c8_quirks(key->quirks)) / sizeof(uint64_t);
+    size_t limit = key_size(key) / 2;
+    size_t len = 0;
+    size_t i = 0;
+    size_t from = 0;
+
+    while(i < WORDS) {
+        if(i == gap) {
+            i = RAM_WORDS;
+        }
+        size_t end = i < gap ? gap : WORDS;
+        // most of the machine is ram that didn't change, skip it a line at a time
+        while(i + 8 <= end && memcmp(a + i * 8, b + i * 8, 64) == 0) {
+            i += 8;
+        }
+        while(i < end && memcmp(a + i * 8, b + i * 8, 8) == 0) {
+            i++;
+        }
+        if(i == end) {
+            continue;
+        }
+
+        size_t start = i;
+        while(i < end && memcmp(a + i * 8, b + i * 8, 8) != 0) {
+            i++;
+        }
+
+        size_t words = i - start;
+        if(len + 4 + words * 8 > limit) {
+            return 0;
+        }
+
+        uint16_t skip = start - from;
+        uint16_t run = words;
+        memcpy(out + len, &skip, 2);
+        memcpy(out + len + 2, &run, 2);
+        memcpy(out + len + 4, b + start * 8, words * 8);
+        len += 4 + words * 8;
+        from = i;
+    }
+
+    // an unchanged frame still needs a record, make it an empty run
+    if(len == 0) {
+        memset(out, 0, 4);
+        len = 4;
+    }
+
+    return len;
+}
+
+static void apply_delta(Chip8 *state, const uint8_t *delta, size_t len) {
+    uint8_t *out = (uint8_t *)state;
+    size_t word = 0;
+
+    for(size_t pos = 0; pos < len;) {
+        uint16_t skip, run;
+        memcpy(&skip, delta + pos, 2);
+        memcpy(&run, delta + pos + 2, 2);
+        word += skip;
+        memcpy(out + word * 8, delta + pos + 4, run * 8);
+        word += run;
+        pos += 4 + run * 8;
+    }
+}
+
+void c8_rewind_push(C8Rewind *rw, const Chip8 *chip8) {
+    if(rw->have_key && rw->since_key + 1 < rw->interval && rw->key.quirks == chip8->quirks) {
+        size_t len = encode_delta(&rw->key, chip8, rw->delta);
+
+        if(len > 0) {
+            size_t at = reserve(rw, sizeof(Record) + align8(len));
+            // making room can cost us the keyframe the delta was taken against
+            if(rw->have_key) {
+                memcpy(payload_at(rw, at), rw->delta, len);
+                commit(rw, at, len, ++rw->since_key);
+                return;
+            }
+        }
+    }
+
+    size_t size = key_size(chip8);
+    size_t at = reserve(rw, sizeof(Record) + align8(size));
+    pack_key(payload_at(rw, at), chip8);
+    commit(rw, at, size, 0);
+
+    rw->have_key = true;
+    c8_copy_state(&rw->key, chip8);
+    rw->key_offset = at;
+    rw->since_key = 0;
+}
+
+bool c8_rewind_pop(C8Rewind *rw, Chip8 *state) {
+    if(rw->count == 0) {
+        return false;
+    }
+
+    size_t at = rw->newest;
+    const Record *rec = record_at(rw, at);
+
+    unpack_key(state, payload_at(rw, rec->keyframe), record_at(rw, rec->keyframe)->size);
+    if(rec->index != 0) {
+        apply_delta(state, payload_at(rw, at), rec->size);
+    }
+
+    size_t prev = rec->prev;
+    bool was_key = rec->index == 0;
+    if(--rw->count == 0) {
+        clear(rw);
+        return true;
+    }
+
+    rw->tail = at;
+    rw->newest = prev;
+    if(at == 0) {
+        // that was the first record at the start of buf, the rest end at wrap
+        rw->tail = rw->wrap;
+        rw->wrap = rw->capacity;
+    }
+
+    const Record *newest = record_at(rw, prev);
+    if(was_key) {
+        rw->key_offset = newest->keyframe;
+        unpack_key(&rw->key, payload_at(rw, rw->key_offset),
+                   record_at(rw, rw->key_offset)->size);
+    }
+    rw->since_key = newest->index;
+
+    return true;
+}
+
+size_t c8_rewind_frames(const C8Rewind *rw) {
+    return rw->count;
+}
+
+size_t c8_rewind_bytes(const C8Rewind *rw) {
+    if(rw->count == 0) {
+        return 0;
+    }
+    if(rw->head < rw->tail) {
+        return rw->tail - rw->head;
+    }
+    return rw->wrap - rw->head + rw->tail;
+}
@@ -0,0 +1,23 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "chip8.h"
+
+// Keeps one state per frame inside a fixed memory budget. Every interval
+// frames a full keyframe is stored and the frames in between only keep the
+// words that differ from it, which is a few dozen bytes for most ROMs. When
+// the budget runs out the oldest keyframe goes, along with its deltas.
+typedef struct C8Rewind C8Rewind;
+
+C8Rewind *c8_rewind_create(size_t budget, uint32_t interval);
+void c8_rewind_destroy(C8Rewind *rw);
+
+void c8_rewind_push(C8Rewind *rw, const Chip8 *chip8);
+// Takes the newest state off the buffer, false once it's empty. Like
+// c8_copy_state, ram past what the state's quirk profile reaches is left alone.
+bool c8_rewind_pop(C8Rewind *rw, Chip8 *state);
+
+size_t c8_rewind_frames(const C8Rewind *rw);
+size_t c8_rewind_bytes(const C8Rewind *rw);
+
+#endif
@@ -0,0 +1,282 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "romlib.h"
+
+#define LIB_MAGIC "C8RA"
+// read back as 04 03 02 01 on a host with the other byte order
+#define LIB_BYTE_ORDER 0x01020304u
+
+typedef struct LibHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t count;
+    uint32_t names; // offsets from the start of the file
+    uint32_t data;
+    uint8_t reserved[8];
+} LibHeader;
+
+typedef struct RomEntry {
+    uint64_t hash;   // c8_hash of the ROM, which is all that tells ROMs apart
+    uint32_t offset; // from the start of the data
+    uint32_t name;   // from the start of the names
+    uint16_t size;
+    uint8_t quirks;  // what c8_quirks_for_rom said when the ROM was packed
+    uint8_t reserved[5];
+} RomEntry;
+
+struct C8RomLib {
+    void *map;
+    size_t len;
+    const RomEntry *entries;
+    size_t count;
+    const char *names;
+    const uint8_t *data;
+};
+
+// A ROM on its way into an archive
+typedef struct Packing {
+    uint64_t hash;
+    size_t order; // position on the command line, the first copy keeps its name
+    const char *name;
+    uint8_t *rom;
+    size_t len;
+    C8QuirkProfile quirks;
+} Packing;
+
+static int by_hash(const void *a, const void *b) {
+    const Packing *x = a;
+    const Packing *y = b;
+    if(x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+bool c8_romlib_build(const char *path, char *const *paths, size_t count) {
+    Packing *roms = c8_calloc(count ? count : 1, sizeof *roms);
+
+    for(size_t i = 0; i < count; i++) {
+        const char *slash = strrchr(paths[i], '/');
+        roms[i].rom = c8_read_rom(paths[i], &roms[i].len);
+        roms[i].hash = c8_hash(roms[i].rom, roms[i].len);
+        roms[i].order = i;
+        roms[i].name = slash ? slash + 1 : paths[i];
+        roms[i].quirks = c8_quirks_for_rom(roms[i].rom, roms[i].len);
+
+        // the archive would be refused when it's opened
+        if(roms[i].len > c8_rom_space(roms[i].quirks)) {
+            fprintf(stderr, "%s is too big for the %s profile\n", paths[i],
+                    c8_quirks_name(roms[i].quirks));
+            for(size_t j = 0; j <= i; j++) {
+                free(roms[j].rom);
+            }
+            free(roms);
+            return false;
+        }
+    }
+    qsort(roms, count, sizeof *roms, by_hash);
+
+    size_t unique = 0;
+    size_t names_len = 0;
+    size_t data_len = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(unique > 0 && roms[i].hash == roms[unique - 1].hash) {
+            free(roms[i].rom);
+            continue;
+        }
+        roms[unique++] = roms[i];
+        names_len += strlen(roms[i].name) + 1;
+        data_len += roms[i].len;
+    }
+
+    LibHeader header = {
+        .version = C8_ROMLIB_VERSION,
+        .byte_order = LIB_BYTE_ORDER,
+        .count = unique,
+        .names = sizeof header + unique * sizeof(RomEntry),
+    };
+    memcpy(header.magic, LIB_MAGIC, 4);
+    header.data = header.names + names_len;
+
+    if(header.data + data_len > UINT32_MAX) {
+        fprintf(stderr, "Too many ROMs for one archive\n");
+        exit(1);
+    }
+
+    FILE *out = fopen(path, "wb");
+    if(!out) {
+        fprintf(stderr, "Couldn't open ROM archive %s\n", path);
+        for(size_t i = 0; i < unique; i++) {
+            free(roms[i].rom);
+        }
+        free(roms);
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof header, 1, out) == 1;
+    uint32_t name = 0;
+    uint32_t offset = 0;
+    for(size_t i = 0; i < unique; i++) {
+        RomEntry entry = {
+            .hash = roms[i].hash,
+            .offset = offset,
+            .name = name,
+            .size = roms[i].len,
+            .quirks = roms[i].quirks,
+        };
+        ok &= fwrite(&entry, sizeof entry, 1, out) == 1;
+        name += strlen(roms[i].name) + 1;
+        offset += roms[i].len;
+    }
+    for(size_t i = 0; i < unique; i++) {
+        ok &= fwrite(roms[i].name, strlen(roms[i].name) + 1, 1, out) == 1;
+    }
+    for(size_t i = 0; i < unique; i++) {
+        ok &= fwrite(roms[i].rom, 1, roms[i].len, out) == roms[i].len;
+        free(roms[i].rom);
+    }
+    free(roms);
+
+    ok &= fclose(out) == 0;
+    if(!ok) {
+        fprintf(stderr, "Couldn't write ROM archive %s\n", path);
+    }
+    return ok;
+}
+
+// Everything the index points at has to lie inside the file, checked once
+// here so loading never has to
+static bool valid(const uint8_t *map, size_t len) {
+    const LibHeader *header = (const LibHeader *)map;
+
+    if(memcmp(header->magic, LIB_MAGIC, 4) != 0 || header->version != C8_ROMLIB_VERSION ||
+       header->byte_order != LIB_BYTE_ORDER) {
+        return false;
+    }
+    if(header->names != sizeof *header + (uint64_t)header->count * sizeof(RomEntry) ||
+       header->data < header->names || header->data > len) {
+        return false;
+    }
+
+    // a final NUL ends every name
+    size_t names_len = header->data - header->names;
+    if(names_len > 0 && map[header->data - 1] != '\0') {
+        return false;
+    }
+
+    const RomEntry *entries = (const RomEntry *)(map + sizeof *header);
+    for(uint32_t i = 0; i < header->count; i++) {
+        const RomEntry *entry = &entries[i];
+        if(entry->quirks >= C8_NUM_QUIRK_PROFILES || entry->size > c8_rom_space(entry->quirks) ||
+           entry->name >= names_len ||
+           (uint64_t)entry->offset + entry->size > len - header->data) {
+            return false;
+        }
+        if(i > 0 && entries[i - 1].hash >= entry->hash) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+C8RomLib *c8_romlib_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "Couldn't open ROM archive %s\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(LibHeader)) {
+        fprintf(stderr, "%s isn't a ROM archive for this build\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        fprintf(stderr, "Couldn't map ROM archive %s\n", path);
+        return NULL;
+    }
+
+    if(!valid(map, st.st_size)) {
+        fprintf(stderr, "%s isn't a ROM archive for this build\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    const LibHeader *header = map;
+    C8RomLib *lib = c8_calloc(1, sizeof *lib);
+    lib->map = map;
+    lib->len = st.st_size;
+    lib->entries = (const RomEntry *)((const uint8_t *)map + sizeof *header);
+    lib->count = header->count;
+    lib->names = (const char *)map + header->names;
+    lib->data = (const uint8_t *)map + header->data;
+
+    return lib;
+}
+
+void c8_romlib_close(C8RomLib *lib) {
+    munmap(lib->map, lib->len);
+    free(lib);
+}
+
+size_t c8_romlib_count(const C8RomLib *lib) {
+    return lib->count;
+}
+
+bool c8_romlib_find(const C8RomLib *lib, uint64_t hash, size_t *index) {
+    size_t lo = 0;
+    size_t hi = lib->count;
+
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(lib->entries[mid].hash == hash) {
+            *index = mid;
+            return true;
+        }
+        if(lib->entries[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return false;
+}
+
+bool c8_romlib_find_name(const C8RomLib *lib, const char *name, size_t *index) {
+    for(size_t i = 0; i < lib->count; i++) {
+        if(strcmp(lib->names + lib->entries[i].name, name) == 0) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *c8_romlib_name(const C8RomLib *lib, size_t index) {
+    return lib->names + lib->entries[index].name;
+}
+
+uint64_t c8_romlib_hash(const C8RomLib *lib, size_t index) {
+    return lib->entries[index].hash;
+}
+
+size_t c8_romlib_size(const C8RomLib *lib, size_t index) {
+    return lib->entries[index].size;
+}
+
+void c8_romlib_load(const C8RomLib *lib, size_t index, Chip8 *chip8,
+                    const C8QuirkProfile *quirks) {
+    const RomEntry *entry = &lib->entries[index];
+    C8QuirkProfile profile = quirks ? *quirks : entry->quirks;
+    c8_load_rom_data(chip8, lib->data + entry->offset, entry->size, &profile);
+}
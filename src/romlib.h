@@ -0,0 +1,42 @@
+#ifndef ROMLIB_H
+#define ROMLIB_H
+
+#include "chip8.h"
+
+// Many ROMs packed into one archive that is used straight from a mmap. The
+// index at the front is sorted by content hash and already holds what loading
+// needs (size, quirk profile, where the bytes are), so loading a ROM from an
+// open library is one memcpy into ram.
+//
+// File layout, in the host's byte order like savestates:
+//   header:  "C8RA" version:u32 byte_order:u32 count:u32 names:u32 data:u32 pad
+//   entries: count of them sorted by hash, see RomEntry in romlib.c
+//   names:   NUL terminated file names, entries point into them
+//   data:    the ROMs back to back
+#define C8_ROMLIB_VERSION 1
+
+typedef struct C8RomLib C8RomLib;
+
+// Packs the ROM files at paths into a new archive. ROMs with the same
+// contents are stored once, under the first name given. Returns false on
+// I/O errors.
+bool c8_romlib_build(const char *path, char *const *paths, size_t count);
+
+// Reports problems on stderr and returns NULL, the same as savestates
+C8RomLib *c8_romlib_open(const char *path);
+void c8_romlib_close(C8RomLib *lib);
+
+size_t c8_romlib_count(const C8RomLib *lib);
+// Both set index and return true when the library has the ROM
+bool c8_romlib_find(const C8RomLib *lib, uint64_t hash, size_t *index);
+bool c8_romlib_find_name(const C8RomLib *lib, const char *name, size_t *index);
+
+const char *c8_romlib_name(const C8RomLib *lib, size_t index);
+uint64_t c8_romlib_hash(const C8RomLib *lib, size_t index);
+size_t c8_romlib_size(const C8RomLib *lib, size_t index);
+
+// c8_load_rom_data without hashing the ROM again to find its profile
+void c8_romlib_load(const C8RomLib *lib, size_t index, Chip8 *chip8,
+                    const C8QuirkProfile *quirks);
+
+#endif
@@ -0,0 +1,202 @@
+#include <pthread.h>
+#include <unistd.h>
+
+#include "runner.h"
+
+#define CACHE_LINE 64
+
+typedef struct C8Instance {
+    Chip8 *chip8;
+    uint64_t budget;
+    uint32_t ipf;
+    C8RunResult result;
+} __attribute__((aligned(CACHE_LINE))) C8Instance;
+
+// A worker's share of the pool packed as end << 32 | next. The owner takes
+// from the front and thieves from the back, both with a single CAS.
+typedef struct C8WorkQueue {
+    uint64_t range;
+} __attribute__((aligned(CACHE_LINE))) C8WorkQueue;
+
+typedef struct C8Worker {
+    C8Runner *runner;
+    uint32_t id;
+    pthread_t thread;
+} C8Worker;
+
+struct C8Runner {
+    C8EngineKind kind;
+    C8Pool *machines;
+    C8Instance *instances;
+    size_t count;
+    C8WorkQueue *queues;
+    C8Worker *workers;
+    uint32_t threads;
+};
+
+C8Runner *c8_runner_create(C8EngineKind kind, size_t count, uint32_t threads) {
+    if(count > UINT32_MAX) {
+        fprintf(stderr, "Too many machines for one runner\n");
+        exit(1);
+    }
+
+    if(threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+
+    C8Runner *runner = c8_calloc(1, sizeof *runner);
+    runner->kind = kind;
+    runner->count = count;
+    runner->threads = threads;
+    runner->machines = c8_pool_create(sizeof(Chip8), count);
+    runner->instances = c8_aligned_alloc(CACHE_LINE, count * sizeof(C8Instance));
+    runner->queues = c8_aligned_alloc(CACHE_LINE, threads * sizeof(C8WorkQueue));
+    runner->workers = c8_calloc(threads, sizeof(C8Worker));
+
+    Chip8 *reset = c8_malloc(sizeof *reset);
+    c8_reset(reset);
+    for(size_t i = 0; i < count; i++) {
+        runner->instances[i].chip8 = c8_pool_alloc(runner->machines);
+        c8_copy_state(runner->instances[i].chip8, reset);
+        c8_runner_set_budget(runner, i, 60 * FRAMES_PER_SECOND * INSTRUCTIONS_PER_FRAME,
+                             INSTRUCTIONS_PER_FRAME);
+    }
+    free(reset);
+
+    return runner;
+}
+
+void c8_runner_destroy(C8Runner *runner) {
+    c8_pool_destroy(runner->machines);
+    free(runner->instances);
+    free(runner->queues);
+    free(runner->workers);
+    free(runner);
+}
+
+size_t c8_runner_count(const C8Runner *runner) {
+    return runner->count;
+}
+
+uint32_t c8_runner_threads(const C8Runner *runner) {
+    return runner->threads;
+}
+
+Chip8 *c8_runner_machine(C8Runner *runner, size_t index) {
+    return runner->instances[index].chip8;
+}
+
+void c8_runner_set_budget(C8Runner *runner, size_t index, uint64_t instructions,
+                          uint32_t ipf) {
+    runner->instances[index].budget = instructions;
+    runner->instances[index].ipf = ipf;
+}
+
+const C8RunResult *c8_runner_result(const C8Runner *runner, size_t index) {
+    return &runner->instances[index].result;
+}
+
+// Both return false once the queue is empty
+static bool take_front(C8WorkQueue *queue, uint32_t *index) {
+    uint64_t range = __atomic_load_n(&queue->range, __ATOMIC_RELAXED);
+    uint32_t next, end;
+
+    do {
+        next = range;
+        end = range >> 32;
+        if(next >= end) {
+            return false;
+        }
+    } while(!__atomic_compare_exchange_n(&queue->range, &range, range + 1, true,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    *index = next;
+    return true;
+}
+
+static bool take_back(C8WorkQueue *queue, uint32_t *index) {
+    uint64_t range = __atomic_load_n(&queue->range, __ATOMIC_RELAXED);
+    uint32_t next, end;
+
+    do {
+        next = range;
+        end = range >> 32;
+        if(next >= end) {
+            return false;
+        }
+    } while(!__atomic_compare_exchange_n(&queue->range, &range, range - (1ULL << 32), true,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    *index = end - 1;
+    return true;
+}
+
+static void run_instance(C8Engine *engine, C8Instance *instance) {
+    Chip8 *chip8 = instance->chip8;
+    C8RunResult *result = &instance->result;
+
+    c8_engine_attach(engine, chip8);
+    c8_engine_run_frames(engine, instance->budget, instance->ipf);
+
+    result->screen_hash = c8_screen_hash(chip8);
+    result->instructions = instance->budget;
+    result->frames = instance->budget / instance->ipf;
+    result->pc = chip8->pc;
+    result->I = chip8->I;
+    result->sp = chip8->sp;
+    memcpy(result->V, chip8->V, sizeof result->V);
+}
+
+static void *worker_main(void *arg) {
+    C8Worker *worker = arg;
+    C8Runner *runner = worker->runner;
+    // one engine per thread, moved from machine to machine
+    C8Engine *engine = c8_engine_create(runner->kind, runner->instances[0].chip8);
+    uint32_t index;
+
+    while(take_front(&runner->queues[worker->id], &index)) {
+        run_instance(engine, &runner->instances[index]);
+    }
+
+    // queues only ever shrink, so one pass that finds them all empty is final
+    for(uint32_t i = 1; i < runner->threads; i++) {
+        C8WorkQueue *victim = &runner->queues[(worker->id + i) % runner->threads];
+        while(take_back(victim, &index)) {
+            run_instance(engine, &runner->instances[index]);
+        }
+    }
+
+    c8_engine_destroy(engine);
+    return NULL;
+}
+
+void c8_runner_run(C8Runner *runner) {
+    if(runner->count == 0) {
+        return;
+    }
+
+    uint64_t share = runner->count / runner->threads;
+    uint64_t extra = runner->count % runner->threads;
+    uint64_t next = 0;
+
+    for(uint32_t i = 0; i < runner->threads; i++) {
+        uint64_t end = next + share + (i < extra);
+        runner->queues[i].range = end << 32 | next;
+        next = end;
+    }
+
+    for(uint32_t i = 0; i < runner->threads; i++) {
+        C8Worker *worker = &runner->workers[i];
+        worker->runner = runner;
+        worker->id = i;
+        if(pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            fprintf(stderr, "Couldn't start runner thread\n");
+            exit(1);
+        }
+    }
+
+    for(uint32_t i = 0; i < runner->threads; i++) {
+        pthread_join(runner->workers[i].thread, NULL);
+    }
+}
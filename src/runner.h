@@ -0,0 +1,44 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include "engine.h"
+
+// Runs many independent machines in parallel. Machines live in one contiguous
+// pool with every slot on its own cache lines, each worker thread starts on its
+// own share of the pool and steals whole machines from the others once that
+// runs out.
+typedef struct C8Runner C8Runner;
+
+// Written only by the worker that ran the machine, so collecting them takes
+// no locks
+typedef struct C8RunResult {
+    uint64_t screen_hash; // c8_screen_hash
+    uint64_t instructions;
+    uint64_t frames;
+    uint16_t pc;
+    uint16_t I;
+    uint8_t sp;
+    uint8_t V[NUM_GPRS];
+} C8RunResult;
+
+// threads == 0 uses one per online cpu
+C8Runner *c8_runner_create(C8EngineKind kind, size_t count, uint32_t threads);
+void c8_runner_destroy(C8Runner *runner);
+
+size_t c8_runner_count(const C8Runner *runner);
+uint32_t c8_runner_threads(const C8Runner *runner);
+
+// Machines start out reset, ready for c8_load_rom_data
+Chip8 *c8_runner_machine(C8Runner *runner, size_t index);
+
+// Instructions run as whole frames of ipf, the default is one minute at
+// INSTRUCTIONS_PER_FRAME
+void c8_runner_set_budget(C8Runner *runner, size_t index, uint64_t instructions,
+                          uint32_t ipf);
+
+// Runs every machine to the end of its budget and returns once all are done
+void c8_runner_run(C8Runner *runner);
+
+const C8RunResult *c8_runner_result(const C8Runner *runner, size_t index);
+
+#endif
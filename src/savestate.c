@@ -0,0 +1,112 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "savestate.h"
+
+#define STATE_MAGIC "C8SS"
+// read back as 04 03 02 01 on a host with the other byte order
+#define STATE_BYTE_ORDER 0x01020304u
+#define STATE_OFFSET 64
+
+typedef struct StateHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t state_size;
+    uint32_t state_offset;
+    uint8_t reserved[STATE_OFFSET - 20];
+} StateHeader;
+
+struct C8Savestate {
+    void *map;
+    size_t len;
+};
+
+void c8_snapshot(const Chip8 *chip8, Chip8 *snapshot) {
+    memcpy(snapshot, chip8, sizeof *snapshot);
+}
+
+void c8_restore(Chip8 *chip8, const Chip8 *snapshot) {
+    bool keypad[NUM_KEYS];
+
+    memcpy(keypad, chip8->keypad, sizeof keypad);
+    c8_copy_state(chip8, snapshot);
+    memcpy(chip8->keypad, keypad, sizeof keypad);
+
+    chip8->dirty_rows = UINT64_MAX;
+    chip8->needs_draw = true;
+}
+
+bool c8_savestate_save(const Chip8 *chip8, const char *path) {
+    StateHeader header = {
+        .version = C8_STATE_VERSION,
+        .byte_order = STATE_BYTE_ORDER,
+        .state_size = sizeof *chip8,
+        .state_offset = STATE_OFFSET,
+    };
+    memcpy(header.magic, STATE_MAGIC, sizeof header.magic);
+
+    FILE *file = fopen(path, "wb");
+    if(!file) {
+        fprintf(stderr, "Couldn't open savestate %s\n", path);
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof header, 1, file) == 1 &&
+              fwrite(chip8, sizeof *chip8, 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+
+    if(!ok) {
+        fprintf(stderr, "Couldn't write savestate %s\n", path);
+    }
+    return ok;
+}
+
+C8Savestate *c8_savestate_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "Couldn't open savestate %s\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size != STATE_OFFSET + sizeof(Chip8)) {
+        fprintf(stderr, "%s isn't a savestate for this build\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        fprintf(stderr, "Couldn't map savestate %s\n", path);
+        return NULL;
+    }
+
+    const StateHeader *header = map;
+    const Chip8 *saved = (const Chip8 *)((const uint8_t *)map + STATE_OFFSET);
+    if(memcmp(header->magic, STATE_MAGIC, 4) != 0 || header->version != C8_STATE_VERSION ||
+       header->byte_order != STATE_BYTE_ORDER || header->state_size != sizeof(Chip8) ||
+       header->state_offset != STATE_OFFSET || saved->quirks >= C8_NUM_QUIRK_PROFILES) {
+        fprintf(stderr, "%s isn't a savestate for this build\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    C8Savestate *state = c8_calloc(1, sizeof *state);
+    state->map = map;
+    state->len = st.st_size;
+
+    return state;
+}
+
+const Chip8 *c8_savestate_state(const C8Savestate *state) {
+    return (const Chip8 *)((const uint8_t *)state->map + STATE_OFFSET);
+}
+
+void c8_savestate_close(C8Savestate *state) {
+    munmap(state->map, state->len);
+    free(state);
+}
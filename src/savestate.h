@@ -0,0 +1,30 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include "chip8.h"
+
+// Chip8 holds no pointers, so a snapshot is the machine itself
+void c8_snapshot(const Chip8 *chip8, Chip8 *snapshot);
+
+// Keeps the live keypad, which belongs to the frontend, and marks the whole
+// screen for redraw. Engines must be told about the new ram, see
+// c8_engine_restore.
+void c8_restore(Chip8 *chip8, const Chip8 *snapshot);
+
+// Savestate files are a 64 byte header followed by the machine exactly as it
+// sits in memory, so loading one is a mmap. The header pins the layout: bump
+// C8_STATE_VERSION whenever Chip8 changes.
+#define C8_STATE_VERSION 4
+
+typedef struct C8Savestate C8Savestate;
+
+// Both report problems on stderr and fail rather than exit, a bad savestate
+// shouldn't take the session down with it
+bool c8_savestate_save(const Chip8 *chip8, const char *path);
+C8Savestate *c8_savestate_open(const char *path);
+
+// Valid until c8_savestate_close
+const Chip8 *c8_savestate_state(const C8Savestate *state);
+void c8_savestate_close(C8Savestate *state);
+
+#endif
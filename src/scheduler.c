@@ -0,0 +1,46 @@
+#include <errno.h>
+
+#include "scheduler.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+// beyond this (a stopped process, a debugger) it's pointless to catch up
+#define MAX_FRAMES_BEHIND 4
+
+static uint64_t ts_to_ns(const struct timespec *ts) {
+    return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static struct timespec ns_to_ts(uint64_t ns) {
+    struct timespec ts = {ns / NSEC_PER_SEC, ns % NSEC_PER_SEC};
+    return ts;
+}
+
+void c8_scheduler_init(C8Scheduler *sched, uint32_t ipf, bool turbo) {
+    sched->ipf = ipf;
+    sched->turbo = turbo;
+    sched->frames = 0;
+    clock_gettime(CLOCK_MONOTONIC, &sched->start);
+}
+
+void c8_scheduler_wait(C8Scheduler *sched) {
+    sched->frames++;
+    if(sched->turbo) {
+        return;
+    }
+
+    uint64_t start = ts_to_ns(&sched->start);
+    uint64_t deadline = start + sched->frames * NSEC_PER_SEC / FRAMES_PER_SECOND;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if(ts_to_ns(&now) > deadline + MAX_FRAMES_BEHIND * NSEC_PER_SEC / FRAMES_PER_SECOND) {
+        sched->start = now;
+        sched->frames = 0;
+        return;
+    }
+
+    struct timespec until = ns_to_ts(deadline);
+    // the deadline is absolute so a signal just means going back to sleep
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+    }
+}
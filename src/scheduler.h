@@ -0,0 +1,22 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "chip8.h"
+
+// Paces emulation in 60 Hz frames against CLOCK_MONOTONIC with one sleep per
+// frame. Deadlines are computed from the start time rather than accumulated,
+// so the frame rate doesn't drift.
+typedef struct C8Scheduler {
+    uint32_t ipf; // instructions per frame
+    bool turbo;   // run frames back to back without waiting
+    struct timespec start;
+    uint64_t frames;
+} C8Scheduler;
+
+void c8_scheduler_init(C8Scheduler *sched, uint32_t ipf, bool turbo);
+
+// Blocks until the next frame is due. Frames that fall behind run back to
+// back to catch up, unless they're so far behind the schedule starts over.
+void c8_scheduler_wait(C8Scheduler *sched);
+
+#endif
@@ -0,0 +1,345 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "stream.h"
+
+#define FRAME_TYPE 'F'
+// every row of every column, plus the header
+#define MAX_WORDS (NUM_PLANES * SCREEN_WORDS * SCREEN_HEIGHT)
+// a run of rows per iovec, runs being at least a row apart
+#define MAX_IOVECS (1 + NUM_PLANES * SCREEN_WORDS * (SCREEN_HEIGHT / 2))
+
+typedef struct FrameHeader {
+    uint32_t size;
+    uint8_t type;
+    uint8_t hires;
+    uint8_t pad[2];
+    uint64_t frame;
+    uint64_t rows[NUM_PLANES][SCREEN_WORDS];
+} FrameHeader;
+
+#define MAX_MESSAGE (sizeof(FrameHeader) + MAX_WORDS * sizeof(uint64_t))
+
+typedef struct Consumer {
+    int out_fd; // -1 for a free slot
+    int in_fd;  // -1 when keys don't come back
+    bool owned; // opened by the stream, so closed by it
+    bool socket;
+    bool fresh;  // hasn't been sent a frame yet
+    bool behind; // had the last frame dropped
+    // the screen as the consumer will have it once pending is through
+    uint64_t sent[NUM_PLANES][SCREEN_WORDS][SCREEN_HEIGHT];
+    // the tail of a message the descriptor only took part of
+    uint8_t pending[MAX_MESSAGE];
+    size_t pending_len;
+    size_t pending_off;
+} Consumer;
+
+struct C8Stream {
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int listen_fd; // -1 for an fd: target
+    Consumer consumers[C8_STREAM_CONSUMERS];
+    bool owed; // some consumer is fresh or behind, so gets a frame without a draw
+    uint64_t dropped;
+};
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void add_consumer(C8Stream *stream, Consumer *c, int out_fd, int in_fd, bool owned) {
+    struct stat st;
+    c->out_fd = out_fd;
+    c->in_fd = in_fd;
+    c->owned = owned;
+    c->socket = fstat(out_fd, &st) == 0 && S_ISSOCK(st.st_mode);
+    c->fresh = true;
+    c->behind = false;
+    c->pending_len = c->pending_off = 0;
+    stream->owed = true;
+}
+
+static void drop_consumer(Consumer *c) {
+    if(c->owned) {
+        close(c->out_fd);
+        if(c->in_fd != c->out_fd) {
+            close(c->in_fd);
+        }
+    }
+    c->out_fd = c->in_fd = -1;
+}
+
+// fd:<out>[:<in>]
+static bool parse_fds(const char *spec, int *out_fd, int *in_fd) {
+    char *end;
+    long out = strtol(spec, &end, 10);
+    long in = -1;
+    if(end == spec || out < 0) {
+        return false;
+    }
+    if(*end == ':') {
+        spec = end + 1;
+        in = strtol(spec, &end, 10);
+        if(end == spec || in < 0) {
+            return false;
+        }
+    }
+    *out_fd = out;
+    *in_fd = in;
+    return *end == '\0';
+}
+
+static int listen_on(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if(strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "Stream socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        fprintf(stderr, "Couldn't create the stream socket\n");
+        return -1;
+    }
+    // a socket left behind by an earlier run, but never anything else at path
+    struct stat st;
+    if(lstat(path, &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and isn't a socket\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+    if(bind(fd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+       listen(fd, C8_STREAM_CONSUMERS) != 0 || !set_nonblocking(fd)) {
+        fprintf(stderr, "Couldn't listen for stream consumers on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+C8Stream *c8_stream_open(const char *target) {
+    C8Stream *stream = c8_calloc(1, sizeof *stream);
+    for(int i = 0; i < C8_STREAM_CONSUMERS; i++) {
+        stream->consumers[i].out_fd = stream->consumers[i].in_fd = -1;
+    }
+
+    if(strncmp(target, "fd:", 3) == 0) {
+        int out_fd, in_fd;
+        if(!parse_fds(target + 3, &out_fd, &in_fd) || !set_nonblocking(out_fd) ||
+           (in_fd >= 0 && !set_nonblocking(in_fd))) {
+            fprintf(stderr, "Can't stream to %s\n", target);
+            free(stream);
+            return NULL;
+        }
+        stream->listen_fd = -1;
+        add_consumer(stream, &stream->consumers[0], out_fd, in_fd, false);
+        return stream;
+    }
+
+    stream->listen_fd = listen_on(target);
+    if(stream->listen_fd < 0) {
+        free(stream);
+        return NULL;
+    }
+    strcpy(stream->path, target);
+    return stream;
+}
+
+void c8_stream_close(C8Stream *stream) {
+    for(int i = 0; i < C8_STREAM_CONSUMERS; i++) {
+        if(stream->consumers[i].out_fd >= 0) {
+            drop_consumer(&stream->consumers[i]);
+        }
+    }
+    if(stream->listen_fd >= 0) {
+        close(stream->listen_fd);
+        unlink(stream->path);
+    }
+    free(stream);
+}
+
+static void accept_consumers(C8Stream *stream) {
+    int fd;
+    while((fd = accept(stream->listen_fd, NULL, NULL)) >= 0) {
+        Consumer *slot = NULL;
+        for(int i = 0; i < C8_STREAM_CONSUMERS && !slot; i++) {
+            if(stream->consumers[i].out_fd < 0) {
+                slot = &stream->consumers[i];
+            }
+        }
+        // a full stream hangs up at once rather than leave the consumer waiting
+        if(!slot || !set_nonblocking(fd)) {
+            close(fd);
+            continue;
+        }
+        add_consumer(stream, slot, fd, fd, true);
+    }
+}
+
+static void read_keys(Consumer *c, Chip8 *chip8) {
+    uint8_t buf[64];
+    ssize_t got = read(c->in_fd, buf, sizeof buf);
+    if(got < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if(got <= 0 && c->in_fd != c->out_fd) {
+        // keys stopped coming, frames can still go out
+        if(c->owned) {
+            close(c->in_fd);
+        }
+        c->in_fd = -1;
+        return;
+    }
+    if(got <= 0) {
+        drop_consumer(c);
+        return;
+    }
+    for(ssize_t i = 0; i < got; i++) {
+        // anything that isn't a key is skipped
+        if(buf[i] >> 5 == 0) {
+            chip8->keypad[buf[i] & 0xF] = buf[i] >> 4 & 1;
+        }
+    }
+}
+
+void c8_stream_poll(C8Stream *stream, Chip8 *chip8) {
+    if(stream->listen_fd >= 0) {
+        accept_consumers(stream);
+    }
+    for(int i = 0; i < C8_STREAM_CONSUMERS; i++) {
+        Consumer *c = &stream->consumers[i];
+        if(c->out_fd >= 0 && c->in_fd >= 0) {
+            read_keys(c, chip8);
+        }
+    }
+}
+
+static ssize_t send_iov(const Consumer *c, struct iovec *iov, int count) {
+    if(c->socket) {
+        // a consumer that went away mustn't take the emulator down with SIGPIPE
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = count};
+        return sendmsg(c->out_fd, &msg, MSG_NOSIGNAL);
+    }
+    return writev(c->out_fd, iov, count);
+}
+
+// false when the consumer still has part of an earlier message to take
+static bool flush_pending(Consumer *c) {
+    while(c->pending_off < c->pending_len) {
+        struct iovec iov = {c->pending + c->pending_off, c->pending_len - c->pending_off};
+        ssize_t sent = send_iov(c, &iov, 1);
+        if(sent < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return false;
+        }
+        if(sent <= 0) {
+            drop_consumer(c);
+            return false;
+        }
+        c->pending_off += sent;
+    }
+    c->pending_len = c->pending_off = 0;
+    return true;
+}
+
+// Keeps whatever the descriptor didn't take to send before anything else
+static void keep_pending(Consumer *c, const struct iovec *iov, int count, size_t sent) {
+    for(int i = 0; i < count; i++) {
+        if(sent >= iov[i].iov_len) {
+            sent -= iov[i].iov_len;
+            continue;
+        }
+        memcpy(c->pending + c->pending_len, (uint8_t *)iov[i].iov_base + sent,
+               iov[i].iov_len - sent);
+        c->pending_len += iov[i].iov_len - sent;
+        sent = 0;
+    }
+}
+
+static void send_frame(C8Stream *stream, Consumer *c, const Chip8 *chip8, uint64_t frame) {
+    if(!flush_pending(c)) {
+        stream->dropped += c->out_fd >= 0;
+        c->behind = true;
+        return;
+    }
+
+    FrameHeader header = {.type = FRAME_TYPE, .hires = chip8->hires, .frame = frame};
+    struct iovec iov[MAX_IOVECS];
+    int count = 1;
+    size_t size = sizeof header;
+    bool changed = false;
+
+    // the words go out straight from the screen, a run of rows at a time
+    for(int p = 0; p < NUM_PLANES; p++) {
+        for(int w = 0; w < SCREEN_WORDS; w++) {
+            const uint64_t *column = chip8->screen[p][w];
+            uint64_t rows = 0;
+            for(int y = 0; y < SCREEN_HEIGHT; y++) {
+                rows |= (uint64_t)(c->fresh || column[y] != c->sent[p][w][y]) << y;
+            }
+            header.rows[p][w] = rows;
+            changed |= rows != 0;
+
+            while(rows) {
+                int first = __builtin_ctzll(rows);
+                uint64_t from_first = rows >> first;
+                int run = ~from_first ? __builtin_ctzll(~from_first) : SCREEN_HEIGHT;
+                iov[count].iov_base = (void *)&column[first];
+                iov[count].iov_len = run * sizeof(uint64_t);
+                size += iov[count++].iov_len;
+                rows = first + run < 64 ? rows & ~0ULL << (first + run) : 0;
+            }
+        }
+    }
+    if(!changed) {
+        c->behind = false;
+        return;
+    }
+    header.size = size;
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof header;
+
+    ssize_t sent = send_iov(c, iov, count);
+    if(sent < 0 && (errno == EAGAIN || errno == EINTR)) {
+        stream->dropped++;
+        c->behind = true;
+        return;
+    }
+    if(sent <= 0) {
+        drop_consumer(c);
+        return;
+    }
+    if((size_t)sent < size) {
+        keep_pending(c, iov, count, sent);
+    }
+    memcpy(c->sent, chip8->screen, sizeof c->sent);
+    c->fresh = c->behind = false;
+}
+
+void c8_stream_frame(C8Stream *stream, const Chip8 *chip8, uint64_t frame) {
+    if(!chip8->needs_draw && !stream->owed) {
+        return;
+    }
+    stream->owed = false;
+    for(int i = 0; i < C8_STREAM_CONSUMERS; i++) {
+        Consumer *c = &stream->consumers[i];
+        if(c->out_fd >= 0) {
+            send_frame(stream, c, chip8, frame);
+            // one that missed this frame gets the next whether or not it draws
+            stream->owed |= c->out_fd >= 0 && (c->fresh || c->behind);
+        }
+    }
+}
+
+uint64_t c8_stream_dropped(const C8Stream *stream) {
+    return stream->dropped;
+}
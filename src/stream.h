@@ -0,0 +1,43 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "chip8.h"
+
+// Streams a machine's screen to other local processes and takes their key
+// presses back, without SDL. Every consumer is sent the words of the screen
+// that changed since the frame it last got, and one that can't keep up has
+// frames dropped instead of holding up the machine.
+//
+// The target is fd:<out>[:<in>] for descriptors the process was started with
+// (a pipe, a file, one end of a socketpair), anything else is the path of a
+// Unix socket up to C8_STREAM_CONSUMERS consumers connect to.
+//
+// Frames, emulator to consumer, in host byte order:
+//   size:u32 'F':u8 hires:u8 pad:u8[2] frame:u64 rows:u64[NUM_PLANES][SCREEN_WORDS]
+//   then for each plane and word column in that order, the new value of the
+//   column's word in every row set in its rows mask, top row first
+// size counts the whole message. A consumer's first frame has every row set.
+// Keys, consumer to emulator: a byte per transition, key | pressed << 4 as in
+// input logs.
+#define C8_STREAM_CONSUMERS 8
+
+typedef struct C8Stream C8Stream;
+
+// NULL when the target can't be opened or something other than a socket is
+// already at a socket path. A stale socket there is replaced.
+C8Stream *c8_stream_open(const char *target);
+// Hangs up on every consumer and removes the socket
+void c8_stream_close(C8Stream *stream);
+
+// Takes consumers that are waiting and applies the keys they sent to the
+// keypad. Never blocks.
+void c8_stream_poll(C8Stream *stream, Chip8 *chip8);
+// Sends frame to every consumer that needs it: after needs_draw, to one that
+// had the last frame dropped and a full screen to one that just connected.
+// The frontend clears needs_draw.
+void c8_stream_frame(C8Stream *stream, const Chip8 *chip8, uint64_t frame);
+
+// Frames a consumer didn't get because it hadn't taken the last one yet
+uint64_t c8_stream_dropped(const C8Stream *stream);
+
+#endif
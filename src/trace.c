@@ -0,0 +1,458 @@
+#include <pthread.h>
+
+#include "trace.h"
+
+#define TRACE_MAGIC "C8TR"
+#define HEADER_SIZE 62
+
+// A trace never holds more than TRACE_CHUNKS chunks of memory, the machine
+// waits for the writer thread when they're all queued
+#define TRACE_CHUNK_SIZE (64 << 10)
+#define TRACE_CHUNKS 16
+// the longest record: tag, jump, all registers with their mask, I, sp with a
+// push, both timers and a store
+#define MAX_RECORD 64
+// FX55 and 5XY2 store at most 16 bytes from I, the same c8_store_spans allows for
+#define STORE_WINDOW 16
+
+struct C8TraceWriter {
+    FILE *file;
+    bool started;
+
+    // the machine as the records so far leave it
+    uint8_t V[NUM_GPRS];
+    uint16_t I;
+    uint8_t sp;
+    uint8_t delay;
+    uint8_t sound;
+
+    uint8_t *buf; // the chunk being filled
+    size_t len;
+
+    // chunks head up to tail are queued for the writer thread, tail is
+    // the one being filled
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t written;
+    uint8_t *chunks;
+    size_t lens[TRACE_CHUNKS];
+    uint64_t head;
+    uint64_t tail;
+    bool done;
+    bool failed;
+};
+
+struct C8TraceReader {
+    FILE *file;
+    Chip8 *chip8;
+    uint32_t mask; // the end of the machine's ram
+    uint64_t index;
+    bool truncated;
+};
+
+static void put_le(uint8_t *buf, uint64_t v, size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        buf[i] = v >> (8 * i);
+    }
+}
+
+static uint64_t get_le(const uint8_t *buf, size_t n) {
+    uint64_t v = 0;
+    for(size_t i = 0; i < n; i++) {
+        v |= (uint64_t)buf[i] << (8 * i);
+    }
+    return v;
+}
+
+static void *write_chunks(void *arg) {
+    C8TraceWriter *trace = arg;
+
+    pthread_mutex_lock(&trace->lock);
+    for(;;) {
+        while(trace->head == trace->tail && !trace->done) {
+            pthread_cond_wait(&trace->queued, &trace->lock);
+        }
+        if(trace->head == trace->tail) {
+            break;
+        }
+
+        size_t slot = trace->head % TRACE_CHUNKS;
+        size_t len = trace->lens[slot];
+        pthread_mutex_unlock(&trace->lock);
+        bool ok = fwrite(trace->chunks + slot * TRACE_CHUNK_SIZE, 1, len, trace->file) == len;
+        pthread_mutex_lock(&trace->lock);
+
+        trace->failed |= !ok;
+        trace->head++;
+        pthread_cond_signal(&trace->written);
+    }
+    pthread_mutex_unlock(&trace->lock);
+
+    return NULL;
+}
+
+// Queues the chunk being filled and moves on to the next one once the writer
+// thread is done with it
+static void submit(C8TraceWriter *trace) {
+    pthread_mutex_lock(&trace->lock);
+    trace->lens[trace->tail % TRACE_CHUNKS] = trace->len;
+    trace->tail++;
+    pthread_cond_signal(&trace->queued);
+    while(trace->tail - trace->head >= TRACE_CHUNKS) {
+        pthread_cond_wait(&trace->written, &trace->lock);
+    }
+    pthread_mutex_unlock(&trace->lock);
+
+    trace->buf = trace->chunks + trace->tail % TRACE_CHUNKS * TRACE_CHUNK_SIZE;
+    trace->len = 0;
+}
+
+C8TraceWriter *c8_trace_writer_create(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if(!file) {
+        fprintf(stderr, "Couldn't open trace %s\n", path);
+        exit(1);
+    }
+
+    C8TraceWriter *trace = c8_calloc(1, sizeof *trace);
+    trace->file = file;
+    trace->chunks = c8_malloc(TRACE_CHUNKS * TRACE_CHUNK_SIZE);
+    trace->buf = trace->chunks;
+    pthread_mutex_init(&trace->lock, NULL);
+    pthread_cond_init(&trace->queued, NULL);
+    pthread_cond_init(&trace->written, NULL);
+
+    if(pthread_create(&trace->thread, NULL, write_chunks, trace) != 0) {
+        fprintf(stderr, "Couldn't start trace writer thread\n");
+        exit(1);
+    }
+
+    return trace;
+}
+
+// The header goes out before any chunk is queued, so the writer thread
+// never has the file at the same time
+static void start(C8TraceWriter *trace, const Chip8 *chip8) {
+    uint8_t header[HEADER_SIZE] = TRACE_MAGIC;
+    header[4] = C8_TRACE_VERSION;
+    header[5] = chip8->quirks;
+    header[6] = chip8->sp;
+    header[7] = chip8->delay_timer;
+    header[8] = chip8->sound_timer;
+    put_le(header + 10, chip8->pc, 2);
+    put_le(header + 12, chip8->I, 2);
+    memcpy(header + 14, chip8->V, NUM_GPRS);
+    for(int i = 0; i < STACK_SIZE; i++) {
+        put_le(header + 30 + 2 * i, chip8->stack[i], 2);
+    }
+
+    size_t mem = c8_quirks_mem(c8_quirks(chip8->quirks));
+    trace->failed |= fwrite(header, 1, sizeof header, trace->file) != sizeof header;
+    trace->failed |= fwrite(chip8->ram, 1, mem, trace->file) != mem;
+
+    memcpy(trace->V, chip8->V, NUM_GPRS);
+    trace->I = chip8->I;
+    trace->sp = chip8->sp;
+    trace->delay = chip8->delay_timer;
+    trace->sound = chip8->sound_timer;
+    trace->started = true;
+}
+
+void c8_trace_exec(C8TraceWriter *trace, Chip8 *chip8, bool dbg) {
+    if(!trace->started) {
+        start(trace, chip8);
+    }
+
+    uint16_t pc = chip8->pc;
+    uint16_t opcode = c8_fetch(chip8, pc);
+    // whatever in reach of a store changed is what it stored
+    bool stores = (opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055 ||
+                  (opcode & 0xF00F) == 0x5002;
+    // everything else only ever writes VX and VF
+    bool loads = (opcode & 0xF0FF) == 0xF065 || (opcode & 0xF0FF) == 0xF085 ||
+                 (opcode & 0xF00F) == 0x5003;
+    uint8_t before[STORE_WINDOW];
+    uint32_t mask = 0;
+    uint16_t base = chip8->I;
+
+    if(stores) {
+        mask = c8_quirks_mem(c8_quirks(chip8->quirks)) - 1;
+        for(int i = 0; i < STORE_WINDOW; i++) {
+            before[i] = chip8->ram[(base + i) & mask];
+        }
+    }
+
+    c8_exec_instruction(chip8, dbg);
+
+    uint8_t *out = trace->buf + trace->len;
+    uint8_t *tag = out++;
+    uint8_t changes = 0;
+
+    if(chip8->pc != (uint16_t)(pc + 2)) {
+        changes |= C8_TRACE_JUMP;
+        put_le(out, chip8->pc, 2);
+        out += 2;
+    }
+
+    // comparing just the registers it could have written keeps to the bytes
+    // the interpreter stored, wider loads would have to wait for those
+    uint16_t vs = 0;
+    if(loads) {
+        for(int i = 0; i < NUM_GPRS; i++) {
+            vs |= (chip8->V[i] != trace->V[i]) << i;
+        }
+    } else {
+        uint8_t x = op_X(opcode);
+        vs = (chip8->V[x] != trace->V[x]) << x | (chip8->V[0xF] != trace->V[0xF]) << 0xF;
+    }
+
+    if(vs && !(vs & (vs - 1))) {
+        uint8_t x = __builtin_ctz(vs);
+        changes |= C8_TRACE_V;
+        *out++ = x;
+        *out++ = trace->V[x] = chip8->V[x];
+    } else if(vs) {
+        changes |= C8_TRACE_VS;
+        put_le(out, vs, 2);
+        out += 2;
+        for(uint16_t left = vs; left; left &= left - 1) {
+            uint8_t x = __builtin_ctz(left);
+            *out++ = trace->V[x] = chip8->V[x];
+        }
+    }
+
+    if(chip8->I != trace->I) {
+        // most changes to I are small steps through a table
+        int16_t delta = chip8->I - trace->I;
+        uint16_t zigzag = (uint16_t)delta << 1 ^ (uint16_t)(delta >> 15);
+        changes |= C8_TRACE_I;
+        do {
+            *out++ = (zigzag & 0x7F) | (zigzag > 0x7F ? 0x80 : 0);
+            zigzag >>= 7;
+        } while(zigzag);
+        trace->I = chip8->I;
+    }
+
+    if(chip8->sp != trace->sp) {
+        changes |= C8_TRACE_SP;
+        *out++ = chip8->sp;
+        if(chip8->sp == (uint8_t)(trace->sp + 1)) {
+            put_le(out, chip8->stack[trace->sp % STACK_SIZE], 2);
+            out += 2;
+        }
+        trace->sp = chip8->sp;
+    }
+
+    if(chip8->delay_timer != trace->delay) {
+        changes |= C8_TRACE_DELAY;
+        *out++ = trace->delay = chip8->delay_timer;
+    }
+    if(chip8->sound_timer != trace->sound) {
+        changes |= C8_TRACE_SOUND;
+        *out++ = trace->sound = chip8->sound_timer;
+    }
+
+    if(stores) {
+        int first = STORE_WINDOW;
+        int last = -1;
+        for(int i = 0; i < STORE_WINDOW; i++) {
+            if(chip8->ram[(base + i) & mask] != before[i]) {
+                first = first < i ? first : i;
+                last = i;
+            }
+        }
+
+        if(last >= 0) {
+            changes |= C8_TRACE_STORE;
+            put_le(out, (base + first) & mask, 2);
+            out[2] = last - first + 1;
+            out += 3;
+            for(int i = first; i <= last; i++) {
+                *out++ = chip8->ram[(base + i) & mask];
+            }
+        }
+    }
+
+    *tag = changes;
+    trace->len = out - trace->buf;
+    if(trace->len > TRACE_CHUNK_SIZE - MAX_RECORD) {
+        submit(trace);
+    }
+}
+
+void c8_trace_writer_close(C8TraceWriter *trace) {
+    if(trace->len > 0) {
+        submit(trace);
+    }
+
+    pthread_mutex_lock(&trace->lock);
+    trace->done = true;
+    pthread_cond_signal(&trace->queued);
+    pthread_mutex_unlock(&trace->lock);
+    pthread_join(trace->thread, NULL);
+
+    if(fclose(trace->file) != 0 || trace->failed) {
+        fprintf(stderr, "Couldn't write trace\n");
+    }
+
+    pthread_mutex_destroy(&trace->lock);
+    pthread_cond_destroy(&trace->queued);
+    pthread_cond_destroy(&trace->written);
+    free(trace->chunks);
+    free(trace);
+}
+
+C8TraceReader *c8_trace_reader_open(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if(!file) {
+        fprintf(stderr, "Couldn't open trace %s\n", path);
+        return NULL;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    if(fread(header, 1, sizeof header, file) != sizeof header ||
+       memcmp(header, TRACE_MAGIC, 4) != 0) {
+        fprintf(stderr, "%s is not a trace\n", path);
+        fclose(file);
+        return NULL;
+    }
+    if(header[4] != C8_TRACE_VERSION) {
+        fprintf(stderr, "Unsupported trace version %d\n", header[4]);
+        fclose(file);
+        return NULL;
+    }
+    if(header[5] >= C8_NUM_QUIRK_PROFILES) {
+        fprintf(stderr, "Trace has an unknown quirk profile %d\n", header[5]);
+        fclose(file);
+        return NULL;
+    }
+
+    Chip8 *chip8 = chip8_init();
+    chip8->quirks = header[5];
+    chip8->sp = header[6];
+    chip8->delay_timer = header[7];
+    chip8->sound_timer = header[8];
+    chip8->pc = get_le(header + 10, 2);
+    chip8->I = get_le(header + 12, 2);
+    memcpy(chip8->V, header + 14, NUM_GPRS);
+    for(int i = 0; i < STACK_SIZE; i++) {
+        chip8->stack[i] = get_le(header + 30 + 2 * i, 2);
+    }
+
+    size_t mem = c8_quirks_mem(c8_quirks(chip8->quirks));
+    if(fread(chip8->ram, 1, mem, file) != mem) {
+        fprintf(stderr, "Trace %s is truncated\n", path);
+        fclose(file);
+        free(chip8);
+        return NULL;
+    }
+
+    C8TraceReader *reader = c8_calloc(1, sizeof *reader);
+    reader->file = file;
+    reader->chip8 = chip8;
+    reader->mask = mem - 1;
+
+    return reader;
+}
+
+void c8_trace_reader_close(C8TraceReader *reader) {
+    fclose(reader->file);
+    free(reader->chip8);
+    free(reader);
+}
+
+// Zero past the end of the file, which c8_trace_read reports once the record is done
+static uint8_t get(C8TraceReader *reader) {
+    int c = getc(reader->file);
+    if(c == EOF) {
+        reader->truncated = true;
+        return 0;
+    }
+    return c;
+}
+
+static uint16_t get16(C8TraceReader *reader) {
+    uint8_t lo = get(reader);
+    return lo | get(reader) << 8;
+}
+
+bool c8_trace_read(C8TraceReader *reader, C8TraceStep *step) {
+    Chip8 *chip8 = reader->chip8;
+    int tag = getc(reader->file);
+    if(tag == EOF || reader->truncated) {
+        return false;
+    }
+
+    *step = (C8TraceStep){
+        .index = reader->index,
+        .pc = chip8->pc,
+        .opcode = c8_fetch(chip8, chip8->pc),
+        .changes = tag,
+    };
+
+    chip8->pc += 2;
+    if(tag & C8_TRACE_JUMP) {
+        chip8->pc = get16(reader);
+    }
+
+    if(tag & C8_TRACE_V) {
+        uint8_t x = get(reader) % NUM_GPRS;
+        chip8->V[x] = get(reader);
+        step->vs = 1 << x;
+    }
+    if(tag & C8_TRACE_VS) {
+        step->vs = get16(reader);
+        for(int i = 0; i < NUM_GPRS; i++) {
+            if(step->vs >> i & 1) {
+                chip8->V[i] = get(reader);
+            }
+        }
+    }
+
+    if(tag & C8_TRACE_I) {
+        uint16_t zigzag = 0;
+        uint8_t byte;
+        uint8_t shift = 0;
+        do {
+            byte = get(reader);
+            zigzag |= (uint16_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while(byte & 0x80 && shift < 21);
+        chip8->I += (zigzag >> 1) ^ -(zigzag & 1);
+    }
+
+    if(tag & C8_TRACE_SP) {
+        uint8_t sp = get(reader);
+        if(sp == (uint8_t)(chip8->sp + 1)) {
+            chip8->stack[chip8->sp % STACK_SIZE] = get16(reader);
+        }
+        chip8->sp = sp;
+    }
+
+    if(tag & C8_TRACE_DELAY) {
+        chip8->delay_timer = get(reader);
+    }
+    if(tag & C8_TRACE_SOUND) {
+        chip8->sound_timer = get(reader);
+    }
+
+    if(tag & C8_TRACE_STORE) {
+        step->store = get16(reader);
+        step->store_len = get(reader);
+        for(int i = 0; i < step->store_len; i++) {
+            chip8->ram[(step->store + i) & reader->mask] = get(reader);
+        }
+    }
+
+    if(reader->truncated) {
+        fprintf(stderr, "Trace ends in the middle of an instruction\n");
+        return false;
+    }
+    reader->index++;
+    return true;
+}
+
+const Chip8 *c8_trace_reader_machine(const C8TraceReader *reader) {
+    return reader->chip8;
+}
@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "chip8.h"
+
+// Execution traces record every instruction with the registers it changed
+// and the bytes it stored, a few bytes each. The opcode isn't stored, the
+// reader fetches it from its copy of ram, which the stores keep up to date.
+// Records go into fixed size chunks that a writer thread puts in the file,
+// the machine only waits on it once every chunk is queued.
+//
+// File layout, little endian:
+//   "C8TR" version:u8 quirks:u8 sp:u8 delay:u8 sound:u8 pad:u8 pc:u16 I:u16
+//   V:u8[16] stack:u16[16] ram:u8[c8_quirks_mem bytes]
+//   records: a byte of C8TraceChange bits, then what they say changed in
+//   that order
+//     JUMP   pc after it, u16, when that isn't the next instruction
+//     V      register:u8 value:u8
+//     VS     mask:u16 then a value per bit set, for more than one register
+//     I      difference to the old I, zigzag LEB128 varint
+//     SP     sp:u8, followed by the pushed address:u16 when it went up by one
+//     DELAY  delay timer:u8
+//     SOUND  sound timer:u8
+//     STORE  addr:u16 len:u8 then len bytes, wrapping around the end of ram
+// Timers tick between instructions, so a record has the ticks since the
+// previous one folded into its own changes.
+#define C8_TRACE_VERSION 1
+
+typedef enum C8TraceChange {
+    C8_TRACE_JUMP = 1 << 0,
+    C8_TRACE_V = 1 << 1,
+    C8_TRACE_VS = 1 << 2,
+    C8_TRACE_I = 1 << 3,
+    C8_TRACE_SP = 1 << 4,
+    C8_TRACE_DELAY = 1 << 5,
+    C8_TRACE_SOUND = 1 << 6,
+    C8_TRACE_STORE = 1 << 7,
+} C8TraceChange;
+
+typedef struct C8TraceWriter C8TraceWriter;
+typedef struct C8TraceReader C8TraceReader;
+
+// One instruction read back, the machine state after it is
+// c8_trace_reader_machine
+typedef struct C8TraceStep {
+    uint64_t index; // instructions traced before this one
+    uint16_t pc;
+    uint16_t opcode;
+    uint8_t changes;    // C8TraceChange bits
+    uint16_t vs;        // bit n set when it changed Vn
+    uint16_t store;     // first address stored into
+    uint8_t store_len;  // bytes stored
+} C8TraceStep;
+
+// The machine is taken from the first instruction traced. From then on only
+// instructions traced and timer ticks may change it.
+C8TraceWriter *c8_trace_writer_create(const char *path);
+// c8_exec_instruction with the instruction recorded
+void c8_trace_exec(C8TraceWriter *trace, Chip8 *chip8, bool dbg);
+// Writes out what's left and frees the writer
+void c8_trace_writer_close(C8TraceWriter *trace);
+
+// NULL when the file can't be read or isn't a trace
+C8TraceReader *c8_trace_reader_open(const char *path);
+void c8_trace_reader_close(C8TraceReader *reader);
+// False at the end of the trace
+bool c8_trace_read(C8TraceReader *reader, C8TraceStep *step);
+// Registers, stack and ram as of the last step read, the screen is left blank
+const Chip8 *c8_trace_reader_machine(const C8TraceReader *reader);
+
+#endif
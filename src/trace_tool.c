@@ -0,0 +1,236 @@
+#include <unistd.h>
+
+#include "profile.h"
+#include "trace.h"
+
+static void usage(void) {
+    fprintf(stderr, "Usage: chip8-trace [-c first[:last]] [-p pc] [-w addr] [-s] <trace>\n"
+                    "       chip8-trace -d <trace> <other trace>\n"
+                    "  -c  only instructions first to last, counting from 0\n"
+                    "  -p  only instructions at this address\n"
+                    "  -w  only instructions that stored into this address\n"
+                    "  -s  print totals instead of instructions\n"
+                    "  -d  print the first instruction where the two traces differ\n");
+    exit(1);
+}
+
+// One line per instruction: where it ran, what it was and what it changed
+static void print_step(const C8TraceStep *step, const Chip8 *chip8) {
+    printf("%10llu  %03x  %04x  %-*s", (unsigned long long)step->index, step->pc,
+           step->opcode, step->changes ? 10 : 0, c8_op_class_name(c8_op_class(step->opcode)));
+
+    for(int i = 0; i < NUM_GPRS; i++) {
+        if(step->vs >> i & 1) {
+            printf(" V%X=%02x", i, chip8->V[i]);
+        }
+    }
+    if(step->changes & C8_TRACE_I) {
+        printf(" I=%03x", chip8->I);
+    }
+    if(step->changes & C8_TRACE_SP) {
+        printf(" sp=%u", chip8->sp);
+    }
+    if(step->changes & C8_TRACE_DELAY) {
+        printf(" dt=%u", chip8->delay_timer);
+    }
+    if(step->changes & C8_TRACE_SOUND) {
+        printf(" st=%u", chip8->sound_timer);
+    }
+    if(step->changes & C8_TRACE_STORE) {
+        uint32_t mask = c8_quirks_mem(c8_quirks(chip8->quirks)) - 1;
+        printf(" [%03x]=", step->store);
+        for(int i = 0; i < step->store_len; i++) {
+            printf("%02x", chip8->ram[(step->store + i) & mask]);
+        }
+    }
+    if(step->changes & C8_TRACE_JUMP) {
+        printf(" -> %03x", chip8->pc);
+    }
+    printf("\n");
+}
+
+static bool stored_into(const C8TraceStep *step, const Chip8 *chip8, uint16_t addr) {
+    uint32_t mask = c8_quirks_mem(c8_quirks(chip8->quirks)) - 1;
+    return (step->changes & C8_TRACE_STORE) &&
+           ((addr - step->store) & mask) < step->store_len;
+}
+
+static int query(const char *path, uint64_t first, uint64_t last, int pc, int addr,
+                 bool summary) {
+    C8TraceReader *reader = c8_trace_reader_open(path);
+    if(!reader) {
+        return 1;
+    }
+    const Chip8 *chip8 = c8_trace_reader_machine(reader);
+
+    C8TraceStep step;
+    uint64_t steps = 0;
+    uint64_t jumps = 0;
+    uint64_t stores = 0;
+    uint64_t ops[C8_NUM_OP_CLASSES] = {0};
+
+    while(c8_trace_read(reader, &step) && step.index <= last) {
+        if(step.index < first || (pc >= 0 && step.pc != pc) ||
+           (addr >= 0 && !stored_into(&step, chip8, addr))) {
+            continue;
+        }
+
+        steps++;
+        if(summary) {
+            jumps += (step.changes & C8_TRACE_JUMP) != 0;
+            stores += (step.changes & C8_TRACE_STORE) != 0;
+            ops[c8_op_class(step.opcode)]++;
+        } else {
+            print_step(&step, chip8);
+        }
+    }
+
+    if(summary) {
+        FILE *file = fopen(path, "rb");
+        long bytes = 0;
+        if(file) {
+            fseek(file, 0, SEEK_END);
+            bytes = ftell(file);
+            fclose(file);
+        }
+
+        printf("trace:        %s\n", path);
+        printf("quirks:       %s\n", c8_quirks_name(chip8->quirks));
+        printf("instructions: %llu\n", (unsigned long long)steps);
+        printf("jumps:        %llu\n", (unsigned long long)jumps);
+        printf("stores:       %llu\n", (unsigned long long)stores);
+        printf("file:         %ld bytes, %.2f per instruction\n", bytes,
+               steps ? (double)bytes / steps : 0.0);
+        for(int i = 0; i < C8_NUM_OP_CLASSES; i++) {
+            if(ops[i]) {
+                printf("  %-10s  %llu\n", c8_op_class_name(i), (unsigned long long)ops[i]);
+            }
+        }
+    }
+
+    c8_trace_reader_close(reader);
+    return 0;
+}
+
+static bool same_registers(const Chip8 *a, const Chip8 *b) {
+    return a->quirks == b->quirks && a->pc == b->pc && a->I == b->I && a->sp == b->sp &&
+           a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer &&
+           memcmp(a->V, b->V, sizeof a->V) == 0 &&
+           memcmp(a->stack, b->stack, sizeof a->stack) == 0;
+}
+
+// Whether the bytes one machine's step stored hold the same in the other
+static bool same_store(const C8TraceStep *step, const Chip8 *a, const Chip8 *b) {
+    uint32_t mask = c8_quirks_mem(c8_quirks(a->quirks)) - 1;
+    for(int i = 0; i < step->store_len; i++) {
+        uint32_t addr = (step->store + i) & mask;
+        if(a->ram[addr] != b->ram[addr]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The traces run side by side until one of them leaves its machine in a
+// different state
+static int diff(const char *path_a, const char *path_b) {
+    C8TraceReader *a = c8_trace_reader_open(path_a);
+    C8TraceReader *b = c8_trace_reader_open(path_b);
+    if(!a || !b) {
+        return 1;
+    }
+    const Chip8 *chip8_a = c8_trace_reader_machine(a);
+    const Chip8 *chip8_b = c8_trace_reader_machine(b);
+
+    if(!same_registers(chip8_a, chip8_b) ||
+       memcmp(chip8_a->ram, chip8_b->ram, sizeof chip8_a->ram) != 0) {
+        printf("the traces start from different machines\n");
+        return 1;
+    }
+
+    C8TraceStep step_a, step_b;
+    uint64_t steps = 0;
+    int differ = 0;
+
+    for(;;) {
+        bool more_a = c8_trace_read(a, &step_a);
+        bool more_b = c8_trace_read(b, &step_b);
+
+        if(!more_a || !more_b) {
+            if(more_a != more_b) {
+                printf("%s ends after %llu instructions\n", more_a ? path_b : path_a,
+                       (unsigned long long)steps);
+                differ = 1;
+            }
+            break;
+        }
+
+        // ram only changes where the steps stored
+        if(!same_registers(chip8_a, chip8_b) || !same_store(&step_a, chip8_a, chip8_b) ||
+           !same_store(&step_b, chip8_a, chip8_b)) {
+            printf("the traces differ after %llu instructions\n", (unsigned long long)steps);
+            printf("%s:\n", path_a);
+            print_step(&step_a, chip8_a);
+            printf("%s:\n", path_b);
+            print_step(&step_b, chip8_b);
+            differ = 1;
+            break;
+        }
+        steps++;
+    }
+
+    if(!differ) {
+        printf("the traces match for %llu instructions\n", (unsigned long long)steps);
+    }
+
+    c8_trace_reader_close(a);
+    c8_trace_reader_close(b);
+    return differ;
+}
+
+int main(int argc, char **argv) {
+    uint64_t first = 0;
+    uint64_t last = UINT64_MAX;
+    int pc = -1;
+    int addr = -1;
+    bool summary = false;
+    bool compare = false;
+    int opt;
+
+    while((opt = getopt(argc, argv, "c:p:w:sd")) != -1) {
+        switch(opt) {
+            case 'c': {
+                char *end;
+                first = strtoull(optarg, &end, 0);
+                last = *end == ':' ? strtoull(end + 1, NULL, 0) : UINT64_MAX;
+                break;
+            }
+            case 'p':
+                pc = strtoul(optarg, NULL, 16) & 0xFFFF;
+                break;
+            case 'w':
+                addr = strtoul(optarg, NULL, 16) & 0xFFFF;
+                break;
+            case 's':
+                summary = true;
+                break;
+            case 'd':
+                compare = true;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if(compare) {
+        if(argc - optind != 2) {
+            usage();
+        }
+        return diff(argv[optind], argv[optind + 1]);
+    }
+
+    if(argc - optind != 1) {
+        usage();
+    }
+    return query(argv[optind], first, last, pc, addr, summary);
+}
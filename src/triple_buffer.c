@@ -0,0 +1,31 @@
+#include "triple_buffer.h"
+
+#define FRESH 0x4
+#define SLOT 0x3
+
+void c8_triple_init(C8TripleBuffer *tb) {
+    memset(tb, 0, sizeof *tb);
+    tb->back = 0;
+    tb->middle = 1;
+    tb->front = 2;
+}
+
+C8Frame *c8_triple_back(C8TripleBuffer *tb) {
+    return &tb->slots[tb->back];
+}
+
+void c8_triple_publish(C8TripleBuffer *tb) {
+    // release: the frame's contents are visible before the slot is
+    uint8_t old = __atomic_exchange_n(&tb->middle, tb->back | FRESH, __ATOMIC_ACQ_REL);
+    tb->back = old & SLOT;
+}
+
+const C8Frame *c8_triple_acquire(C8TripleBuffer *tb) {
+    if(!(__atomic_load_n(&tb->middle, __ATOMIC_RELAXED) & FRESH)) {
+        return NULL;
+    }
+
+    uint8_t old = __atomic_exchange_n(&tb->middle, tb->front, __ATOMIC_ACQ_REL);
+    tb->front = old & SLOT;
+    return &tb->slots[tb->front];
+}
@@ -0,0 +1,35 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include "chip8.h"
+
+// Hands finished frames from one producer thread to one consumer thread
+// without either ever waiting on the other. The producer fills the back slot
+// and swaps it with the middle one, the consumer swaps the middle one for its
+// front slot whenever a fresh frame is there. Frames the consumer is too slow
+// to pick up are simply replaced.
+typedef struct C8Frame {
+    uint64_t screen[NUM_PLANES][SCREEN_WORDS][SCREEN_HEIGHT];
+    bool hires;
+    uint64_t number; // frames emulated when this one was published
+    uint64_t input_time; // the newest key event the machine had seen, 0 for none
+} __attribute__((aligned(64))) C8Frame;
+
+typedef struct C8TripleBuffer {
+    C8Frame slots[3];
+    uint8_t back;   // producer only
+    uint8_t front;  // consumer only
+    uint8_t middle; // slot index, with a fresh bit set once published
+} C8TripleBuffer;
+
+void c8_triple_init(C8TripleBuffer *tb);
+
+// The slot the producer fills next
+C8Frame *c8_triple_back(C8TripleBuffer *tb);
+void c8_triple_publish(C8TripleBuffer *tb);
+
+// The newest published frame, or NULL when nothing was published since the
+// last call. Stays valid until the next call.
+const C8Frame *c8_triple_acquire(C8TripleBuffer *tb);
+
+#endif